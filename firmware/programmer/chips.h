@@ -0,0 +1,61 @@
+// Chip descriptors for the National/TI Bipolar PROM programmer shield, shared by
+// the firmware and the host software
+//
+// (C) 2024 Eduardo Casino
+//
+// Permission is hereby granted, free of charge, to any person
+// obtaining a copy of this software and associated documentation
+// files (the “Software”), to deal in the Software without restriction,
+// including without limitation the rights to use, copy, modify, merge,
+// publish, distribute, sublicense, and/or sell copies of the Software,
+// and to permit persons to whom the Software is furnished to do so,
+// subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+// THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+//
+
+#ifndef CHIPS_H
+#define CHIPS_H
+
+// The socket has A0-A7 on port A and the S2 pin on PC7. On a part where S2 is a chip
+// select, it is asserted together with S1. On the others, S2 is address line 'a_s2'
+// and the lines above it go one bit down on port A
+//
+#define CHIP_S2_SELECT  0xFF
+
+// One line per part, in <CHIPNO> order: id, name, size, a_s2, pulse_min, pulse_length,
+// pulse_max and cooling_factor. Pulses are in ms: adaptive mode starts with pulse_min
+// and doubles up to pulse_max, fixed mode applies pulse_length. The datasheets guarantee
+// a bit is programmed with a 0.9ms pulse, max 10ms. The cooling delay after a pulse is
+// cooling_factor times its length: 3 keeps the nominal 25% duty cycle, 35% max
+//
+#define CHIP_TABLE( X ) \
+  X( CHIP_256X8, "74s471", 256, CHIP_S2_SELECT, 1, 5, 8, 3 ) \
+  X( CHIP_512X8, "74s472", 512, 5,              1, 5, 8, 3 )
+
+#define CHIP_ID( id, name, size, a_s2, pulse_min, pulse_length, pulse_max, cooling_factor ) id,
+#define CHIP_DESCRIPTOR( id, name, size, a_s2, pulse_min, pulse_length, pulse_max, cooling_factor ) \
+  { name, size, a_s2, pulse_min, pulse_length, pulse_max, cooling_factor },
+
+typedef enum { CHIP_TABLE( CHIP_ID ) NUM_CHIPS } chip_type_t;
+
+typedef struct {
+  const char *name;
+  unsigned int size;              // In bytes
+  unsigned char a_s2;             // Address line on the S2 pin, or CHIP_S2_SELECT
+  unsigned char pulse_min;
+  unsigned char pulse_length;
+  unsigned char pulse_max;
+  unsigned char cooling_factor;
+} chip_desc_t;
+
+#endif // CHIPS_H
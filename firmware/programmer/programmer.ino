@@ -27,7 +27,15 @@
 //            Read byte:           "r <CHIPNO> <ADDR>\n"
 //            Write byte:          "w <CHIPNO> <ADDR> <BYTE>\n"
 //            Simulate write byte: "s <CHIPNO> <ADDR> <BYTE>\n"
+//            Write block:         "W <CHIPNO> <ADDR> <COUNT> <DATA>\n"
+//            Simulate write block:"S <CHIPNO> <ADDR> <COUNT> <DATA>\n"
+//            Compare block:       "c <CHIPNO> <ADDR> <COUNT> <DATA>\n"
+//            Check block:         "C <CHIPNO> <ADDR> <COUNT> <DATA>\n"
 //            Blank check:         "K <CHIPNO>\n"
+//            Occupancy map:       "M <CHIPNO>\n"
+//            CRC of a range:      "H <CHIPNO> <ADDR> <COUNT>\n"
+//            Set pulse mode:      "P <MODE>\n"
+//            Query statistics:    "Q"
 //            Excute test          "t <CHIPNO> <TEST_NUM> <TEST_PARAM>\n"
 //                 0    Power test. Params:
 //                          0  Power off
@@ -40,11 +48,15 @@
 //                 2    Set address. Parameter is address number in hex
 //                 3    Set program bit to ground. Parameter is bit mask
 //
-// Where:     <CHIPNO> is 0 for 740/741 and 1 for 742/743
+// Where:     <CHIPNO> is 0 for 740/741 and 1 for 742/743, the chip types of chips.h
 //            <ADDR> is a three digit hex number in ascii
 //            <BYTE> is a two digit hex number in ascii
+//            <COUNT> is the number of bytes of the block, in hex
+//            <DATA> is a string of <COUNT> two digit hex numbers, without separators
+//            <MODE> is 0 for fixed programming pulses and 1 for adaptive ones
 //
-// (V)ersion returns the version string, followed by "\r\nR\r\n"
+// (V)ersion returns the version string, followed by "\r\nR\r\n". The same is sent
+//        as a ready banner after a reset
 // (R)ead prom returns the number of bytes read in hex, followed by "\r\n", followed
 //        by data as an string of 2-byte hex digits, followed by "\r\nR\r\n"
 // (r)ead returns the hex value, followed by "\r\nR\r\n"
@@ -53,6 +65,77 @@
 //        followed by "\r\nR\r\n"
 // Blan(K) test returns the last blank address read in hex (or the memory size if all
 //        blank), followed by "\r\nR\r\n"
+// Occupancy (M)ap reads the whole chip and returns a bitmap with a bit set for each
+//        byte that is not zero, <SIZE> / 8 bytes with address 0 in bit 0 of the first
+//        byte, followed by the programmed bits of each output, D0 first, as eight 16-bit
+//        little endian values. As a string of 2-byte hex digits, followed by "\r\nR\r\n"
+// (H)ash returns the CRC-32 (the zip one, poly 0xEDB88320 reflected, init and final xor
+//        0xFFFFFFFF) of the <COUNT> bytes from <ADDR> in hex, followed by "\r\nR\r\n"
+// (W)rite block programs the whole block and returns the value read after programming
+//        each byte, as a string of 2-byte hex digits, followed by "\r\nR\r\n". It stops
+//        at the first byte that could not be programmed, which is the last one returned.
+//        The pulses of up to SCHED_DEPTH bits are interleaved, so in adaptive mode some
+//        bits of the following bytes may have been programmed too
+// (S)imulate write block returns the values that (W)rite block would have returned
+// (c)ompare block reads the block from the chip and compares it with <DATA>. It returns
+//        a bitmap with a bit set for each byte that differs, (<COUNT> + 7) / 8 bytes with
+//        the first one in bit 0 of the first byte, followed by the values read for those
+//        bytes, in order. Both as a string of 2-byte hex digits, followed by "\r\nR\r\n"
+// (C)heck block tells if the chip can be programmed with <DATA>, without programming
+//        anything. It returns five 16-bit little endian values: the number of bytes that
+//        already have their value, the number of bytes that need programming, the number
+//        of bits to program, the number of bytes that can't be programmed because they
+//        have bits already programmed that are not in <DATA>, and the address of the
+//        first of them (or <ADDR> + <COUNT> if none). As a string of 2-byte hex digits,
+//        followed by "\r\nR\r\n"
+// Set (P)ulse mode just returns "R\r\n". It stays in effect until changed or the
+//        programmer is reset. Fixed mode applies a single pulse of the pulse_length of
+//        the chip per bit. Adaptive mode starts with its pulse_min and doubles the length
+//        up to its pulse_max until the bit is programmed. In both cases, the cooling delay
+//        after each pulse is cooling_factor times its length to keep the duty cycle
+// (Q)uery statistics returns six 32-bit little endian counters and clears them: the
+//        commands that returned "R", the ones that returned "E", the chip bytes read by
+//        the (R)ead, (r)ead, Blan(K), (M)ap, (H)ash, (c)ompare and (C)heck commands, the
+//        programming pulses, the total time in us at 10.5V and the pulses after which
+//        the bit was still not programmed. As a string of 2-byte hex digits, followed
+//        by "\r\nR\r\n". The response to a query counts for the next one
+//
+// Binary protocol:
+//
+// Every command above (but the test one) can also be sent as a binary frame:
+//
+//   <STX> <LEN> <CMD> <PARAMS> <CRC>
+//
+// Where:     <STX> is 0x02
+//            <LEN> is the length of <CMD> plus <PARAMS>, 16-bit little endian
+//            <CMD> is the command letter
+//            <PARAMS> are, in order and as needed by the command:
+//                 <CHIPNO>  1 byte
+//                 <ADDR>    2 bytes, little endian
+//                 <BYTE>    1 byte for (w)rite and (s)imulate, or
+//                 <MODE>    1 byte for set (P)ulse mode, alone
+//                 <COUNT>   2 bytes, little endian, for (r)ead, (H)ash and the block commands
+//                 <DATA>    <COUNT> bytes for (W)rite, (S)imulate, (c)ompare and (C)heck block
+//            <CRC> is the CRC-16/CCITT (poly 0x1021, init 0xFFFF) of <LEN>, <CMD>
+//                 and <PARAMS>, 16-bit little endian
+//
+// The response is a frame with the same layout, where <CMD> is the status ('R' or 'E')
+// and <PARAMS> is the returned data in binary: the version string for (V)ersion, the
+// bytes read for (r)ead and (R)ead whole PROM (without the count), the resulting byte
+// for (w)rite and (s)imulate, the 16-bit address for Blan(K) test, the 32-bit little
+// endian CRC for (H)ash, the bitmap and counts for (M)ap, the resulting bytes for (W)rite
+// and (S)imulate block, the bitmap and values for (c)ompare block, the five values for
+// (C)heck block and the six counters for (Q)uery statistics.
+//
+// Binary only commands:
+//
+//   Get (b)aud rates:  No params. Returns the supported rates, fastest first, as 32-bit
+//                      little endian numbers
+//   Set (B)aud rate:   <INDEX> of the rate in the list, 1 byte. The response is sent at
+//                      the current speed, then the programmer switches and waits for a
+//                      (T)est frame. If it does not get a valid one in BAUD_TIMEOUT, it
+//                      goes back to DEFAULT_BAUD. No test is needed for DEFAULT_BAUD itself
+//   (T)est:            <COUNT>, 2 bytes, and <DATA>. Returns <DATA>
 //
 
 // Address bus on port A:
@@ -93,17 +176,32 @@
 // VCC_EN  - PK1 - Pin A9
 // ~S1     - PK2 - Pin A10
 
-#define VERSION               "V010000"
-#define PROG_PULSE_LENGTH      5     // In ms. Datasheet guarantees bit is programmed with a 0.9ms pulse, max 10ms
-#define PROG_COOLING_DELAY    15     // In ms. Duty cycle is 25% nominal, 35% max, we go nominal
+#include "chips.h"
+
+#define VERSION               "V010100"
+#define SCHED_DEPTH            8     // Max pending pulses of the block scheduler
+
+#define FRAME_START         0x02     // STX
+#define FRAME_MAX_PARAMS       5     // Chip, address and value
+#define FRAME_TIMEOUT        100     // In ms. Max silence between two bytes of a binary frame
+
+#define DEFAULT_BAUD       57600
+#define BAUD_TIMEOUT         500     // In ms. Max wait for the test frame after a speed change
+#define TX_RING_SIZE         256     // Output waiting for room in the serial buffer. Byte indexes wrap by themselves
 
 #define VCC_EN    A9
 #define VCC_10V5  A8
 #define S1        A10
 #define S2        30
 
-typedef enum { CHIP_256X8 = 0, CHIP_512X8, NUM_CHIPS } chip_type_t;
-typedef enum { ST_ANY = 0, ST_READY, ST_WAIT_CHIP, ST_WAIT_ADDR, ST_WAIT_VALUE, ST_WAIT_TESTNO, ST_WAIT_TEST_PARAMS, ST_EXEC } state_t;
+// Same signals as bits of their ports, for direct port writes
+#define PK_10V5   B00000001
+#define PK_VCC_EN B00000010
+#define PK_S1     B00000100
+#define PC_S2     B10000000
+
+typedef enum { PULSE_FIXED = 0, PULSE_ADAPTIVE, NUM_PULSE_MODES } pulse_mode_t;
+typedef enum { ST_ANY = 0, ST_READY, ST_WAIT_CHIP, ST_WAIT_ADDR, ST_WAIT_VALUE, ST_WAIT_DATA, ST_WAIT_TESTNO, ST_WAIT_TEST_PARAMS, ST_EXEC } state_t;
 
 typedef struct {
   byte command;
@@ -121,17 +219,44 @@ typedef struct {
   state_t next_state;
 } st_machine_t;
 
+typedef struct {
+  word index;                     // Position in the block
+  byte mask;                      // Bit to program
+  byte pulse;                     // Length of its next pulse
+} pulse_t;
+
+typedef struct {
+  char command;
+  byte params;                    // Number of parameter bytes in the frame
+  byte first;                     // Position of the first one in the chip, address, value layout
+  bool data;                      // Parameters are followed by a data block
+} frame_cmd_t;
+
 state_t print_version( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
 
 state_t get_command( cmd_data_t *cmd_data, state_t unused, state_t next );
 state_t get_chip( cmd_data_t *cmd_data, state_t unused, state_t next );
 state_t get_address( cmd_data_t *cmd_data, state_t unused, state_t next );
 state_t get_value( cmd_data_t *cmd_data, state_t unused, state_t next );
+state_t get_data( cmd_data_t *cmd_data, state_t unused, state_t next );
+state_t get_mode( cmd_data_t *cmd_data, state_t unused, state_t next );
 
 state_t exec_read_prom( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_dump_prom( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
 state_t exec_blank_check( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_map( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_crc( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
 state_t exec_write_prom_byte( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
 state_t exec_simul_write_prom_byte( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_write_prom_block( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_simul_write_prom_block( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_compare_block( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_check_block( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_set_pulse_mode( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_stats( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_get_baud_rates( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_set_baud_rate( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
+state_t exec_echo( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
 state_t exec_test( cmd_data_t *cmd_data, state_t unused1, state_t unused2 );
 
 // State machine table
@@ -139,12 +264,21 @@ const st_machine_t machine[] = {
 
   { '*', ST_READY, get_command, ST_WAIT_CHIP },
   { 'V', ST_ANY, print_version, ST_READY },
+  { 'Q', ST_ANY, exec_stats, ST_READY },
   { 'K', ST_WAIT_CHIP, get_chip, ST_EXEC },
   { 'K', ST_EXEC, exec_blank_check, ST_READY },
+  { 'M', ST_WAIT_CHIP, get_chip, ST_EXEC },
+  { 'M', ST_EXEC, exec_map, ST_READY },
+  { 'R', ST_WAIT_CHIP, get_chip, ST_EXEC },
+  { 'R', ST_EXEC, exec_dump_prom, ST_READY },
   { 'r', ST_WAIT_CHIP, get_chip, ST_WAIT_ADDR },
   { 'r', ST_WAIT_ADDR, get_address, ST_WAIT_VALUE },
   { 'r', ST_WAIT_VALUE, get_value, ST_EXEC },
   { 'r', ST_EXEC, exec_read_prom, ST_READY },
+  { 'H', ST_WAIT_CHIP, get_chip, ST_WAIT_ADDR },
+  { 'H', ST_WAIT_ADDR, get_address, ST_WAIT_VALUE },
+  { 'H', ST_WAIT_VALUE, get_value, ST_EXEC },
+  { 'H', ST_EXEC, exec_crc, ST_READY },
   { 'w', ST_WAIT_CHIP, get_chip, ST_WAIT_ADDR },
   { 'w', ST_WAIT_ADDR, get_address, ST_WAIT_VALUE },
   { 'w', ST_WAIT_VALUE, get_value, ST_EXEC },
@@ -153,6 +287,31 @@ const st_machine_t machine[] = {
   { 's', ST_WAIT_ADDR, get_address, ST_WAIT_VALUE },
   { 's', ST_WAIT_VALUE, get_value, ST_EXEC },
   { 's', ST_EXEC, exec_simul_write_prom_byte, ST_READY },
+  { 'W', ST_WAIT_CHIP, get_chip, ST_WAIT_ADDR },
+  { 'W', ST_WAIT_ADDR, get_address, ST_WAIT_VALUE },
+  { 'W', ST_WAIT_VALUE, get_value, ST_WAIT_DATA },
+  { 'W', ST_WAIT_DATA, get_data, ST_EXEC },
+  { 'W', ST_EXEC, exec_write_prom_block, ST_READY },
+  { 'S', ST_WAIT_CHIP, get_chip, ST_WAIT_ADDR },
+  { 'S', ST_WAIT_ADDR, get_address, ST_WAIT_VALUE },
+  { 'S', ST_WAIT_VALUE, get_value, ST_WAIT_DATA },
+  { 'S', ST_WAIT_DATA, get_data, ST_EXEC },
+  { 'S', ST_EXEC, exec_simul_write_prom_block, ST_READY },
+  { 'c', ST_WAIT_CHIP, get_chip, ST_WAIT_ADDR },
+  { 'c', ST_WAIT_ADDR, get_address, ST_WAIT_VALUE },
+  { 'c', ST_WAIT_VALUE, get_value, ST_WAIT_DATA },
+  { 'c', ST_WAIT_DATA, get_data, ST_EXEC },
+  { 'c', ST_EXEC, exec_compare_block, ST_READY },
+  { 'C', ST_WAIT_CHIP, get_chip, ST_WAIT_ADDR },
+  { 'C', ST_WAIT_ADDR, get_address, ST_WAIT_VALUE },
+  { 'C', ST_WAIT_VALUE, get_value, ST_WAIT_DATA },
+  { 'C', ST_WAIT_DATA, get_data, ST_EXEC },
+  { 'C', ST_EXEC, exec_check_block, ST_READY },
+  { 'P', ST_WAIT_CHIP, get_mode, ST_EXEC },
+  { 'P', ST_EXEC, exec_set_pulse_mode, ST_READY },
+  { 'b', ST_EXEC, exec_get_baud_rates, ST_READY },    // No ascii version of these
+  { 'B', ST_EXEC, exec_set_baud_rate, ST_READY },
+  { 'T', ST_EXEC, exec_echo, ST_READY },
 #ifdef TEST
   { 't', ST_WAIT_CHIP, get_chip, ST_WAIT_TESTNO },
   { 't', ST_WAIT_TESTNO, get_value, ST_WAIT_TEST_PARAMS },
@@ -162,39 +321,106 @@ const st_machine_t machine[] = {
   { 0 }
 };
 
-const unsigned int chip_sizes[NUM_CHIPS] = { 256, 512 };
+// Binary frame commands. They share the execution functions with the ascii ones
+const frame_cmd_t frame_commands[] = {
+  { 'V', 0, 0, false },
+  { 'Q', 0, 0, false },
+  { 'K', 1, 0, false },
+  { 'M', 1, 0, false },
+  { 'R', 1, 0, false },
+  { 'r', 5, 0, false },
+  { 'H', 5, 0, false },
+  { 'w', 4, 0, false },
+  { 's', 4, 0, false },
+  { 'W', 5, 0, true },
+  { 'S', 5, 0, true },
+  { 'c', 5, 0, true },
+  { 'C', 5, 0, true },
+  { 'P', 1, 3, false },
+  { 'b', 0, 0, false },
+  { 'B', 1, 3, false },
+  { 'T', 2, 3, true },
+  { 0 }
+};
+
+constexpr chip_desc_t chips[NUM_CHIPS] = { CHIP_TABLE( CHIP_DESCRIPTOR ) };
+
+// Exact or within 2.1% with a 16MHz clock
+const unsigned long baud_rates[] = { 1000000, 500000, 250000, 115200, DEFAULT_BAUD };
+#define NUM_BAUD_RATES ( sizeof( baud_rates ) / sizeof( baud_rates[0] ) )
+
+byte block[512];                  // Data for the block commands, big enough for the largest chip
+byte mismatches[512 / 8];         // Bitmap of the bytes that differ, for the compare command, or
+                                  // of the ones that are not zero, for the map
+
+// Responses are queued here and moved to the serial buffer when it has room, so the
+// chip is read while the UART sends what came before. It is empty between commands
+byte tx_ring[TX_RING_SIZE];
+byte tx_head = 0;
+byte tx_tail = 0;
+
+const char hex_digits[] = "0123456789ABCDEF";
 
+pulse_mode_t pulse_mode = PULSE_FIXED;
+
+// Duty cycle budget: no new pulse until 'cooling_time' us after the end of the last one
+unsigned long pulse_end;
+unsigned long cooling_time = 0;
+
+pulse_t sched[SCHED_DEPTH];       // Pending pulses of the block scheduler, a circular queue
+
+bool framed = false;              // True while executing a command received in a binary frame
+bool reply_open = false;          // True if the header of the binary response has been sent
+word reply_crc;
+
+// Counters for the (Q)uery statistics command, in its response order
+struct {
+  unsigned long commands;         // Answered with "R"
+  unsigned long errors;           // Answered with "E"
+  unsigned long bytes_read;       // By the scanning commands
+  unsigned long pulses;
+  unsigned long pulse_time;       // In us, at 10.5V
+  unsigned long verify_failures;  // Pulses that did not program the bit
+} stats;
+
+// The lines of the chip come from its descriptor. With a constant chip type, as in the
+// fast read engine, the lookups fold away and just the port writes of that chip are left
+//
 inline void set_address( chip_type_t chip_type, unsigned int address ) __attribute__( ( always_inline ) );
 void set_address( chip_type_t chip_type, unsigned int address )
 {
-  if ( CHIP_256X8 == chip_type )
+  const byte a_s2 = chips[chip_type].a_s2;
+
+  if ( CHIP_S2_SELECT == a_s2 )
   {
     PORTA = address;
   }
   else
   {
-    PORTA = ( address & B00011111 ) | ( ( address >> 1 ) & B11100000 );
-    PORTC = ( PORTC   & B01111111 ) | ( ( address << 2 ) & B10000000 );
+    const byte low = ( 1 << a_s2 ) - 1;
+
+    PORTA = ( address & low ) | ( ( address >> 1 ) & ~low );
+    PORTC = ( PORTC & ~PC_S2 ) | ( ( ( address >> a_s2 ) & 1 ) ? PC_S2 : 0 );
   }
 }
 
 inline void enable_10V5( void ) __attribute__( ( always_inline ) );
 void enable_10V5( void )
 {
-  digitalWrite( VCC_10V5, HIGH );
+  PORTK |= PK_10V5;
 }
 
 inline void disable_10V5( void ) __attribute__( ( always_inline ) );
 void disable_10V5( void )
 {
-  digitalWrite( VCC_10V5, LOW );
+  PORTK &= ~PK_10V5;
 }
 
 inline void _power_on( void ) __attribute__( ( always_inline ) );
 void _power_on( void )
 {
   // Power on chip
-  digitalWrite( VCC_EN, LOW );
+  PORTK &= ~PK_VCC_EN;
 } 
 
 inline void power_on( void ) __attribute__( ( always_inline ) );
@@ -209,27 +435,27 @@ void power_on( void )
 inline void power_off( void ) __attribute__( ( always_inline ) );
 void power_off( void )
 {
-  digitalWrite( VCC_EN, HIGH );
+  PORTK |= PK_VCC_EN;
 }
 
 inline void output_enable( chip_type_t chip_type ) __attribute__( ( always_inline ) );
 void output_enable( chip_type_t chip_type )
 {
-  if ( CHIP_256X8 == chip_type )
+  if ( CHIP_S2_SELECT == chips[chip_type].a_s2 )
   {
-    digitalWrite( S2, LOW );
+    PORTC &= ~PC_S2;
   }
-  digitalWrite( S1, LOW );
+  PORTK &= ~PK_S1;
 }
 
 inline void output_disable( chip_type_t chip_type ) __attribute__( ( always_inline ) );
 void output_disable( chip_type_t chip_type )
 {
-  if ( CHIP_256X8 == chip_type )
+  if ( CHIP_S2_SELECT == chips[chip_type].a_s2 )
   {
-    digitalWrite( S2, HIGH );
+    PORTC |= PC_S2;
   }
-  digitalWrite( S1, HIGH );
+  PORTK |= PK_S1;
 }
 
 inline void ground_pins( byte mask ) __attribute__( ( always_inline ) );
@@ -244,15 +470,18 @@ void pullup_pins( byte mask )
   PORTL &= ~mask;
 }
 
-inline void prog_bit( chip_type_t chip_type, byte mask ) __attribute__( ( always_inline ) );
-void prog_bit( chip_type_t chip_type, byte mask )
+inline void prog_bit( chip_type_t chip_type, byte mask, byte pulse ) __attribute__( ( always_inline ) );
+void prog_bit( chip_type_t chip_type, byte mask, byte pulse )
 {
+  unsigned long start;
+
   // 1. Connect each output not being programmed to 5 V through 3K9 and apply the voltage
   //    specified in the table to the output to be programmed
   ground_pins( mask );
   
   // 2. Step Vcc to 10.5 V nominal
   enable_10V5();
+  start = micros();
 
   // 3. Apply a low-logic-level voltage to the chip-select input(s). This should occur between
   //    10 us and 1 ms after Vcc has reached its 10V5 level.
@@ -261,13 +490,17 @@ void prog_bit( chip_type_t chip_type, byte mask )
 
   // 4. After the X pulse time is reached, a high logic level is applied to the chip-select
   //    inputs to disable the outputs. 
-  delay( PROG_PULSE_LENGTH );
+  delay( pulse );
   output_disable( chip_type );
 
   // 5. Within 10 us to 1 ms after the chip-select input(s) reach a high logic level,
   //    Vcc should be stepped down to 5V, at which level verification can be accomplished.
+  delayMicroseconds( 10 );
   disable_10V5();
   pullup_pins( mask );
+
+  stats.pulse_time += micros() - start;
+  ++stats.pulses;
 }
 
 // Returns true if the bit is programmed
@@ -283,10 +516,194 @@ bool read_bit( chip_type_t chip_type, byte mask )
   return value;
 }
 
+word crc16_update( word crc, byte data )
+{
+  crc ^= (word) data << 8;
+
+  for ( int bit = 0; bit < 8; ++bit )
+  {
+    crc = ( crc & 0x8000 ) ? ( crc << 1 ) ^ 0x1021 : crc << 1;
+  }
+
+  return crc;
+}
+
+unsigned long crc32_update( unsigned long crc, byte data )
+{
+  crc ^= data;
+
+  for ( int bit = 0; bit < 8; ++bit )
+  {
+    crc = ( crc & 1 ) ? ( crc >> 1 ) ^ 0xEDB88320UL : crc >> 1;
+  }
+
+  return crc;
+}
+
+// Moves to the serial buffer as much output as fits there without waiting
+void tx_drain( void )
+{
+  int room = Serial.availableForWrite();
+
+  while ( room-- > 0 && tx_tail != tx_head )
+  {
+    Serial.write( tx_ring[tx_tail++] );
+  }
+}
+
+void tx_put( byte data )
+{
+  while ( (byte) ( tx_head + 1 ) == tx_tail )
+  {
+    tx_drain();
+  }
+  tx_ring[tx_head++] = data;
+}
+
+// Sends everything queued. Needed before writing to Serial directly
+void tx_flush( void )
+{
+  while ( tx_tail != tx_head )
+  {
+    tx_drain();
+  }
+}
+
+void frame_put( byte data )
+{
+  reply_crc = crc16_update( reply_crc, data );
+  tx_put( data );
+}
+
+// Sends the header of a binary response with 'len' bytes of data
+void frame_begin( byte status, word len )
+{
+  ++len;                              // Account for the status byte
+
+  reply_crc = 0xFFFF;
+  tx_put( FRAME_START );
+  frame_put( len & 0xFF );
+  frame_put( len >> 8 );
+  frame_put( status );
+  reply_open = true;
+}
+
+void frame_end( void )
+{
+  word crc = reply_crc;
+
+  tx_put( crc & 0xFF );
+  tx_put( crc >> 8 );
+  tx_flush();
+  reply_open = false;
+  framed = false;
+}
+
+// Start of the data returned by a command. Only needed by the binary protocol
+void reply_begin( word len )
+{
+  if ( framed )
+  {
+    frame_begin( 'R', len );
+  }
+}
+
+// Sends a data byte, as two hex digits or raw
+void reply_data( byte data )
+{
+  if ( framed )
+  {
+    frame_put( data );
+  }
+  else
+  {
+    tx_put( hex_digits[data >> 4] );
+    tx_put( hex_digits[data & 0x0F] );
+  }
+  tx_drain();
+}
+
+// Sends a single value of 'size' bytes, as a hex number or raw little endian
+void reply_value( word value, byte size )
+{
+  if ( framed )
+  {
+    frame_put( value & 0xFF );
+    if ( size > 1 )
+    {
+      frame_put( value >> 8 );
+    }
+  }
+  else
+  {
+    tx_flush();
+    Serial.println( value, HEX );
+  }
+}
+
+// Same for a 32-bit value
+void reply_value32( unsigned long value )
+{
+  if ( framed )
+  {
+    for ( byte i = 0; i < 4; ++i, value >>= 8 )
+    {
+      frame_put( value & 0xFF );
+    }
+  }
+  else
+  {
+    tx_flush();
+    Serial.println( value, HEX );
+  }
+}
+
+// Sends a string, as is or as the data of a binary response
+void reply_string( const char *string )
+{
+  if ( framed )
+  {
+    frame_begin( 'R', strlen( string ) );
+    while ( *string )
+    {
+      frame_put( *string++ );
+    }
+  }
+  else
+  {
+    tx_flush();
+    Serial.println( string );
+  }
+}
+
+// End of the data returned by a command
+void reply_end( void )
+{
+  if ( !framed )
+  {
+    tx_flush();
+    Serial.println( "" );
+  }
+}
+
 inline state_t _set_st_ready( void ) __attribute__( ( always_inline ) );
 state_t _set_st_ready( void )
 {
-  Serial.println( "R" );
+  ++stats.commands;
+
+  if ( framed )
+  {
+    if ( !reply_open )
+    {
+      frame_begin( 'R', 0 );
+    }
+    frame_end();
+  }
+  else
+  {
+    tx_flush();
+    Serial.println( "R" );
+  }
 
   return ST_READY;
 }
@@ -302,7 +719,19 @@ state_t set_st_ready( void )
 inline state_t _set_st_error( void ) __attribute__( ( always_inline ) );
 state_t _set_st_error( void )
 {
-  Serial.println( "E" );
+  ++stats.errors;
+
+  if ( framed )
+  {
+    // Errors are always detected before any data is sent
+    frame_begin( 'E', 0 );
+    frame_end();
+  }
+  else
+  {
+    tx_flush();
+    Serial.println( "E" );
+  }
 
   return ST_READY;
 }
@@ -330,6 +759,32 @@ void wait_first_non_blank( void )
   }
 }
 
+byte get_char( void )
+{
+  while ( !Serial.available() )
+    ;
+  return Serial.read();
+}
+
+// Returns the value of a hex digit, or -1 if it is not one
+int hex_value( byte digit )
+{
+  if ( digit >= '0' && digit <= '9' )
+  {
+    return digit - '0';
+  }
+  else if ( digit >= 'A' && digit <= 'F' )
+  {
+    return digit - 'A' + 10;
+  }
+  else if ( digit >= 'a' && digit <= 'f' )
+  {
+    return digit - 'a' + 10;
+  }
+
+  return -1;
+}
+
 long int get_hex( void )
 {
   byte digit;
@@ -339,26 +794,12 @@ long int get_hex( void )
 
   do
   {
-    while ( !Serial.available() )
-      ;
-    digit = Serial.read();
+    digit = get_char();
 
     if ( isHexadecimalDigit( digit ) )
     {
       hex <<= 4;
-
-      if ( digit >= '0' && digit <= '9' )
-      {
-        hex += digit - '0';
-      }
-      else if ( digit >= 'A' && digit <= 'F' )
-      {
-        hex += digit - 'A' + 10;
-      }
-      else if ( digit >= 'a' && digit <= 'f' )
-      {
-        hex += digit - 'a' + 10;
-      }
+      hex += hex_value( digit );
     }
     else if ( !isSpace( digit ) )
     {
@@ -369,11 +810,137 @@ long int get_hex( void )
   return hex;
 }
 
+// Checks that a block fits in the chip
+bool valid_block( cmd_data_t *cmd_data )
+{
+  return cmd_data->value > 0 && cmd_data->address + cmd_data->value <= chips[cmd_data->chip].size;
+}
+
+// Returns the next byte of a binary frame, or -1 on timeout
+int frame_get( word *crc )
+{
+  unsigned long start = millis();
+  byte data;
+
+  while ( !Serial.available() )
+  {
+    if ( millis() - start > FRAME_TIMEOUT )
+    {
+      return -1;
+    }
+  }
+  data = Serial.read();
+  *crc = crc16_update( *crc, data );
+
+  return data;
+}
+
+// Gets a 16-bit little endian word from a binary frame
+bool frame_get_word( word *value, word *crc )
+{
+  int low, high;
+
+  if ( ( low = frame_get( crc ) ) < 0 || ( high = frame_get( crc ) ) < 0 )
+  {
+    return false;
+  }
+  *value = low | ( high << 8 );
+
+  return true;
+}
+
+// Discards any input until the line is silent, so we resync after a bad frame
+state_t frame_error( void )
+{
+  word unused;
+
+  while ( frame_get( &unused ) >= 0 )
+    ;
+
+  return set_st_error();
+}
+
+state_t get_frame( cmd_data_t *cmd_data )
+{
+  const frame_cmd_t *frame_cmd;
+  byte params[FRAME_MAX_PARAMS] = { 0 };
+  word crc = 0xFFFF;
+  word len, frame_crc, unused;
+  int c, i;
+
+  framed = true;
+
+  if ( !frame_get_word( &len, &crc ) || ( c = frame_get( &crc ) ) < 0 )
+  {
+    return frame_error();
+  }
+  cmd_data->command = c;
+
+  for ( frame_cmd = frame_commands; frame_cmd->command && frame_cmd->command != c; ++frame_cmd )
+    ;
+
+  if ( !frame_cmd->command || ( !frame_cmd->data && len != frame_cmd->params + 1 ) )
+  {
+    return frame_error();
+  }
+
+  for ( i = 0; i < frame_cmd->params; ++i )
+  {
+    if ( ( c = frame_get( &crc ) ) < 0 )
+    {
+      return frame_error();
+    }
+    params[frame_cmd->first + i] = c;
+  }
+
+  cmd_data->chip = params[0];
+  cmd_data->address = params[1] | ( params[2] << 8 );
+  cmd_data->value = params[3] | ( params[4] << 8 );
+
+  if ( frame_cmd->data )
+  {
+    if ( cmd_data->chip >= NUM_CHIPS || !valid_block( cmd_data ) || len != frame_cmd->params + 1 + cmd_data->value )
+    {
+      return frame_error();
+    }
+
+    for ( i = 0; i < cmd_data->value; ++i )
+    {
+      if ( ( c = frame_get( &crc ) ) < 0 )
+      {
+        return frame_error();
+      }
+      block[i] = c;
+    }
+  }
+
+  if ( !frame_get_word( &frame_crc, &unused ) || frame_crc != crc )
+  {
+    return frame_error();
+  }
+
+  // Same validations as for the ascii protocol
+  if ( frame_cmd->first > 0 )
+  {
+    // No chip, the execution function validates the parameter
+    return ST_EXEC;
+  }
+
+  if ( ( frame_cmd->params > 0 && cmd_data->chip >= NUM_CHIPS )
+      || ( frame_cmd->params > 1 && cmd_data->address >= chips[cmd_data->chip].size )
+      || ( frame_cmd->params > 3 && cmd_data->value > chips[cmd_data->chip].size ) )
+  {
+    return set_st_error();
+  }
+
+  return ST_EXEC;
+}
+
 state_t get_value( cmd_data_t *cmd_data, state_t unused, state_t next )
 {
   long int value = get_hex();
 
-  if (value < 0 || value > chip_sizes[cmd_data->chip] )
+  if (value < 0 || value > chips[cmd_data->chip].size )
   {
     return set_st_error();
   }
@@ -383,11 +950,49 @@ state_t get_value( cmd_data_t *cmd_data, state_t unused, state_t next )
   return next; 
 }
 
+state_t get_data( cmd_data_t *cmd_data, state_t unused, state_t next )
+{
+  int high, low;
+
+  // 'value' is the block size
+  if ( !valid_block( cmd_data ) )
+  {
+    return set_st_error();
+  }
+
+  wait_first_non_blank();
+
+  for ( word i = 0; i < cmd_data->value; ++i )
+  {
+    if ( ( high = hex_value( get_char() ) ) < 0 || ( low = hex_value( get_char() ) ) < 0 )
+    {
+      return set_st_error();
+    }
+    block[i] = ( high << 4 ) | low;
+  }
+
+  return next;
+}
+
+state_t get_mode( cmd_data_t *cmd_data, state_t unused, state_t next )
+{
+  long int mode = get_hex();
+
+  if ( mode < 0 || mode >= NUM_PULSE_MODES )
+  {
+    return set_st_error();
+  }
+
+  cmd_data->value = (word) mode;
+
+  return next; 
+}
+
 state_t get_address( cmd_data_t *cmd_data, state_t unused, state_t next )
 {
   long int address = get_hex();
 
-  if ( address < 0 || address >= chip_sizes[cmd_data->chip] )
+  if ( address < 0 || address >= chips[cmd_data->chip].size )
   {
     return set_st_error();
   }
@@ -405,6 +1010,11 @@ state_t get_command( cmd_data_t *cmd_data, state_t unused, state_t next )
 
   cmd_data->command = Serial.read();
 
+  if ( FRAME_START == cmd_data->command )
+  {
+    return get_frame( cmd_data );
+  }
+
   for ( c = 0; machine[c].command != cmd_data->command; ++c )
     ;
     
@@ -422,7 +1032,7 @@ state_t get_chip( cmd_data_t *cmd_data, state_t unused, state_t next )
 
   char chip_c = Serial.read();
 
-  if ( chip_c != '0' && chip_c != '1' )
+  if ( chip_c < '0' || chip_c >= '0' + NUM_CHIPS )
   {
      return set_st_error();
   }
@@ -444,8 +1054,68 @@ byte read_prom_byte( chip_type_t chip_type, unsigned int address )
   return value;
 }
 
-#ifdef TEST
-state_t exec_test( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+// Fast read engine. It is specialized at compile time for each chip descriptor, so there
+// are no branches on it, and the outputs stay enabled while the address changes. The chip
+// must be powered on
+//
+template <chip_type_t CHIP> inline byte fast_read( word address ) __attribute__( ( always_inline ) );
+template <chip_type_t CHIP> byte fast_read( word address )
+{
+  set_address( CHIP, address );
+  asm ("nop\n\tnop\n\t");            // 125ns, the max address access time is 60ns
+
+  return PINF;
+}
+
+// Calls 'op( address, data )' for every byte in [address, end) until it returns false.
+// Returns the address where it stopped, or 'end'
+//
+template <chip_type_t CHIP, typename OP> word scan_chip( word address, word end, OP op )
+{
+  word start = address;
+
+  output_enable( CHIP );
+
+  // Unrolled by four
+  while ( end - address >= 4 )
+  {
+    if ( !op( address, fast_read<CHIP>( address ) ) ) goto stop;
+    ++address;
+    if ( !op( address, fast_read<CHIP>( address ) ) ) goto stop;
+    ++address;
+    if ( !op( address, fast_read<CHIP>( address ) ) ) goto stop;
+    ++address;
+    if ( !op( address, fast_read<CHIP>( address ) ) ) goto stop;
+    ++address;
+  }
+
+  while ( address < end && op( address, fast_read<CHIP>( address ) ) )
+  {
+    ++address;
+  }
+
+stop:
+  output_disable( CHIP );
+
+  // Including the one 'op' stopped at
+  stats.bytes_read += address - start + ( address < end );
+
+  return address;
+}
+
+template <typename OP> word fast_scan( chip_type_t chip_type, word address, word count, OP op )
+{
+  switch ( chip_type )
+  {
+#define SCAN_CHIP( id, ... ) case id: return scan_chip<id>( address, address + count, op );
+    CHIP_TABLE( SCAN_CHIP )
+#undef SCAN_CHIP
+    default: return address;
+  }
+}
+
+#ifdef TEST
+state_t exec_test( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
 {
   unsigned long start, now;
   byte mask;
@@ -522,24 +1192,81 @@ state_t exec_test( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
 }
 #endif
 
-state_t write_prom_byte( cmd_data_t *cmd_data, bool do_write )
+// True if the duty cycle allows a new pulse
+inline bool cooled( void ) __attribute__( ( always_inline ) );
+bool cooled( void )
+{
+  return micros() - pulse_end >= cooling_time;
+}
+
+// Pulses a bit at the address already in the bus, as soon as the duty cycle allows it.
+// Chip must be powered on. Returns true if it took
+bool pulse_bit( chip_type_t chip_type, byte mask, byte pulse )
 {
-  byte existing, returned, mask;
   bool programmed;
+
+  while ( !cooled() )
+    ;
+
+  prog_bit( chip_type, mask, pulse );
+  delayMicroseconds( 10 );
+  // Verify that bit is programmed
+  programmed = read_bit( chip_type, mask );
+  if ( !programmed )
+  {
+    ++stats.verify_failures;
+  }
+
+  // Cool down in proportion to the pulse actually applied
+  pulse_end = micros();
+  cooling_time = pulse * chips[chip_type].cooling_factor * 1000UL;
+
+  return programmed;
+}
+
+inline byte first_pulse( chip_type_t chip_type ) __attribute__( ( always_inline ) );
+byte first_pulse( chip_type_t chip_type )
+{
+  return ( PULSE_ADAPTIVE == pulse_mode ) ? chips[chip_type].pulse_min : chips[chip_type].pulse_length;
+}
+
+// Programs a bit at the address already in the bus. Returns true if it took
+bool burn_bit( chip_type_t chip_type, byte mask )
+{
+  byte pulse = first_pulse( chip_type );
+
+  while ( !pulse_bit( chip_type, mask, pulse ) )
+  {
+    if ( PULSE_ADAPTIVE != pulse_mode || pulse >= chips[chip_type].pulse_max )
+    {
+      return false;
+    }
+
+    // Didn't take, try a longer one
+    pulse <<= 1;
+  }
+
+  return true;
+}
+
+// Returns the value read after programming
+byte program_byte( chip_type_t chip_type, word address, byte value, bool do_write )
+{
+  byte existing, returned, mask;
   
   power_on();
 
-  existing = read_prom_byte( cmd_data->chip, cmd_data->address );    // This also set the address bus
+  existing = read_prom_byte( chip_type, address );    // This also set the address bus
   returned = existing;
 
-  if ( existing != cmd_data->value )
+  if ( existing != value )
   {
     for ( int bit = 0; bit < 8; ++bit )
     {
       mask = 1 << bit;
 
       // Check every bit to see if it needs programming
-      if ( (existing & mask) != (cmd_data->value & mask) )
+      if ( (existing & mask) != (value & mask) )
       {
         // Bits are different
         if ( ! (existing & mask) )
@@ -547,24 +1274,10 @@ state_t write_prom_byte( cmd_data_t *cmd_data, bool do_write )
           // They are different, but it is not programmed. Okay, burn it
           // Address was already set by read_prom_byte()
           //
-          if ( do_write )
+          if ( do_write && ! burn_bit( chip_type, mask ) )
           {
-            _power_on();
-
-            prog_bit( cmd_data->chip, mask );
-            delayMicroseconds( 10 );
-            // Verify that bit is programmed
-            programmed = read_bit( cmd_data->chip, mask );
-      
-            power_off();
-
-            delay( PROG_COOLING_DELAY );
-
-            if ( ! programmed )
-            {
-              // Stop here, there was a problem programming the last bit
-              break;
-            }
+            // Stop here, there was a problem programming the last bit
+            break;
           }
 
           returned |= mask;
@@ -578,8 +1291,168 @@ state_t write_prom_byte( cmd_data_t *cmd_data, bool do_write )
     }
   }
   
+  return returned;
+}
+
+state_t write_prom_byte( cmd_data_t *cmd_data, bool do_write )
+{
+  byte returned = program_byte( cmd_data->chip, cmd_data->address, cmd_data->value, do_write );
+
   // Return programmed value
-  Serial.println( returned, HEX );
+  reply_begin( 1 );
+  reply_value( returned, 1 );
+
+  return set_st_ready();
+}
+
+// Programs the whole block, replacing each byte with the value read back. Returns
+// the number of bytes up to and including the first one that failed.
+//
+// Only one bit is pulsed at a time, but instead of waiting for the cooling after each
+// pulse, the scheduler keeps a queue of pending bits. While the duty cycle does not
+// allow a new pulse, it examines the next bytes to queue their bits and reads back the
+// finished ones. In adaptive mode, a bit that did not take goes back to the end of the
+// queue with a longer pulse, so the bits of other addresses fill its cooling time.
+//
+word schedule_block( cmd_data_t *cmd_data )
+{
+  chip_type_t chip_type = cmd_data->chip;
+  word count = cmd_data->value;
+  word failed = count;            // First byte that could not be programmed
+  word planned = 0;               // Next byte to examine
+  word verified = 0;              // Next byte to read back
+  byte pending = 0;               // Bits of block[planned] not queued yet
+  byte head = 0, queued = 0;
+  byte existing, i;
+  pulse_t *entry;
+  word done;
+
+  power_on();
+
+  for ( ;; )
+  {
+    if ( queued && cooled() )
+    {
+      entry = &sched[head];
+      head = ( head + 1 ) % SCHED_DEPTH;
+      --queued;
+
+      if ( entry->index >= failed )
+      {
+        // Don't go further than a failed byte
+        continue;
+      }
+
+      set_address( chip_type, cmd_data->address + entry->index );
+
+      if ( !pulse_bit( chip_type, entry->mask, entry->pulse ) )
+      {
+        if ( PULSE_ADAPTIVE == pulse_mode && entry->pulse < chips[chip_type].pulse_max )
+        {
+          // Retry later with a longer one. The slot of the head is free, so no overflow
+          sched[( head + queued++ ) % SCHED_DEPTH] = { entry->index, entry->mask, (byte) ( entry->pulse << 1 ) };
+        }
+        else
+        {
+          failed = entry->index;
+        }
+      }
+    }
+    else if ( planned < failed && queued < SCHED_DEPTH )
+    {
+      if ( !pending )
+      {
+        existing = read_prom_byte( chip_type, cmd_data->address + planned );
+
+        if ( existing & ~block[planned] )
+        {
+          // Bits are different and already programmed
+          failed = planned;
+          continue;
+        }
+
+        if ( !( pending = block[planned] & ~existing ) )
+        {
+          ++planned;
+          continue;
+        }
+      }
+
+      // Queue the lowest pending bit
+      sched[( head + queued++ ) % SCHED_DEPTH] = { planned, (byte) ( pending & -pending ), first_pulse( chip_type ) };
+      pending &= pending - 1;
+
+      if ( !pending )
+      {
+        ++planned;
+      }
+    }
+    else
+    {
+      // Bytes before the first one with queued or unqueued bits are finished
+      done = ( planned < failed ) ? planned : failed;
+      for ( i = 0; i < queued; ++i )
+      {
+        entry = &sched[( head + i ) % SCHED_DEPTH];
+        if ( entry->index < done )
+        {
+          done = entry->index;
+        }
+      }
+
+      if ( verified < done )
+      {
+        block[verified] = read_prom_byte( chip_type, cmd_data->address + verified );
+        ++verified;
+      }
+      else if ( !queued )
+      {
+        break;
+      }
+    }
+  }
+
+  // Include the failed one
+  if ( failed < count )
+  {
+    block[failed] = read_prom_byte( chip_type, cmd_data->address + failed );
+    count = failed + 1;
+  }
+
+  return count;
+}
+
+state_t write_prom_block( cmd_data_t *cmd_data, bool do_write )
+{
+  word count = 0;
+  byte expected;
+
+  if ( do_write )
+  {
+    count = schedule_block( cmd_data );
+  }
+  else
+  {
+    // Simulation, byte by byte
+    while ( count < cmd_data->value )
+    {
+      expected = block[count];
+      block[count] = program_byte( cmd_data->chip, cmd_data->address + count, expected, false );
+
+      if ( block[count++] != expected )
+      {
+        // Stop at the first failure
+        break;
+      }
+    }
+  }
+
+  reply_begin( count );
+  for ( word i = 0; i < count; ++i )
+  {
+    reply_data( block[i] );
+  }
+  reply_end();
 
   return set_st_ready();
 }
@@ -594,46 +1467,306 @@ state_t exec_simul_write_prom_byte( cmd_data_t *cmd_data, state_t unused1, state
   return write_prom_byte( cmd_data, false );
 }
 
-state_t exec_read_prom( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+state_t exec_write_prom_block( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
 {
-  unsigned int address;
-  byte data;
+  return write_prom_block( cmd_data, true );
+}
+
+state_t exec_simul_write_prom_block( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  return write_prom_block( cmd_data, false );
+}
+
+// Only the differences go back, so a good block costs just the bitmap
+state_t exec_compare_block( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  word start = cmd_data->address;
+  word bitmap_size = ( cmd_data->value + 7 ) / 8;
+  word count = 0;
+
+  memset( mismatches, 0, bitmap_size );
 
   power_on();
 
-  for ( address = cmd_data->address; address < cmd_data->address+cmd_data->value; ++address )
+  // The values read replace the expected ones at the start of the block, never ahead
+  // of the one being compared
+  fast_scan( cmd_data->chip, start, cmd_data->value, [start, &count]( word address, byte data ) {
+    word i = address - start;
+
+    if ( data != block[i] )
+    {
+      mismatches[i / 8] |= 1 << ( i % 8 );
+      block[count++] = data;
+    }
+    return true;
+  } );
+
+  reply_begin( bitmap_size + count );
+  for ( word i = 0; i < bitmap_size; ++i )
+  {
+    reply_data( mismatches[i] );
+  }
+  for ( word i = 0; i < count; ++i )
   {
-    data = read_prom_byte( cmd_data->chip, address ); 
-    Serial.print( data < 16 ? "0" : "");
-    Serial.print( data, HEX );
+    reply_data( block[i] );
   }
-  Serial.println( "" );
+  reply_end();
 
   return set_st_ready();
 }
 
-state_t exec_blank_check( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+// Classifies every byte of the block in a single read of the chip, so a chip that
+// can't take the data is rejected before burning anything
+state_t exec_check_block( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
 {
-  unsigned int address;
-  byte data;
+  word start = cmd_data->address;
+  word summary[5] = { 0, 0, 0, 0, (word) ( start + cmd_data->value ) };  // Correct, to program, bits, impossible, first
 
   power_on();
-  
-  for ( address = 0; address < chip_sizes[cmd_data->chip]; ++address )
+
+  fast_scan( cmd_data->chip, start, cmd_data->value, [start, &summary]( word address, byte data ) {
+    byte wanted = block[address - start];
+
+    if ( data == wanted )
+    {
+      ++summary[0];
+    }
+    else if ( data & ~wanted )
+    {
+      if ( !summary[3]++ )
+      {
+        summary[4] = address;
+      }
+    }
+    else
+    {
+      ++summary[1];
+      for ( byte bits = wanted & ~data; bits; bits &= bits - 1 )
+      {
+        ++summary[2];
+      }
+    }
+    return true;
+  } );
+
+  reply_begin( sizeof( summary ) );
+  for ( byte i = 0; i < 5; ++i )
+  {
+    reply_data( summary[i] & 0xFF );
+    reply_data( summary[i] >> 8 );
+  }
+  reply_end();
+
+  return set_st_ready();
+}
+
+state_t exec_set_pulse_mode( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  if ( cmd_data->value >= NUM_PULSE_MODES )
   {
-    if ( 0 != ( data = read_prom_byte( cmd_data->chip, address ) ) )
+    return set_st_error();
+  }
+
+  pulse_mode = (pulse_mode_t) cmd_data->value;
+
+  return set_st_ready();
+}
+
+state_t exec_stats( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  const unsigned long *counters = (const unsigned long *) &stats;
+  const byte count = sizeof( stats ) / sizeof( unsigned long );
+
+  reply_begin( count * 4 );
+  for ( byte i = 0; i < count; ++i )
+  {
+    for ( byte j = 0; j < 4; ++j )
+    {
+      reply_data( ( counters[i] >> ( j * 8 ) ) & 0xFF );
+    }
+  }
+  reply_end();
+
+  memset( &stats, 0, sizeof( stats ) );
+
+  return set_st_ready();
+}
+
+state_t exec_get_baud_rates( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  reply_begin( NUM_BAUD_RATES * 4 );
+  for ( byte i = 0; i < NUM_BAUD_RATES; ++i )
+  {
+    reply_value32( baud_rates[i] );
+  }
+
+  return set_st_ready();
+}
+
+state_t exec_set_baud_rate( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  unsigned long start;
+  int c = -1;
+
+  if ( cmd_data->value >= NUM_BAUD_RATES )
+  {
+    return set_st_error();
+  }
+
+  // Answer at the current speed and wait until it is sent
+  set_st_ready();
+  Serial.flush();
+  Serial.begin( baud_rates[cmd_data->value] );
+
+  if ( DEFAULT_BAUD == baud_rates[cmd_data->value] )
+  {
+    // Nothing to fall back to
+    return ST_READY;
+  }
+
+  // Skip any garbage from the change
+  for ( start = millis(); millis() - start < BAUD_TIMEOUT; )
+  {
+    if ( Serial.available() && FRAME_START == ( c = Serial.read() ) )
     {
       break;
     }
   }
-  Serial.println( address, HEX );
+
+  if ( FRAME_START == c && ST_EXEC == get_frame( cmd_data ) )
+  {
+    if ( 'T' == cmd_data->command )
+    {
+      return exec_echo( cmd_data, ST_EXEC, ST_READY );
+    }
+    set_st_error();
+  }
+
+  // The host is not there
+  Serial.flush();
+  Serial.begin( DEFAULT_BAUD );
+
+  return ST_READY;
+}
+
+state_t exec_echo( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  reply_begin( cmd_data->value );
+  for ( word i = 0; i < cmd_data->value; ++i )
+  {
+    reply_data( block[i] );
+  }
+
+  return set_st_ready();
+}
+
+state_t exec_read_prom( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  power_on();
+
+  reply_begin( cmd_data->value );
+  fast_scan( cmd_data->chip, cmd_data->address, cmd_data->value, []( word, byte data ) {
+    reply_data( data );
+    return true;
+  } );
+  reply_end();
+
+  return set_st_ready();
+}
+
+state_t exec_dump_prom( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  cmd_data->address = 0;
+  cmd_data->value = chips[cmd_data->chip].size;
+
+  // In binary, the count is in the frame length
+  if ( !framed )
+  {
+    reply_value( cmd_data->value, 2 );
+  }
+
+  return exec_read_prom( cmd_data, ST_EXEC, ST_READY );
+}
+
+state_t exec_blank_check( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  word address;
+
+  power_on();
+
+  address = fast_scan( cmd_data->chip, 0, chips[cmd_data->chip].size, []( word, byte data ) {
+    return 0 == data;
+  } );
+
+  reply_begin( 2 );
+  reply_value( address, 2 );
+
+  return set_st_ready();
+}
+
+// The occupancy index of the whole chip, in a single read, so the host can plan
+// without reading the chip again
+state_t exec_map( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  word size = chips[cmd_data->chip].size;
+  word lines[8] = { 0 };
+
+  memset( mismatches, 0, size / 8 );
+
+  power_on();
+
+  fast_scan( cmd_data->chip, 0, size, [&lines]( word address, byte data ) {
+    if ( data )
+    {
+      mismatches[address / 8] |= 1 << ( address % 8 );
+      for ( byte line = 0; data; ++line, data >>= 1 )
+      {
+        lines[line] += data & 1;
+      }
+    }
+    return true;
+  } );
+
+  reply_begin( size / 8 + sizeof( lines ) );
+  for ( word i = 0; i < size / 8; ++i )
+  {
+    reply_data( mismatches[i] );
+  }
+  for ( byte i = 0; i < 8; ++i )
+  {
+    reply_data( lines[i] & 0xFF );
+    reply_data( lines[i] >> 8 );
+  }
+  reply_end();
+
+  return set_st_ready();
+}
+
+state_t exec_crc( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
+{
+  unsigned long crc = 0xFFFFFFFFUL;
+
+  if ( !valid_block( cmd_data ) )
+  {
+    return set_st_error();
+  }
+
+  power_on();
+
+  fast_scan( cmd_data->chip, cmd_data->address, cmd_data->value, [&crc]( word, byte data ) {
+    crc = crc32_update( crc, data );
+    return true;
+  } );
+
+  reply_begin( 4 );
+  reply_value32( ~crc );
 
   return set_st_ready();
 }
 
 state_t print_version( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
 {
-  Serial.println( VERSION );
+  reply_string( VERSION );
 
   return set_st_ready();
 }
@@ -641,8 +1774,10 @@ state_t print_version( cmd_data_t *cmd_data, state_t unused1, state_t unused2 )
 state_t programmer_init( cmd_data_t *cmd_data )
 {
   memset( cmd_data, 0, sizeof( cmd_data_t ) );
-  
-  return set_st_ready();
+
+  // Ready banner, the same as the version response, so the host does not
+  // need to ask after a reset
+  return print_version( cmd_data, ST_READY, ST_READY );
 }
 
 void setup( void )
@@ -662,10 +1797,12 @@ void setup( void )
   power_off();
   disable_10V5();
   ground_pins( 0 );
-  output_disable( CHIP_256X8 );
-  output_disable( CHIP_512X8 );
+  for ( int chip = 0; chip < NUM_CHIPS; ++chip )
+  {
+    output_disable( (chip_type_t) chip );
+  }
 
-  Serial.begin( 57600 );
+  Serial.begin( DEFAULT_BAUD );
 }
 
 void loop( void )
@@ -0,0 +1,500 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Batch jobs
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include "globals.h"
+#include "options.h"
+#include "files.h"
+#include "formats.h"
+#include "command.h"
+#include "scan.h"
+#include "stats.h"
+#include "batch.h"
+
+#define MAX_LINE    1024
+#define SEPARATORS  " \t\r\n"
+
+typedef struct {
+    const char *name;
+    char command;               // As in the command line
+    cmd_fn_t function;
+} operation_t;
+
+// A file, parsed once for all the lines that use it
+typedef struct batch_file_s {
+    char *name;
+    const format_st_t *format;
+    image_t image;
+    struct batch_file_s *next;
+} batch_file_t;
+
+// A line of the manifest, with its chip image ready
+typedef struct batch_entry_s {
+    unsigned line;
+    uint8_t chip;
+    const operation_t *operation;
+    const char *filename;       // NULL for blank checks
+    unsigned copies;
+    mem_block_t *blocks;
+    uint8_t *data;
+    struct batch_entry_s *next;
+} batch_entry_t;
+
+typedef struct {
+    char *manifest;
+    batch_file_t *files;
+    batch_entry_t *entries;
+    batch_entry_t **tail;
+    unsigned parts;
+    bool writes;
+} batch_t;
+
+static status_t batch_blank( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, mem_block_t *blocks, char *ofile, const format_st_t *format );
+
+static const operation_t operations[] = {
+    { "blank",  'k', batch_blank },
+    { "write",  'w', command_write },
+    { "verify", 'v', command_verify },
+    { NULL }
+};
+
+// Unlike the '-b' command, a chip that is not blank is a failed part
+//
+static status_t batch_blank(
+    prom_session_t *session,
+    uint8_t chip,
+    uint16_t address,           // Unused
+    uint16_t count,             // Unused
+    mem_block_t *blocks,        // Unused
+    char *ofile,                // Unused
+    const format_st_t *format   // Unused
+    )
+{
+    uint16_t end;
+
+    if ( FAILURE == prom_blank( session, chip, &end ) )
+    {
+        return FAILURE;
+    }
+
+    if ( end != prom_chip_size( chip ) )
+    {
+        fprintf( stderr, "Chip is not blank. Found non-zero data at address 0x%x.\n", end );
+        return FAILURE;
+    }
+
+    fputs( "Chip is blank.\n", stderr );
+
+    return SUCCESS;
+}
+
+static status_t invalid( const batch_t *batch, unsigned line, const char *what, const char *value )
+{
+    fprintf( stderr, "Error: %s, line %u: %s: %s\n", batch->manifest, line, what, value );
+
+    return FAILURE;
+}
+
+// Relative paths are from the directory of the manifest
+//
+static char *batch_path( const char *manifest, const char *name )
+{
+    const char *slash = strrchr( manifest, '/' );
+    size_t dir = ( '/' == *name || NULL == slash ) ? 0 : slash - manifest + 1;
+    char *path = malloc( dir + strlen( name ) + 1 );
+
+    if ( NULL == path )
+    {
+        perror( "Can't alloc memory for file name" );
+        return NULL;
+    }
+
+    memcpy( path, manifest, dir );
+    strcpy( &path[dir], name );
+
+    return path;
+}
+
+static batch_file_t *batch_file( batch_t *batch, const char *name )
+{
+    char *path = batch_path( batch->manifest, name );
+    batch_file_t *file;
+
+    if ( NULL == path )
+    {
+        return NULL;
+    }
+
+    for ( file = batch->files; NULL != file; file = file->next )
+    {
+        if ( ! strcmp( file->name, path ) )
+        {
+            free( path );
+            return file;
+        }
+    }
+
+    if ( NULL == ( file = calloc( 1, sizeof( batch_file_t ) ) ) )
+    {
+        perror( "Can't alloc memory for file" );
+        free( path );
+        return NULL;
+    }
+
+    file->name = path;
+
+    if ( FAILURE == formats_load( path, &file->format, &file->image ) )
+    {
+        free( path );
+        free( file );
+        return NULL;
+    }
+
+    file->next = batch->files;
+    batch->files = file;
+
+    return file;
+}
+
+// CHIP FILE[@BASE] OPERATION [COPIES], FILE is '-' for blank checks
+//
+static status_t batch_line( batch_t *batch, unsigned line, char *text )
+{
+    char *fields[4], *save, *at, *comment = strchr( text, '#' );
+    const operation_t *operation = operations;
+    batch_entry_t *entry;
+    batch_file_t *file;
+    uint32_t base = 0, copies = 1;
+    uint8_t chip;
+    int n = 0;
+
+    if ( NULL != comment )
+    {
+        *comment = '\0';
+    }
+
+    for ( char *f = strtok_r( text, SEPARATORS, &save ); NULL != f; f = strtok_r( NULL, SEPARATORS, &save ) )
+    {
+        if ( n == 4 )
+        {
+            return invalid( batch, line, "Unexpected field", f );
+        }
+        fields[n++] = f;
+    }
+
+    if ( n == 0 )
+    {
+        return SUCCESS;
+    }
+
+    if ( n < 3 )
+    {
+        return invalid( batch, line, "Expected", "CHIP FILE OPERATION [COPIES]" );
+    }
+
+    if ( FAILURE == prom_chip_parse( fields[0], &chip ) )
+    {
+        return invalid( batch, line, "Invalid chip", fields[0] );
+    }
+
+    while ( NULL != operation->name && strcmp( operation->name, fields[2] ) )
+    {
+        ++operation;
+    }
+
+    if ( NULL == operation->name )
+    {
+        return invalid( batch, line, "Invalid operation, not blank, write or verify", fields[2] );
+    }
+
+    if ( n == 4 && ( EINVAL == get_uint32( fields[3], &copies ) || ! copies ) )
+    {
+        return invalid( batch, line, "Invalid number of copies", fields[3] );
+    }
+
+    if ( ( operation->command == 'k' ) != ! strcmp( fields[1], "-" ) )
+    {
+        return invalid( batch, line, "Blank checks, and only them, take '-' as file", fields[1] );
+    }
+
+    if ( NULL == ( entry = calloc( 1, sizeof( batch_entry_t ) ) ) )
+    {
+        perror( "Can't alloc memory for batch entry" );
+        return FAILURE;
+    }
+
+    entry->line = line;
+    entry->chip = chip;
+    entry->operation = operation;
+    entry->copies = copies;
+
+    *batch->tail = entry;
+    batch->tail = &entry->next;
+    batch->parts += copies;
+
+    if ( operation->command == 'k' )
+    {
+        return SUCCESS;
+    }
+
+    batch->writes |= ( operation->command == 'w' );
+
+    if ( NULL != ( at = strrchr( fields[1], '@' ) ) )
+    {
+        *at++ = '\0';
+
+        if ( EINVAL == get_uint32( at, &base ) )
+        {
+            return invalid( batch, line, "Invalid base address", at );
+        }
+    }
+
+    if ( NULL == ( file = batch_file( batch, fields[1] ) ) )
+    {
+        return invalid( batch, line, "Can't load", fields[1] );
+    }
+
+    entry->filename = file->name;
+
+    if ( NULL == ( entry->data = malloc( prom_chip_size( chip ) ) ) )
+    {
+        perror( "Can't alloc memory for chip image" );
+        return FAILURE;
+    }
+
+    if ( FAILURE == command_extract( &file->image, file->name, file->format, base, chip, entry->data, &entry->blocks ) )
+    {
+        return invalid( batch, line, "Invalid image", fields[1] );
+    }
+
+    return SUCCESS;
+}
+
+// Parses the manifest and all its files before touching any chip
+//
+static status_t batch_load( batch_t *batch )
+{
+    char text[MAX_LINE];
+    unsigned line = 0;
+    status_t status = SUCCESS;
+    FILE *file = fopen( batch->manifest, "r" );
+
+    if ( NULL == file )
+    {
+        fprintf( stderr, "Error: Can't open manifest '%s': %s\n", batch->manifest, strerror( errno ) );
+        return FAILURE;
+    }
+
+    while ( status == SUCCESS && NULL != fgets( text, sizeof( text ), file ) )
+    {
+        ++line;
+
+        if ( NULL == strchr( text, '\n' ) && ! feof( file ) )
+        {
+            status = invalid( batch, line, "Line too long", "max is 1023 characters" );
+        }
+        else
+        {
+            status = batch_line( batch, line, text );
+        }
+    }
+
+    if ( status == SUCCESS && ferror( file ) )
+    {
+        fprintf( stderr, "Error: Can't read manifest '%s': %s\n", batch->manifest, strerror( errno ) );
+        status = FAILURE;
+    }
+
+    fclose( file );
+
+    if ( status == SUCCESS && ! batch->parts )
+    {
+        fprintf( stderr, "Error: No parts in manifest '%s'\n", batch->manifest );
+        status = FAILURE;
+    }
+
+    return status;
+}
+
+static void batch_free( batch_t *batch )
+{
+    while ( NULL != batch->entries )
+    {
+        batch_entry_t *entry = batch->entries;
+
+        batch->entries = entry->next;
+        files_free_blocks( entry->blocks );
+        free( entry->data );
+        free( entry );
+    }
+
+    while ( NULL != batch->files )
+    {
+        batch_file_t *file = batch->files;
+
+        batch->files = file->next;
+        files_image_free( &file->image );
+        free( file->name );
+        free( file );
+    }
+}
+
+// Waits for the user to swap the chip. Returns the answer, 'q' at the end of the input
+//
+static char batch_prompt( unsigned part, const batch_t *batch, const batch_entry_t *entry )
+{
+    char answer[16];
+
+    fprintf( stderr, "\nPart %u of %u, line %u: %s chip %u%s%s\n", part, batch->parts, entry->line,
+                entry->operation->name, entry->chip, entry->filename ? " with " : "", entry->filename ? entry->filename : "" );
+    fputs( "Insert the chip and press ENTER, 's' to skip it or 'q' to stop: ", stderr );
+
+    if ( NULL == fgets( answer, sizeof( answer ), stdin ) )
+    {
+        fputs( "\nEnd of input.\n", stderr );
+        return 'q';
+    }
+
+    return ( 's' == answer[0] || 'q' == answer[0] ) ? answer[0] : '\n';
+}
+
+static status_t batch_parts( prom_session_t *session, const options_t *options, const batch_t *batch )
+{
+    bool counters = options->flags.stats && SUCCESS == command_stats( session, false );
+    unsigned part = 0, passed = 0, failed = 0;
+    uint64_t busy = 0;
+    char answer = '\n';
+
+    for ( const batch_entry_t *entry = batch->entries; NULL != entry && 'q' != answer; entry = entry->next )
+    {
+        cmd_fn_t function = entry->operation->function;
+
+        if ( options->flags.fast && entry->operation->command == 'v' )
+        {
+            function = command_fast_verify;
+        }
+
+        for ( unsigned copy = 0; copy < entry->copies && 'q' != ( answer = batch_prompt( part + 1, batch, entry ) ); ++copy )
+        {
+            uint64_t start, us;
+            status_t status;
+
+            ++part;
+
+            if ( 's' == answer )
+            {
+                fprintf( stderr, "Part %u skipped\n", part );
+                continue;
+            }
+
+            if ( NULL != entry->data )
+            {
+                command_use( entry->chip, entry->data );
+            }
+
+            // A new chip in the socket
+            prom_forget( session );
+
+            start = stats_now();
+            status = function( session, entry->chip, 0xFFFF, 0xFFFF, entry->blocks, NULL, NULL );
+            stats_phase( prom_timing( session ), entry->operation->name, start, status );
+            us = stats_now() - start;
+            busy += us;
+
+            fprintf( stderr, "Part %u %s in %lu.%02lus\n", part, ( status == SUCCESS ) ? "passed" : "FAILED",
+                        (unsigned long) ( us / 1000000 ), (unsigned long) ( us % 1000000 / 10000 ) );
+
+            if ( status == SUCCESS )
+            {
+                ++passed;
+            }
+            else
+            {
+                ++failed;
+            }
+        }
+    }
+
+    fprintf( stderr, "\nBatch done: %u passed, %u failed, %u skipped, %u not done. %lu.%02lus with the programmer.\n",
+                passed, failed, part - passed - failed, batch->parts - part,
+                (unsigned long) ( busy / 1000000 ), (unsigned long) ( busy % 1000000 / 10000 ) );
+
+    if ( counters )
+    {
+        command_stats( session, true );
+    }
+
+    return ( passed == batch->parts ) ? SUCCESS : FAILURE;
+}
+
+// Runs all the manifest lines with the same programmer connection. Programming is
+// confirmed once, up front, so the answers to the prompts are just the chip swaps
+//
+status_t batch_run( char *device, const options_t *options, stats_t *stats )
+{
+    batch_t batch = { options->manifest, NULL, NULL, NULL, 0, false };
+    uint64_t start = stats_now();
+    prom_session_t *prom = NULL;
+    status_t status;
+
+    batch.tail = &batch.entries;
+
+    status = batch_load( &batch );
+    stats_phase( stats, "load", start, status );
+
+    if ( status == SUCCESS && batch.writes )
+    {
+        if ( command_confirm() )
+        {
+            command_set_confirmed( true );
+        }
+        else
+        {
+            fputs( "Aborted by user.\n", stderr );
+            status = FAILURE;
+        }
+    }
+
+    if ( status == SUCCESS ) status = command_init( &prom, device, options->flags.ascii, options->pulse, options->baud, stats );
+
+    if ( status == SUCCESS ) status = batch_parts( prom, options, &batch );
+
+    command_close( prom );
+
+    batch_free( &batch );
+
+    stats_report( stats, stderr, options->stats_json );
+
+    return status;
+}
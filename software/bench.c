@@ -0,0 +1,389 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Benchmark of the programmer commands
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "globals.h"
+#include "options.h"
+#include "serial.h"
+#include "protocol.h"
+#include "files.h"
+#include "formats.h"
+#include "command.h"
+#include "scan.h"
+
+#define DEFAULT_RUNS    5
+#define LATENCY_SAMPLES 100         // Single byte reads for the round trip latency
+#define MAX_SAMPLES     LATENCY_SAMPLES
+
+typedef struct {
+    const char *name;
+    size_t bytes;                   // Per run, 0 if not meaningful
+    size_t count;
+    double ms[MAX_SAMPLES];
+    status_t status;
+} timing_t;
+
+
+static bool verbose = false;
+static int saved_stdout = -1, saved_stderr = -1;
+
+static double now_ms( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+}
+
+// The commands print their progress and results, which are not wanted in the
+// benchmark output unless asked for
+//
+static void quiet( bool on )
+{
+    if ( verbose )
+    {
+        return;
+    }
+
+    fflush( NULL );
+
+    if ( on )
+    {
+        int null = open( "/dev/null", O_WRONLY );
+
+        saved_stdout = dup( STDOUT_FILENO );
+        saved_stderr = dup( STDERR_FILENO );
+        dup2( null, STDOUT_FILENO );
+        dup2( null, STDERR_FILENO );
+        close( null );
+    }
+    else
+    {
+        dup2( saved_stdout, STDOUT_FILENO );
+        dup2( saved_stderr, STDERR_FILENO );
+        close( saved_stdout );
+        close( saved_stderr );
+    }
+}
+
+static int compare_ms( const void *a, const void *b )
+{
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return ( x > y ) - ( x < y );
+}
+
+// Nearest rank, of the sorted samples
+//
+static double percentile( const timing_t *t, int p )
+{
+    size_t rank = ( p * t->count + 99 ) / 100;
+
+    return t->ms[rank ? rank - 1 : 0];
+}
+
+static void print_timing( const timing_t *t, bool last )
+{
+    timing_t sorted = *t;
+    double total = 0;
+
+    printf( "      \"%s\": { \"status\": \"%s\", \"runs\": %zu", t->name, t->status == SUCCESS ? "ok" : "failed", t->count );
+
+    if ( t->count )
+    {
+        for ( size_t i = 0; i < t->count; ++i )
+        {
+            total += t->ms[i];
+        }
+
+        qsort( sorted.ms, sorted.count, sizeof( double ), compare_ms );
+
+        printf( ", \"mean_ms\": %.3f, \"min_ms\": %.3f, \"p50_ms\": %.3f, \"p90_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f",
+                    total / t->count, sorted.ms[0], percentile( &sorted, 50 ), percentile( &sorted, 90 ),
+                    percentile( &sorted, 99 ), sorted.ms[sorted.count - 1] );
+
+        if ( t->bytes )
+        {
+            printf( ", \"bytes\": %zu, \"bytes_per_s\": %.1f", t->bytes, t->bytes * t->count * 1000.0 / total );
+        }
+    }
+
+    printf( " }%s\n", last ? "" : "," );
+}
+
+typedef status_t (*bench_fn_t)( prom_session_t *session, uint8_t chip, mem_block_t *blocks );
+
+static status_t run( timing_t *t, int runs, bench_fn_t fn, prom_session_t *session, uint8_t chip, mem_block_t *blocks )
+{
+    double start;
+
+    t->count = 0;
+    t->status = SUCCESS;
+
+    for ( int i = 0; i < runs && t->status == SUCCESS; ++i )
+    {
+        quiet( true );
+        start = now_ms();
+        t->status = fn( session, chip, blocks );
+        t->ms[t->count++] = now_ms() - start;
+        quiet( false );
+    }
+
+    return t->status;
+}
+
+static status_t bench_read( prom_session_t *session, uint8_t chip, mem_block_t *blocks )
+{
+    return command_read( session, chip, 0xFFFF, 0xFFFF, NULL, NULL, NULL );
+}
+
+static status_t bench_blank( prom_session_t *session, uint8_t chip, mem_block_t *blocks )
+{
+    return command_blank( session, chip, 0xFFFF, 0xFFFF, NULL, NULL, NULL );
+}
+
+static status_t bench_simul( prom_session_t *session, uint8_t chip, mem_block_t *blocks )
+{
+    return command_simul( session, chip, 0xFFFF, 0xFFFF, blocks, NULL, NULL );
+}
+
+static status_t bench_verify( prom_session_t *session, uint8_t chip, mem_block_t *blocks )
+{
+    return command_verify( session, chip, 0xFFFF, 0xFFFF, blocks, NULL, NULL );
+}
+
+static status_t bench_fast_verify( prom_session_t *session, uint8_t chip, mem_block_t *blocks )
+{
+    return command_fast_verify( session, chip, 0xFFFF, 0xFFFF, blocks, NULL, NULL );
+}
+
+static status_t bench_round_trip( prom_session_t *session, uint8_t chip, mem_block_t *blocks )
+{
+    uint8_t value;
+
+    return prom_read( session, chip, 0, 1, &value );
+}
+
+// The chip contents are the data for the simulated write and the verify, as it is
+// the only one that succeeds with both
+//
+static status_t load_contents( prom_session_t *session, uint8_t chip, mem_block_t **blocks )
+{
+    uint8_t data[MAX_BLOCK];
+    char filename[] = "/tmp/prombench-XXXXXX";
+    uint16_t size = prom_chip_size( chip );
+    status_t status;
+    int file;
+
+    if ( FAILURE == prom_read( session, chip, 0, size, data ) )
+    {
+        return FAILURE;
+    }
+
+    if ( -1 == ( file = mkstemp( filename ) ) )
+    {
+        perror( "Error creating temporary file" );
+        return FAILURE;
+    }
+
+    status = ( size == write( file, data, size ) ) ? SUCCESS : FAILURE;
+    close( file );
+
+    if ( SUCCESS == status )
+    {
+        status = command_load( 0, NULL, filename, 0, formats_find( "bin" ), blocks );
+    }
+
+    unlink( filename );
+
+    return status;
+}
+
+static status_t bench_chip( char *device, uint8_t chip, int runs, bool ascii, uint32_t max_baud, bool last )
+{
+    timing_t connect = { "connect", 0 }, read = { "read", prom_chip_size( chip ) },
+             blank = { "blank", prom_chip_size( chip ) }, simul = { "simulate", prom_chip_size( chip ) },
+             verify = { "verify", prom_chip_size( chip ) }, fast_verify = { "fast_verify", prom_chip_size( chip ) },
+             round_trip = { "round_trip", 1 };
+    mem_block_t *blocks = NULL;
+    prom_session_t *prom = NULL;
+    status_t status;
+    double start;
+
+    // Opening the port resets the programmer, so this is what every prom run waits
+    quiet( true );
+    start = now_ms();
+    status = command_init( &prom, device, ascii, PULSE_FIXED, max_baud, NULL );
+    connect.ms[connect.count++] = now_ms() - start;
+    connect.status = status;
+
+    if ( SUCCESS == status ) status = load_contents( prom, chip, &blocks );
+    quiet( false );
+
+    if ( SUCCESS == status )
+    {
+        run( &read, runs, bench_read, prom, chip, blocks );
+        run( &blank, runs, bench_blank, prom, chip, blocks );
+        run( &simul, runs, bench_simul, prom, chip, blocks );
+        run( &verify, runs, bench_verify, prom, chip, blocks );
+        if ( prom_has_blocks( prom ) )
+        {
+            run( &fast_verify, runs, bench_fast_verify, prom, chip, blocks );
+        }
+        run( &round_trip, LATENCY_SAMPLES, bench_round_trip, prom, chip, blocks );
+    }
+
+    printf( "    { \"chip\": %u, \"size\": %u, \"protocol\": \"%s\",\n", chip, prom_chip_size( chip ),
+                ( NULL != prom && prom_is_binary( prom ) ) ? "binary" : "ascii" );
+    print_timing( &connect, SUCCESS != status );
+
+    if ( SUCCESS == status )
+    {
+        print_timing( &read, false );
+        print_timing( &blank, false );
+        print_timing( &simul, false );
+        print_timing( &verify, false );
+        if ( prom_has_blocks( prom ) )
+        {
+            print_timing( &fast_verify, false );
+        }
+        print_timing( &round_trip, true );
+
+        status = ( read.status || blank.status || simul.status || verify.status || fast_verify.status || round_trip.status )
+                    ? FAILURE : SUCCESS;
+    }
+
+    printf( "    }%s\n", last ? "" : "," );
+
+    files_free_blocks( blocks );
+
+    quiet( true );
+    command_close( prom );
+    quiet( false );
+
+    return status;
+}
+
+static int usage( char *myname )
+{
+    fprintf( stderr, "Usage: %s DEVICE [-a|-b RATE] [-c CHIP] [-n RUNS] [-v]\n\n", myname );
+    fputs( "   -a          Use the ascii protocol.\n", stderr );
+    fputs( "   -b RATE     Max serial speed to negotiate with the programmer.\n", stderr );
+    fputs( "   -c CHIP     Only this chip type, 0 == 74s471, 1 == 74s472 or by name. Default is both.\n", stderr );
+    fprintf( stderr, "   -n RUNS     Runs of every command, up to %d. Default is %d.\n", MAX_SAMPLES, DEFAULT_RUNS );
+    fputs( "   -v          Show the output of the commands.\n\n", stderr );
+    fputs( "Results are written to stdout as JSON.\n", stderr );
+
+    return EXIT_FAILURE;
+}
+
+int main( int argc, char **argv )
+{
+    char *myname = basename( argv[0] );
+    uint32_t max_baud = UINT32_MAX, runs32 = DEFAULT_RUNS;
+    int opt, first = 0, last = MAX_CHIP, failed = 0;
+    bool ascii = false;
+    uint8_t chip;
+    char *device;
+    double start;
+
+    while ( -1 != ( opt = getopt( argc, argv, "ab:c:n:v" ) ) )
+    {
+        switch ( opt )
+        {
+            case 'a':
+                ascii = true;
+                break;
+
+            case 'b':
+                if ( EINVAL == get_uint32( optarg, &max_baud ) || ! serial_speed_supported( max_baud ) )
+                {
+                    fprintf( stderr, "Error: Invalid baud rate: %s\n", optarg );
+                    return usage( myname );
+                }
+                break;
+
+            case 'c':
+                if ( FAILURE == prom_chip_parse( optarg, &chip ) )
+                {
+                    fprintf( stderr, "Error: Invalid chip: %s\n", optarg );
+                    return usage( myname );
+                }
+                first = last = chip;
+                break;
+
+            case 'n':
+                if ( EINVAL == get_uint32( optarg, &runs32 ) || runs32 == 0 || runs32 > MAX_SAMPLES )
+                {
+                    fprintf( stderr, "Error: Invalid number of runs: %s\n", optarg );
+                    return usage( myname );
+                }
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            default:
+                return usage( myname );
+        }
+    }
+
+    if ( optind != argc - 1 )
+    {
+        return usage( myname );
+    }
+    device = argv[optind];
+
+    start = now_ms();
+
+    printf( "{\n  \"device\": \"%s\",\n  \"runs\": %u,\n  \"chips\": [\n", device, runs32 );
+
+    for ( int c = first; c <= last; ++c )
+    {
+        failed += ( FAILURE == bench_chip( device, c, runs32, ascii, max_baud, c == last ) );
+    }
+
+    printf( "  ],\n  \"wall_ms\": %.3f,\n  \"status\": \"%s\"\n}\n", now_ms() - start, failed ? "failed" : "ok" );
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
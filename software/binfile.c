@@ -34,90 +34,41 @@
 
 #include "globals.h"
 #include "files.h"
+#include "binfile.h"
 
-#ifndef UNUSED
-#define UNUSED(x) (void)(x)
-#endif
-
-status_t bin_read( char *filename, uint8_t* data, size_t size, mem_block_t **blocks )
+// Anything can be a binary file
+//
+bool bin_detect( const char *contents, size_t len )
 {
-    FILE *file = NULL;
-    status_t status = SUCCESS;
-    mem_block_t *b = malloc( sizeof( mem_block_t) );
-
-    if ( NULL == b )
-    {
-        perror( "Can't alloc memory for new bin block\n" );
-        return files_cleanup( file, b, FAILURE );
-    }
-
-    if ( NULL == ( file = fopen( filename, "rb" ) ) )
-    {
-        fprintf( stderr, "Error %d opening file '%s': %s\n", errno, filename, strerror( errno ) );
-        return files_cleanup( file, b, FAILURE );
-    }
-    
-    if ( fseek( file, 0L, SEEK_END ) )
-    {
-        perror( "Can't determine file size" );
-        return files_cleanup( file, b, FAILURE );
-    }
-
-    b->start = 0;
-    b->count = ftell( file );
-    b->next = NULL;
-
-    rewind( file );
+    return true;
+}
 
-    if ( b->count > size || b->count == 0 )
+// The whole file is the image of a chip, from address 0
+//
+status_t bin_parse( const char *contents, size_t len, image_t *image )
+{
+    if ( 0 == len )
     {
         fputs( "Invalid file size\n", stderr );
-        return files_cleanup( file, b, FAILURE );
+        return FAILURE;
     }
 
-    *blocks = b;
+    return files_image_add( image, 0, (const uint8_t *) contents, len );
+}
 
-    if ( fread( data, 1, b->count, file ) != b->count )
+status_t bin_put( writer_t *writer, const uint8_t *data, size_t len )
+{
+    if ( FAILURE == files_write( writer, data, len ) )
     {
-        perror( "Error reading from binary file" );
-        return files_cleanup( file, b, FAILURE );
+        return FAILURE;
     }
 
-    fclose( file );
+    writer->address += len;
 
     return SUCCESS;
 }
 
-status_t bin_write( char *filename, uint8_t* data, size_t size, uint64_t base_addr )
+status_t bin_close( writer_t *writer, status_t status )
 {
-    FILE *file;
-
-    UNUSED( base_addr );
-
-    status_t status = SUCCESS;
-    int rc;
-
-    if ( NULL == ( file = fopen( filename, "wb" ) ) )
-    {
-        fprintf( stderr, "Error %d opening file '%s': %s\n", errno, filename, strerror( errno ) );
-        return FAILURE;
-    }
-    
-	for ( size_t i = 0; i < size; ++i )
-    {
-        rc = fwrite( &data[i], 1, 1, file );
-        if ( rc == 0 )
-        {
-            fprintf( stderr, "Error writing to file '%s'\n", filename );
-            status = FAILURE;
-        }
-    }
-
-    if ( EOF == fclose( file ) )
-    {
-        fprintf( stderr, "Error %d closing file '%s': %s\n", errno, filename, strerror( errno ) );
-        status = FAILURE;
-    }
-
-    return status;
+    return files_close( writer, status );
 }
@@ -33,8 +33,11 @@
 #include <stdint.h>
 
 #include "globals.h"
+#include "files.h"
 
-status_t bin_read( char *filename, const uint8_t *buffer, size_t buffer_size, mem_block_t **blocks );
-status_t bin_write( char *filename, const uint8_t *buffer, size_t buffer_size, uint64_t base_addr );
+bool bin_detect( const char *contents, size_t len );
+status_t bin_parse( const char *contents, size_t len, image_t *image );
+status_t bin_put( writer_t *writer, const uint8_t *data, size_t len );
+status_t bin_close( writer_t *writer, status_t status );
 
 #endif /* BINFILE_H */
@@ -35,104 +35,107 @@
 
 #include "globals.h"
 #include "serial.h"
+#include "protocol.h"
+#include "stats.h"
 #include "hexdump.h"
 #include "files.h"
+#include "formats.h"
 #include "str.h"
 #include "scan.h"
+#include "journal.h"
+#include "progress.h"
+#include "libprom.h"
 
-#define REC_BUF_SIZE    4096
 #define RW_BUF_SIZE     4096
 
-typedef void (*cmdset_fn_t)( char command, char *cmd_buf, uint8_t chip, uint16_t address, uint8_t *data );
+// Estimated time per bit to program, pulse plus cooling. Most bits program with
+// the first pulse in adaptive mode
+#define FIXED_BIT_TIME      20      // 5ms pulse + 15ms cooling
+#define ADAPTIVE_BIT_TIME   4       // 1ms pulse + 3ms cooling
 
-static const uint16_t chip_sizes[] =
-{
-    256, 512
-};
-
-static uint8_t rec_buf[REC_BUF_SIZE];
 static uint8_t rw_buf[RW_BUF_SIZE];
 
+static bool confirmed = false;      // Programming already confirmed by the user
+static bool resume = false;         // Continue the write recorded in the journal
+
+static progress_t progress;         // Of the command being executed
+
 status_t command_blank(
-    int fd,
-    char *device,
+    prom_session_t *session,
     uint8_t chip,
     uint16_t address,           // Unused
     uint16_t count,             // Unused
-    uint8_t *data,              // Unused
-    char *ifile,                // Unused
+    mem_block_t *blocks,        // Unused
     char *ofile,                // Unused
     const format_st_t *format   // Unused
     ) 
 {
-    int n, tries;
-    ssize_t returned;
+    prom_map_t map;
     uint16_t end;
-    uint8_t ret_stat;
-
-    sprintf( rec_buf, "K %x\n", chip );
 
-    if ( FAILURE == serial_write( fd, device, rec_buf, strlen( rec_buf ) ) )
-    {
-        return FAILURE;            
-    }
-        
-    for ( tries = 0; tries < 5; ++tries )
+    if ( FAILURE == prom_blank( session, chip, &end ) )
     {
-        if ( FAILURE == serial_read( fd, device, rec_buf, sizeof( rec_buf ), &returned ) )
-        {
-            return FAILURE;
-        }
-
-        if ( returned != 0 )
-        {
-            break;
-        }
-    }
-
-    if ( returned == 0 )
-    {
-        fprintf( stderr, "Error: No response from programmer at port %s.\n", device );
-        return FAILURE;
-    }
-
-    if ( 2 != sscanf( rec_buf, "%hx\r\n%c\r\n", &end, &ret_stat ) || ret_stat != 'R' )
-    {
-        fputs( "Error executing blank test. Bad programmer response.\n", stderr );
         return FAILURE;
     }
 
     fputs( "Chip is ", stdout );
 
-    if ( end == chip_sizes[chip] )
+    if ( end == prom_chip_size( chip ) )
     {
         puts( "blank." );
     }
     else
     {
         printf( "not blank. Found non-zero data at address 0x%x.\n", end );
+
+        // Already read by the blank test, if the firmware has it
+        if ( SUCCESS == prom_map( session, chip, &map ) )
+        {
+            printf( "%u bytes are not zero. Programmed bits by output, D0 to D7:", map.bytes );
+            for ( int line = 0; line < 8; ++line )
+            {
+                printf( " %u", map.lines[line] );
+            }
+            putchar( '\n' );
+        }
     }
 
     return SUCCESS;
 }
 
+typedef struct {
+    const format_st_t *format;
+    writer_t writer;
+    uint16_t address;           // Of the next byte
+} file_sink_t;
+
+static status_t to_file( const uint8_t *data, size_t len, void *arg )
+{
+    file_sink_t *sink = arg;
+
+    sink->address += len;
+    progress_step( &progress, sink->address - 1, len, 0 );
+
+    return sink->format->put_fn( &sink->writer, data, len );
+}
+
+static status_t to_screen( const uint8_t *data, size_t len, void *arg )
+{
+    hexdump_put( arg, data, len );
+
+    return SUCCESS;
+}
+
 status_t command_read(
-    int fd,
-    char *device,
+    prom_session_t *session,
     uint8_t chip,
     uint16_t address,
     uint16_t count,
-    uint8_t *data,              // Unused
-    char *ifile,                // Unused
+    mem_block_t *blocks,        // Unused
     char *ofile,
     const format_st_t *format
     )
 {
-    int n, tries;
-    ssize_t returned;
-    uint8_t ret_stat;
-    size_t received = 0;
-
     if ( address == 0xFFFF )
     {
         address = 0;
@@ -140,322 +143,740 @@ status_t command_read(
 
     if ( count == 0xFFFF )
     {
-        count = chip_sizes[chip]-address;
+        count = prom_chip_size( chip )-address;
     }
-    if ( address >= chip_sizes[chip] )
+    if ( address >= prom_chip_size( chip ) )
     {
         fprintf( stderr, "Error: Invalid start address: 0x%X\n", address );
         return FAILURE;
     }
 
-    if ( address+count > chip_sizes[chip] )
+    if ( address+count > prom_chip_size( chip ) )
     {
         fprintf( stderr, "Error: Invalid start+count address: 0x%X\n", address+count );
         return FAILURE;
     }
 
-    sprintf( rec_buf, "r %x %x %x\n", chip, address, count );
-
-    if ( FAILURE == serial_write( fd, device, rec_buf, strlen( rec_buf ) ) )
-    {
-        return FAILURE;            
-    }
-        
-    for ( tries = 0; tries < 1000; ++tries )
+    // The data goes to its destination as it arrives
+    if ( ofile )
     {
-        if ( FAILURE == serial_read( fd, device, &rec_buf[received],
-                sizeof( rec_buf ) - address - received, &returned ) )
+        file_sink_t sink = { format, .address = address };
+        status_t status;
+
+        fprintf( stderr, "Writing contents to file `%s` in %s format.\n", ofile, format->format_string );
+
+        if ( FAILURE == files_open( &sink.writer, ofile, address ) )
         {
             return FAILURE;
         }
 
-        received += returned;
+        progress_begin( &progress, "read", count, 0, 0, progress_print, NULL );
+        status = format->close_fn( &sink.writer, prom_stream( session, chip, address, count, to_file, &sink ) );
+        progress_end( &progress, status );
 
-        // Expected 2 digits per byte, plus '\r\n', plus 'R', plus '\r\n' 
-        if ( received == (count*2) + 5 )
+        return status;
+    }
+    else
+    {
+        hexdump_t dump;
+
+        hexdump_begin( &dump, address );
+
+        if ( FAILURE == prom_stream( session, chip, address, count, to_screen, &dump ) )
         {
-            break;
+            return FAILURE;
         }
+
+        hexdump_end( &dump );
+
+        return SUCCESS;
     }
+}
 
-    if ( tries == 1000 )
+// The block being verified, to say once that its CRC did not match
+typedef struct {
+    uint16_t start;
+    uint16_t count;
+    bool crc;
+} mismatch_t;
+
+static void report_mismatch( uint16_t loc, uint8_t ret_val, uint8_t expected, void *arg )
+{
+    mismatch_t *mismatch = arg;
+
+    if ( mismatch->crc )
     {
-        fprintf( stderr, "\nError: No response from programmer at port %s.\n", device );
-        return FAILURE;
+        fprintf( stderr, "CRC mismatch in block 0x%03X-0x%03X\n",
+                    mismatch->start,
+                    mismatch->start + mismatch->count - 1 );
+        mismatch->crc = false;
     }
 
-    if ( 1 != sscanf( &rec_buf[count*2], "\r\n%c\r\n", &ret_stat ) || ret_stat != 'R' )
+    fprintf( stderr, "\nError verifying prom address 0x%03X: Read == 0x%02x, expected == 0x%02x\n",
+                loc,
+                ret_val,
+                expected );
+}
+
+// Gets the data blocks from the input file or the data string. 'base' is the file address
+// of the chip image, for files that have several
+//
+status_t command_load( uint16_t address, uint8_t *data, char *ifile, uint32_t base, const format_st_t *format, mem_block_t **blocks )
+{
+    if ( ifile )
     {
-        fputs( "\nError reading from prom. Bad programmer response.\n", stderr );
-        return FAILURE;
+        return formats_read( ifile, format, base, rw_buf, sizeof( rw_buf ), blocks );
     }
 
-    for ( int i = 0; i < count; ++i )
+    *blocks = malloc( sizeof( mem_block_t ) );
+
+    if ( NULL == *blocks )
     {
-        if ( EINVAL == get_hexbyte( &rec_buf[i*2], &rw_buf[address+i] ) )
-        {
-            fputs( "\nError reading from prom. Bad programmer response.\n", stderr );
-            return FAILURE;
-        }
+        perror( "Can't alloc memory for new hex block\n" );
+        return FAILURE;
     }
+    ( *blocks )->start = address;
+    ( *blocks )->next = NULL;
 
-    if ( ofile )
+    if ( FAILURE == str_process( data, &rw_buf[address], sizeof( rw_buf ) - address, &( *blocks )->count ) )
     {
-        status_t status;
-        fprintf( stderr, "Writing contents to file `%s` in %s format.\n", ofile, format->format_string );
+        files_free_blocks( *blocks );
+        *blocks = NULL;
+        return FAILURE;
+    }
 
-        status = format->write_fn( ofile, rw_buf, chip_sizes[chip], address );
+    return SUCCESS;
+}
 
-        return status;
-    }
-    else
+// Number of bytes of the block that fit in the chip
+//
+static uint16_t chip_count( uint8_t chip, const mem_block_t *b )
+{
+    if ( b->start >= prom_chip_size( chip ) )
     {
-        hexdump( &rw_buf[address], count, address );
-        return SUCCESS;
+        return 0;
     }
+
+    return ( b->start + b->count > prom_chip_size( chip ) ) ? prom_chip_size( chip ) - b->start : b->count;
 }
 
-static void command_set_read( char command, char *cmd_buf, uint8_t chip, uint16_t address, uint8_t *unused )
+static status_t out_of_chip( uint8_t chip, const mem_block_t *b )
 {
-    sprintf( cmd_buf, "%c %x %x 1\n", command, chip, address );
+    fprintf( stderr, "\nAddress 0x%X is larger than last chip cell ( 0x%X )\n", b->start + chip_count( chip, b ), prom_chip_size( chip )-1 );
+
+    return FAILURE;
 }
 
-static void command_set_write( char command, char *cmd_buf, uint8_t chip, uint16_t address, uint8_t *data )
+// Like command_load(), but from a file already loaded and to a buffer of the chip size
+// that command_use() makes current later. The data must fit in the chip
+//
+status_t command_extract( const image_t *image, char *filename, const format_st_t *format, uint32_t base,
+                          uint8_t chip, uint8_t *buffer, mem_block_t **blocks )
 {
-    sprintf( cmd_buf, "%c %x %x %x\n", command, chip, address, *data );
+    if ( FAILURE == formats_extract( image, filename, format, base, rw_buf, sizeof( rw_buf ), blocks ) )
+    {
+        return FAILURE;
+    }
+
+    for ( mem_block_t *b = *blocks; NULL != b; b = b->next )
+    {
+        if ( chip_count( chip, b ) < b->count )
+        {
+            files_free_blocks( *blocks );
+            *blocks = NULL;
+            return out_of_chip( chip, b );
+        }
+    }
+
+    memcpy( buffer, rw_buf, prom_chip_size( chip ) );
+
+    return SUCCESS;
 }
 
-static status_t command_execute(
+void command_use( uint8_t chip, const uint8_t *buffer )
+{
+    memcpy( rw_buf, buffer, prom_chip_size( chip ) );
+}
+
+// Simulates the write ('s'), or verifies the blocks by reading them back ('r') or by
+// their CRC ('h')
+//
+static status_t execute_blocks(
     char command,
-    cmdset_fn_t command_fn,
-    const char *message,
-    int fd,
-    char *device,
+    prom_session_t *session,
     uint8_t chip,
-    uint16_t address,
-    uint8_t *data,
-    char *ifile,
-    char *ofile,
-    const format_st_t *format )
+    mem_block_t *blocks )
 {
     status_t status = SUCCESS;
-    mem_block_t *b, *blocks = NULL;
-    int tries;
-    ssize_t returned;
-    uint8_t ret_stat;
-    uint8_t ret_val;
+    uint16_t total = 0, end;
+    mem_block_t *b;
+
+    for ( b = blocks; NULL != b; b = b->next )
+    {
+        total += chip_count( chip, b );
+    }
 
+    progress_begin( &progress, ( command == 's' ) ? "simulate" : "verify", total, 0, 0, progress_print, NULL );
 
-    if ( ifile )
+    for ( b = blocks; NULL != b; b = b->next )
     {
-        if ( FAILURE == format->read_fn( ifile, rw_buf, sizeof( rw_buf ), &blocks ) )
+        uint16_t count = chip_count( chip, b );
+
+        if ( count && command == 's' )
+        {
+            status = prom_simulate( session, chip, b->start, count, &rw_buf[b->start], &end );
+        }
+        else if ( count )
+        {
+            mismatch_t mismatch = { b->start, count, command == 'h' };
+
+            status = ( command == 'h' )
+                ? prom_fast_verify( session, chip, b->start, count, &rw_buf[b->start], &end, report_mismatch, &mismatch )
+                : prom_verify( session, chip, b->start, count, &rw_buf[b->start], &end, report_mismatch, &mismatch );
+
+            if ( status == SUCCESS && end < b->start + count )
+            {
+                status = FAILURE;
+            }
+        }
+
+        if ( status == SUCCESS && count )
+        {
+            progress_step( &progress, b->start + count - 1, count, 0 );
+        }
+
+        if ( status == SUCCESS && count < b->count )
+        {
+            status = out_of_chip( chip, b );
+        }
+
+        if ( status == FAILURE )
         {
+            progress_end( &progress, FAILURE );
             return FAILURE;
         }
     }
-    else
+
+    progress_end( &progress, SUCCESS );
+    fputs( "Success.\n", stderr );
+
+    return SUCCESS;
+}
+
+static status_t report_check( const prom_check_t *total )
+{
+    fprintf( stderr, "%u bytes already programmed, %u to program ( %u bits ), %u impossible.\n",
+                total->correct, total->program, total->bits, total->impossible );
+
+    if ( total->impossible )
+    {
+        fprintf( stderr, "Error: Chip can't be programmed with this data. Byte at address 0x%03X has bits already programmed.\n", total->first );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Reads the chip once to tell if it can be programmed with the blocks. Returns FAILURE
+// if not, and the number of bytes and bits to program in 'total'
+//
+static status_t check_blocks( prom_session_t *session, uint8_t chip, mem_block_t *blocks, prom_check_t *total )
+{
+    prom_check_t check;
+    mem_block_t *b;
+
+    memset( total, 0, sizeof( prom_check_t ) );
+    total->first = prom_chip_size( chip );
+
+    for ( b = blocks; NULL != b; b = b->next )
     {
-        blocks = malloc( sizeof( sizeof( mem_block_t ) ) );
+        uint16_t count = chip_count( chip, b );
 
-        if ( NULL == blocks )
+        if ( count < b->count )
         {
-            perror( "Can't alloc memory for new hex block\n" );
-            return FAILURE;
+            return out_of_chip( chip, b );
         }
-        if ( FAILURE == str_process( data, &rw_buf[address], sizeof( rw_buf ) - address, &blocks->count ) )
+
+        if ( FAILURE == prom_check( session, chip, b->start, count, &rw_buf[b->start], &check ) )
         {
             return FAILURE;
         }
-        blocks->start = address;
-        blocks->next = NULL;
+
+        total->correct += check.correct;
+        total->program += check.program;
+        total->bits += check.bits;
+        if ( check.impossible && ! total->impossible )
+        {
+            total->first = check.first;
+        }
+        total->impossible += check.impossible;
+    }
+
+    return report_check( total );
+}
+
+status_t command_check(
+    prom_session_t *session,
+    uint8_t chip,
+    uint16_t address,           // Unused
+    uint16_t count,             // Unused
+    mem_block_t *blocks,
+    char *ofile,                // Unused
+    const format_st_t *format
+    )
+{
+    prom_check_t total;
+    status_t status;
+
+    status = check_blocks( session, chip, blocks, &total );
+
+    if ( SUCCESS == status )
+    {
+        fputs( "Chip can be programmed with this data.\n", stderr );
     }
 
-    b = blocks;
-    while ( NULL != b )
+    return status;
+}
+
+// Fills 'existing' with the chip contents at the wanted addresses. With the occupancy
+// index, only the span from the first to the last of them that is not zero is read,
+// and nothing at all if they are all blank. If not, the whole chip
+//
+static status_t read_existing( prom_session_t *session, uint8_t chip, const bool *wanted, uint8_t *existing )
+{
+    uint16_t size = prom_chip_size( chip ), first = size, last = 0;
+    prom_map_t map;
+
+    if ( FAILURE == prom_map( session, chip, &map ) )
     {
-        uint16_t loc, end = b->start + b->count; 
+        return prom_read( session, chip, 0, size, existing );
+    }
 
-        for ( loc = b->start; loc < end; ++loc )
+    memset( existing, 0, size );
+
+    for ( uint16_t loc = 0; loc < size; ++loc )
+    {
+        if ( wanted[loc] && map.used[loc / 8] & ( 1 << ( loc % 8 ) ) )
         {
-            if ( loc >= chip_sizes[chip] )
+            if ( first == size )
             {
-                fprintf( stderr, "Address 0x%X is larger than last chip cell ( 0x%X )\n", loc, chip_sizes[chip]-1 );
-                status = FAILURE;
-                break;
+                first = loc;
             }
+            last = loc;
+        }
+    }
 
-            putc( '.', stderr );
-            
-            command_fn( command, rec_buf, chip, loc, &rw_buf[loc] );
+    if ( first == size )
+    {
+        return SUCCESS;
+    }
 
-            if ( FAILURE == serial_write( fd, device, rec_buf, strlen( rec_buf ) ) )
-            {
-                status = FAILURE;
-                break;            
-            }
-        
-            for ( tries = 0; tries < 5; ++tries )
-            {
-                if ( FAILURE == (status = serial_read( fd, device, rec_buf, sizeof( rec_buf ), &returned ) ) )
-                {
-                    break;
-                }
-
-                if ( returned != 0 )
-                {
-                    break;
-                }
-            }
+    return prom_read( session, chip, first, last - first + 1, &existing[first] );
+}
 
-            if ( status == FAILURE )
-            {
-                break;
-            }
+// Reads the chip once and builds the list of runs of addresses that need bits
+// programmed, sorted and merged. Bytes that already have their value are left out.
+// Returns FAILURE if the chip can't take the data, with the totals in 'total'
+//
+static status_t plan_write( prom_session_t *session, uint8_t chip, mem_block_t *blocks, uint8_t *existing, mem_block_t **plan,
+                            prom_check_t *total )
+{
+    bool wanted[MAX_BLOCK] = { false };
+    mem_block_t *b, *run = NULL, **tail = plan;
+    uint16_t loc;
+
+    *plan = NULL;
+    memset( total, 0, sizeof( prom_check_t ) );
+    total->first = prom_chip_size( chip );
+
+    for ( b = blocks; NULL != b; b = b->next )
+    {
+        if ( chip_count( chip, b ) < b->count )
+        {
+            return out_of_chip( chip, b );
+        }
+        memset( &wanted[b->start], true, b->count );
+    }
+
+    if ( FAILURE == read_existing( session, chip, wanted, existing ) )
+    {
+        return FAILURE;
+    }
+
+    for ( loc = 0; loc < prom_chip_size( chip ); ++loc )
+    {
+        if ( ! wanted[loc] )
+        {
+            continue;
+        }
+
+        if ( existing[loc] == rw_buf[loc] )
+        {
+            ++total->correct;
+            continue;
+        }
 
-            if ( returned == 0 )
+        if ( existing[loc] & ~rw_buf[loc] )
+        {
+            if ( ! total->impossible++ )
             {
-                fprintf( stderr, "\nError: No response from programmer at port %s.\n", device );
-                status = FAILURE;
-                break;
+                total->first = loc;
             }
+            continue;
+        }
+
+        ++total->program;
+        total->bits += __builtin_popcount( rw_buf[loc] & ~existing[loc] );
+
+        if ( NULL != run && run->start + run->count == loc )
+        {
+            ++run->count;
+            continue;
+        }
+
+        if ( NULL == ( run = malloc( sizeof( mem_block_t ) ) ) )
+        {
+            perror( "Can't alloc memory for the write plan" );
+            files_free_blocks( *plan );
+            *plan = NULL;
+            return FAILURE;
+        }
+        run->start = loc;
+        run->count = 1;
+        run->next = NULL;
+        *tail = run;
+        tail = &run->next;
+    }
+
+    return report_check( total );
+}
+
+// Programs the runs of the plan, on a single progress line. Long runs go in pieces
+// of JOURNAL_BATCH bytes, to keep the journal up to date. 'existing' is the chip as
+// read by the plan, for the bits programmed
+//
+static status_t execute_plan( prom_session_t *session, uint8_t chip, mem_block_t *plan, const uint8_t *existing,
+                              const prom_check_t *total, uint32_t bit_time, journal_t *journal )
+{
+    mem_block_t *run;
+    uint16_t written = 0, done;
+
+    progress_begin( &progress, "write", total->program, total->bits, bit_time * 1000, progress_print, NULL );
 
-            if ( 2 != sscanf( rec_buf, "%hhx\r\n%c\r\n", &ret_val, &ret_stat ) || ret_stat != 'R' )
+    for ( run = plan; NULL != run; run = run->next )
+    {
+        for ( uint16_t loc = run->start, end = run->start + run->count; loc < end; )
+        {
+            uint16_t count = ( end - loc > JOURNAL_BATCH ) ? JOURNAL_BATCH : end - loc;
+            uint32_t bits = 0;
+
+            for ( uint16_t i = loc; i < loc + count; ++i )
             {
-                fputs( "\nError: Bad programmer response.\n", stderr );
-                status = FAILURE;
-                break;
+                bits += __builtin_popcount( rw_buf[i] & ~existing[i] );
             }
 
-            if ( ! ((loc+1) % 73) )
-            {
-                fputs( "\n", stderr );
-            }            
-            
-            if ( ret_val != rw_buf[loc] )
+            if ( FAILURE == prom_write( session, chip, loc, count, &rw_buf[loc], &done ) )
             {
-                fprintf( stderr, "\nError %s prom address 0x%03X: Read == 0x%02x, expected == 0x%02x\n",
-                            message,
-                            loc,
-                            ret_val,
-                            rw_buf[loc]);
-                status = FAILURE;
-                break;
-            } 
+                progress_end( &progress, FAILURE );
+                return FAILURE;
+            }
+            progress_step( &progress, loc + count - 1, count, bits );
+            written += count;
+            loc += count;
+            journal_progress( journal, loc );
         }
+    }
 
-        fputs( "\n", stderr );
+    progress_end( &progress, SUCCESS );
+    fprintf( stderr, "Success. %u bytes programmed.\n", written );
 
-        if ( status == FAILURE )
-        {
-            break;
-        }
-        b = b->next;
+    return SUCCESS;
+}
+
+// Asks before burning anything. Several chips can share a confirmation, see
+// command_set_confirmed()
+//
+bool command_confirm( void )
+{
+    char answer[8];
+
+    fputs( "WARNING: Programming is irreversible. Are you sure? Type YES to confirm\n", stderr );
+
+    return NULL != fgets( answer, sizeof( answer ), stdin ) && ! strcmp( "YES\n", answer );
+}
+
+void command_set_confirmed( bool yes )
+{
+    confirmed = yes;
+}
+
+void command_set_resume( bool yes )
+{
+    resume = yes;
+}
+
+// Identifies the data to program, with its addresses, for the journal
+//
+static uint32_t image_hash( const mem_block_t *blocks )
+{
+    uint32_t crc = 0xFFFFFFFF;
+
+    for ( const mem_block_t *b = blocks; NULL != b; b = b->next )
+    {
+        uint8_t range[4] = { b->start & 0xFF, b->start >> 8, b->count & 0xFF, b->count >> 8 };
+
+        crc = protocol_crc32( crc, range, sizeof( range ) );
+        crc = protocol_crc32( crc, &rw_buf[b->start], b->count );
     }
 
-    files_free_blocks( blocks );
+    return ~crc;
+}
+
+// Checks that the chip is the one of the interrupted write, verifying what the journal
+// says was written, and gets the rest of the data in 'rest'
+//
+static status_t resume_write( prom_session_t *session, uint8_t chip, mem_block_t *blocks, journal_t *journal, mem_block_t **rest )
+{
+    mem_block_t *written;
+    status_t status;
 
-    if ( status == SUCCESS )
+    if ( journal->chip != chip || journal->image != image_hash( blocks ) )
     {
-        fputs( "Success.\n", stderr );
+        fprintf( stderr, "Error: The interrupted write on %s was of another image or chip.\n", prom_device( session ) );
+        return FAILURE;
     }
 
-    return status;
+    if ( FAILURE == files_clip_blocks( blocks, 0, journal->done, &written ) )
+    {
+        return FAILURE;
+    }
+
+    fprintf( stderr, "Resuming the write interrupted at 0x%03X.\n", journal->done );
+
+    if ( NULL != written )
+    {
+        fputs( "Verifying what was written\n", stderr );
+        status = execute_blocks( 'r', session, chip, written );
+        files_free_blocks( written );
+
+        if ( FAILURE == status )
+        {
+            fputs( "Error: This is not the chip of the interrupted write.\n", stderr );
+            return FAILURE;
+        }
+    }
+
+    return files_clip_blocks( blocks, journal->done, UINT16_MAX, rest );
 }
 
 status_t command_write(
-    int fd,
-    char *device,
+    prom_session_t *session,
     uint8_t chip,
-    uint16_t address,
+    uint16_t address,           // Unused
     uint16_t count,             // Unused
-    uint8_t *data,
-    char *ifile,
+    mem_block_t *blocks,
     char *ofile,                // Unused
     const format_st_t *format
     )
 {
-    fputs( "WARNING: Programming is irreversible. Are you sure? Type YES to confirm\n", stderr );
-    if ( NULL != fgets( rw_buf, sizeof( rw_buf ), stdin ) )
+    mem_block_t *plan = NULL, *rest = NULL;
+    uint8_t existing[MAX_BLOCK];
+    status_t status = FAILURE;
+    unsigned long estimate;
+    uint32_t bit_time;
+    uint64_t start = stats_now();
+    journal_t journal;
+    prom_check_t total;
+
+    if ( resume )
     {
-        if ( ! strcmp( "YES\n", rw_buf ) )
+        status = journal_load( &journal, prom_device( session ) );
+
+        if ( SUCCESS == status ) status = resume_write( session, chip, blocks, &journal, &rest );
+
+        stats_phase( prom_timing( session ), "resume", start, status );
+
+        if ( FAILURE == status )
         {
-            fputs( "Writing\n", stderr );
-            return command_execute( 'w', command_set_write, "writing to", fd, device, chip, address, data, ifile, ofile, format );
+            return FAILURE;
         }
+
+        blocks = rest;
+        start = stats_now();
     }
-    fputs( "Aborted by user.\n", stderr );
-    return FAILURE;
+    else if ( FAILURE == journal_init( &journal, prom_device( session ), chip, image_hash( blocks ) ) )
+    {
+        return FAILURE;
+    }
+
+    // Only send what needs programming, and don't burn anything on a chip that can't
+    // take the data
+    status = plan_write( session, chip, blocks, existing, &plan, &total );
+    stats_phase( prom_timing( session ), "plan", start, status );
+
+    files_free_blocks( rest );
+
+    if ( FAILURE == status )
+    {
+        return FAILURE;
+    }
+
+    if ( ! total.program )
+    {
+        fputs( "Nothing to program.\n", stderr );
+        files_free_blocks( plan );
+
+        if ( resume )
+        {
+            journal_remove( &journal );
+        }
+
+        return SUCCESS;
+    }
+
+    bit_time = ( PULSE_ADAPTIVE == prom_pulse( session ) ) ? ADAPTIVE_BIT_TIME : FIXED_BIT_TIME;
+    estimate = (unsigned long) total.bits * bit_time;
+    fprintf( stderr, "About %u pulses, estimated time %lu.%02lus.\n", total.bits, estimate / 1000, estimate % 1000 / 10 );
+
+    if ( ! ( confirmed || command_confirm() ) )
+    {
+        fputs( "Aborted by user.\n", stderr );
+        status = FAILURE;
+    }
+    else if ( SUCCESS == ( status = journal_save( &journal ) ) )
+    {
+        fputs( "Writing\n", stderr );
+        start = stats_now();
+        status = execute_plan( session, chip, plan, existing, &total, bit_time, &journal );
+        stats_phase( prom_timing( session ), "program", start, status );
+
+        if ( SUCCESS == status )
+        {
+            journal_remove( &journal );
+        }
+        else if ( SUCCESS == journal_save( &journal ) )
+        {
+            fprintf( stderr, "Written up to 0x%03X. Run the same write with '-resume' to continue.\n", journal.done );
+        }
+    }
+
+    files_free_blocks( plan );
+
+    return status;
 }
 
 status_t command_simul(
-    int fd,
-    char *device,
+    prom_session_t *session,
     uint8_t chip,
-    uint16_t address,
+    uint16_t address,           // Unused
     uint16_t count,             // Unused
-    uint8_t *data,
-    char *ifile,
+    mem_block_t *blocks,
     char *ofile,                // Unused
     const format_st_t *format
     )
 {
     fputs( "Performing a write simulation\n", stderr );
-    return command_execute( 's', command_set_write, "writing (simulated) to", fd, device, chip, address, data, ifile, ofile, format );
+    return execute_blocks( 's', session, chip, blocks );
 }
 
 status_t command_verify(
-    int fd,
-    char *device,
+    prom_session_t *session,
     uint8_t chip,
-    uint16_t address,
+    uint16_t address,           // Unused
     uint16_t count,             // Unused
-    uint8_t *data,
-    char *ifile,
+    mem_block_t *blocks,
     char *ofile,                // Unused
     const format_st_t *format
     )
 {
     fputs( "Verifying\n", stderr );
-    return command_execute( 'r', command_set_read, "verifying", fd, device, chip, address, data, ifile, ofile, format );
+    return execute_blocks( 'r', session, chip, blocks );
+}
+
+status_t command_fast_verify(
+    prom_session_t *session,
+    uint8_t chip,
+    uint16_t address,           // Unused
+    uint16_t count,             // Unused
+    mem_block_t *blocks,
+    char *ofile,                // Unused
+    const format_st_t *format
+    )
+{
+    if ( ! prom_has_blocks( session ) )
+    {
+        fputs( "Warning: Firmware does not support fast verify, reading all data back.\n", stderr );
+        return command_verify( session, chip, address, count, blocks, ofile, format );
+    }
+
+    fputs( "Verifying CRCs\n", stderr );
+    return execute_blocks( 'h', session, chip, blocks );
+}
+
+// The mode is always set, as the programmer keeps the last one until reset
+//
+status_t command_set_pulse( prom_session_t *session, pulse_mode_t pulse )
+{
+    if ( ! prom_has_blocks( session ) && pulse != PULSE_FIXED )
+    {
+        fputs( "Warning: Firmware does not support adaptive pulses, using fixed ones.\n", stderr );
+        return SUCCESS;
+    }
+
+    return prom_set_pulse( session, pulse );
 }
 
-status_t command_init( int fd, char *device )
+// Programmer counters for the statistics report. Called before a command to clear
+// them and after it to report them. Fails if the firmware does not keep them
+//
+status_t command_stats( prom_session_t *session, bool report )
 {
-    int n, tries;
-    ssize_t returned;
+    programmer_stats_t counters;
 
-    // Flush does not work for USB adapters, so we just discard any data that
-    // does not fit with what we expect
-    //
-    for ( tries = 0; tries < 5; ++tries )
+    if ( FAILURE == prom_stats( session, &counters ) )
     {
-        if ( FAILURE == serial_write( fd, device, "V", 1 ) )                   // Get version
-        {
-            return FAILURE;
-        }
+        return FAILURE;
+    }
 
-        if ( FAILURE == serial_read( fd, device, rec_buf, sizeof( rec_buf ), &returned ) )
-        {
-            return FAILURE;
-        }
+    if ( report )
+    {
+        stats_programmer( prom_timing( session ), &counters );
+    }
 
-        if ( returned == 12 )
-        {
-            break;
-        }
+    return SUCCESS;
+}
+
+// Opens a session with the programmer at 'device'. It must be closed with
+// command_close() even if this fails
+//
+status_t command_init( prom_session_t **session, char *device, bool ascii, pulse_mode_t pulse, uint32_t max_baud, stats_t *stats )
+{
+    prom_config_t config = { ascii, false, max_baud, stats };
+    const uint8_t *version;
+
+    if ( NULL == ( *session = prom_new( &config ) ) )
+    {
+        perror( "Can't alloc memory for the session" );
+        return FAILURE;
     }
-    
-    uint8_t v1, v2, v3, stat;
 
-    if ( returned != 12 || 4 != sscanf( rec_buf, "%*[V]%2hhd%2hhd%2hhd\r\n%c\r\n", &v1, &v2, &v3, &stat ) || stat != 'R' )
+    if ( FAILURE == prom_open( *session, device ) )
     {
-        fprintf( stderr, "Error: Programmer not detected at port %s\n", device );
         return FAILURE;
     }
-    else
+
+    version = prom_version( *session );
+    fprintf( stderr, "Connected to programmer, firmware V%2.2d.%2.2d.%2.2d.\n", version[0], version[1], version[2] );
+
+    if ( prom_baud( *session ) != SERIAL_DEFAULT_BAUD )
     {
-        fprintf( stderr, "Connected to programmer, firmware V%2.2d.%2.2d.%2.2d.\n", v1, v2, v3 );
-        return SUCCESS;
+        fprintf( stderr, "Switched to %u baud.\n", prom_baud( *session ) );
     }
 
-}
\ No newline at end of file
+    return command_set_pulse( *session, pulse );
+}
+
+void command_close( prom_session_t *session )
+{
+    prom_free( session );
+}
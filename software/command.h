@@ -29,17 +29,33 @@
 #ifndef COMMAND_H
 #define COMMAND_H
 
+#include <stdbool.h>
+
 #include "globals.h"
 #include "options.h"
 #include "files.h"
+#include "protocol.h"
+#include "libprom.h"
 
-typedef status_t (*cmd_fn_t)( int fd, char *device, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data, char *ifile, char *ofile, const format_st_t *format );
+typedef status_t (*cmd_fn_t)( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, mem_block_t *blocks, char *ofile, const format_st_t *format );
 
-status_t command_init( int fd, char *device );
-status_t command_blank( int fd, char *device, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data, char *ifile, char *ofile, const format_st_t *format );
-status_t command_read( int fd, char *device, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data, char *ifile, char *ofile, const format_st_t *format );
-status_t command_write( int fd, char *device, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data, char *ifile, char *ofile, const format_st_t *format );
-status_t command_simul( int fd, char *device, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data, char *ifile, char *ofile, const format_st_t *format );
-status_t command_verify( int fd, char *device, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data, char *ifile, char *ofile, const format_st_t *format );
+status_t command_init( prom_session_t **session, char *device, bool ascii, pulse_mode_t pulse, uint32_t max_baud, stats_t *stats );
+status_t command_set_pulse( prom_session_t *session, pulse_mode_t pulse );
+status_t command_stats( prom_session_t *session, bool report );
+void command_close( prom_session_t *session );
+status_t command_load( uint16_t address, uint8_t *data, char *ifile, uint32_t base, const format_st_t *format, mem_block_t **blocks );
+status_t command_extract( const image_t *image, char *filename, const format_st_t *format, uint32_t base,
+                          uint8_t chip, uint8_t *buffer, mem_block_t **blocks );
+void command_use( uint8_t chip, const uint8_t *buffer );
+bool command_confirm( void );
+void command_set_confirmed( bool yes );
+void command_set_resume( bool yes );
+status_t command_blank( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, mem_block_t *blocks, char *ofile, const format_st_t *format );
+status_t command_read( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, mem_block_t *blocks, char *ofile, const format_st_t *format );
+status_t command_check( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, mem_block_t *blocks, char *ofile, const format_st_t *format );
+status_t command_write( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, mem_block_t *blocks, char *ofile, const format_st_t *format );
+status_t command_simul( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, mem_block_t *blocks, char *ofile, const format_st_t *format );
+status_t command_verify( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, mem_block_t *blocks, char *ofile, const format_st_t *format );
+status_t command_fast_verify( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, mem_block_t *blocks, char *ofile, const format_st_t *format );
 
 #endif /* COMMAND_H */
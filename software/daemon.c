@@ -0,0 +1,438 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Daemon mode, keeps the connection to the programmer open between commands
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#define _GNU_SOURCE                 // For struct ucred
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "globals.h"
+#include "files.h"
+#include "daemon.h"
+
+#define SOCKET_DIR      "/tmp"      // Without XDG_RUNTIME_DIR, for a prom-<uid> directory
+#define REQUEST_SIZE    4096        // Max length of a command line
+#define MAX_ARGS        64
+#define REQUEST_FDS     4           // stdin, stdout, stderr and current directory
+
+// A request is a single packet with the command line, the NUL separated arguments,
+// and the file descriptors of the client. The answer is a single status byte.
+typedef struct {
+    uint8_t confirmed;              // Programming already confirmed by the user
+    uint8_t argc;
+    char args[REQUEST_SIZE];
+} request_t;
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal( int signum )
+{
+    quit = 1;
+}
+
+// The socket of a device is prom-<device path, with '_' for '/'>.sock, in a directory
+// that only the user can get into, so nobody else can serve or send requests: the
+// XDG_RUNTIME_DIR of the session, or /tmp/prom-<uid>. The daemon creates the last one
+//
+static status_t socket_address( char *device, struct sockaddr_un *addr, bool create )
+{
+    const char *runtime = getenv( "XDG_RUNTIME_DIR" );
+    char dir[sizeof( addr->sun_path )];
+    char *c;
+    int len;
+
+    if ( NULL != runtime && runtime[0] == '/' )
+    {
+        len = snprintf( dir, sizeof( dir ), "%s", runtime );
+    }
+    else
+    {
+        len = snprintf( dir, sizeof( dir ), SOCKET_DIR "/prom-%u", (unsigned) geteuid() );
+    }
+
+    if ( len < 0 || len >= (int) sizeof( dir ) || FAILURE == files_private_dir( dir, create ) )
+    {
+        return FAILURE;
+    }
+
+    memset( addr, 0, sizeof( struct sockaddr_un ) );
+    addr->sun_family = AF_UNIX;
+
+    len = snprintf( addr->sun_path, sizeof( addr->sun_path ), "%s/prom-%s.sock", dir, device );
+
+    if ( len < 0 || len >= (int) sizeof( addr->sun_path ) )
+    {
+        fprintf( stderr, "Error: Device name too long: %s\n", device );
+        return FAILURE;
+    }
+
+    for ( c = addr->sun_path + strlen( dir ) + sizeof( "/prom-" ) - 1; *c; ++c )
+    {
+        if ( *c == '/' )
+        {
+            *c = '_';
+        }
+    }
+
+    return SUCCESS;
+}
+
+// The other end of the connection runs as the same user
+//
+static bool peer_is_user( int sock )
+{
+    struct ucred cred;
+    socklen_t len = sizeof( cred );
+
+    return 0 == getsockopt( sock, SOL_SOCKET, SO_PEERCRED, &cred, &len ) && cred.uid == geteuid();
+}
+
+// Only to a socket of the user, served by a daemon of the user, as the request passes
+// the terminal and the current directory
+//
+static int connect_daemon( struct sockaddr_un *addr )
+{
+    struct stat st;
+    int sock;
+
+    if ( -1 == lstat( addr->sun_path, &st ) || ! S_ISSOCK( st.st_mode ) || st.st_uid != geteuid() )
+    {
+        return -1;
+    }
+
+    sock = socket( AF_UNIX, SOCK_SEQPACKET, 0 );
+
+    if ( sock != -1 && ( -1 == connect( sock, (struct sockaddr *) addr, sizeof( struct sockaddr_un ) ) || ! peer_is_user( sock ) ) )
+    {
+        close( sock );
+        sock = -1;
+    }
+
+    return sock;
+}
+
+// Creates the socket before opening the device, so a second daemon does not reset
+// the programmer under the first one
+//
+status_t daemon_listen( char *device, int *sock )
+{
+    struct sockaddr_un addr;
+    int other;
+
+    if ( FAILURE == socket_address( device, &addr, true ) )
+    {
+        return FAILURE;
+    }
+
+    if ( -1 != ( other = connect_daemon( &addr ) ) )
+    {
+        close( other );
+        fprintf( stderr, "Error: A daemon is already serving %s\n", device );
+        return FAILURE;
+    }
+
+    unlink( addr.sun_path );            // Left behind by a daemon that did not end well
+
+    if ( -1 == ( *sock = socket( AF_UNIX, SOCK_SEQPACKET, 0 ) )
+        || -1 == bind( *sock, (struct sockaddr *) &addr, sizeof( addr ) )
+        || -1 == listen( *sock, 4 ) )
+    {
+        fprintf( stderr, "Error %d creating socket %s: %s\n", errno, addr.sun_path, strerror( errno ) );
+        if ( *sock != -1 )
+        {
+            close( *sock );
+        }
+        return FAILURE;
+    }
+
+    fprintf( stderr, "Serving %s at %s\n", device, addr.sun_path );
+
+    return SUCCESS;
+}
+
+// Receives a request and its file descriptors. Returns the number of arguments, or 0
+// if it is not valid
+//
+static int receive_request( int conn, request_t *request, char **argv, int *fds )
+{
+    union {
+        char buf[CMSG_SPACE( sizeof( int ) * REQUEST_FDS )];
+        struct cmsghdr align;
+    } control;
+    struct iovec iov = { request, sizeof( request_t ) };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg;
+    ssize_t len;
+    char *arg, *end;
+    int argc = 0;
+
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof( control.buf );
+
+    len = recvmsg( conn, &msg, 0 );
+
+    cmsg = CMSG_FIRSTHDR( &msg );
+
+    if ( len <= 0 || NULL == cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN( sizeof( int ) * REQUEST_FDS ) )
+    {
+        return 0;
+    }
+
+    memcpy( fds, CMSG_DATA( cmsg ), sizeof( int ) * REQUEST_FDS );
+
+    end = (char *) request + len;
+
+    for ( arg = request->args; arg < end && argc < request->argc && argc < MAX_ARGS; arg += strlen( arg ) + 1 )
+    {
+        if ( NULL == memchr( arg, '\0', end - arg ) )
+        {
+            break;
+        }
+        argv[argc++] = arg;
+    }
+
+    if ( argc != request->argc )
+    {
+        for ( int i = 0; i < REQUEST_FDS; ++i )
+        {
+            close( fds[i] );
+        }
+        return 0;
+    }
+
+    argv[argc] = NULL;
+
+    return argc;
+}
+
+// Runs the request with the streams and the current directory of the client
+//
+static status_t run_request( prom_session_t *session, daemon_fn_t request, int argc, char **argv, bool confirmed, int *fds )
+{
+    int saved[REQUEST_FDS];
+    status_t status = FAILURE;
+    int i;
+
+    fflush( NULL );
+
+    for ( i = 0; i < 3; ++i )
+    {
+        saved[i] = dup( i );
+        dup2( fds[i], i );
+    }
+    saved[3] = open( ".", O_RDONLY | O_DIRECTORY );
+
+    if ( -1 == fchdir( fds[3] ) )
+    {
+        perror( "Error changing to the current directory of the client" );
+    }
+    else
+    {
+        // The chip may have been changed since the last request
+        prom_forget( session );
+        status = request( session, argc, argv, confirmed );
+    }
+
+    fflush( NULL );
+    clearerr( stdin );
+
+    if ( saved[3] != -1 && -1 == fchdir( saved[3] ) )
+    {
+        perror( "Error restoring the current directory" );
+    }
+
+    for ( i = 0; i < REQUEST_FDS; ++i )
+    {
+        if ( i < 3 )
+        {
+            dup2( saved[i], i );
+        }
+        close( saved[i] );
+        close( fds[i] );
+    }
+
+    return status;
+}
+
+// Serves requests, one at a time, until interrupted
+//
+status_t daemon_serve( int sock, prom_session_t *session, char *device, daemon_fn_t request )
+{
+    struct sigaction action = { 0 };
+    struct sockaddr_un addr;
+    socklen_t addr_len = sizeof( addr );
+    static request_t packet;
+    char *argv[MAX_ARGS + 1];
+    int fds[REQUEST_FDS];
+    int conn, argc;
+    uint8_t answer;
+
+    // No SA_RESTART, so accept() returns when interrupted
+    action.sa_handler = on_signal;
+    sigaction( SIGINT, &action, NULL );
+    sigaction( SIGTERM, &action, NULL );
+    // The client may go away in the middle of a command
+    signal( SIGPIPE, SIG_IGN );
+    // Nothing read from a client can be left for the next one
+    setvbuf( stdin, NULL, _IONBF, 0 );
+
+    getsockname( sock, (struct sockaddr *) &addr, &addr_len );
+
+    while ( ! quit )
+    {
+        if ( -1 == ( conn = accept( sock, NULL, NULL ) ) )
+        {
+            if ( errno != EINTR )
+            {
+                perror( "Error accepting connection" );
+            }
+            continue;
+        }
+
+        // The directory keeps others out, but its permissions may have been changed
+        if ( ! peer_is_user( conn ) )
+        {
+            fputs( "Error: Request from another user refused\n", stderr );
+            close( conn );
+            continue;
+        }
+
+        if ( 0 != ( argc = receive_request( conn, &packet, argv, fds ) ) )
+        {
+            answer = ( SUCCESS == run_request( session, request, argc, argv, packet.confirmed, fds ) );
+            send( conn, &answer, 1, MSG_NOSIGNAL );
+        }
+
+        close( conn );
+    }
+
+    fputs( "Daemon stopped.\n", stderr );
+
+    close( sock );
+    unlink( addr.sun_path );
+
+    return SUCCESS;
+}
+
+// Sends the command line to the daemon serving the device, if there is one. Returns
+// FAILURE, without any message, if not
+//
+status_t daemon_request( char *device, int argc, char **argv, bool confirmed, status_t *status )
+{
+    union {
+        char buf[CMSG_SPACE( sizeof( int ) * REQUEST_FDS )];
+        struct cmsghdr align;
+    } control;
+    static request_t packet;
+    struct sockaddr_un addr;
+    struct iovec iov = { &packet, 0 };
+    struct msghdr msg = { 0 };
+    struct cmsghdr *cmsg;
+    int fds[REQUEST_FDS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1 };
+    size_t len = 0, arg_len;
+    int sock, i;
+    uint8_t answer;
+
+    if ( FAILURE == socket_address( device, &addr, false ) || -1 == ( sock = connect_daemon( &addr ) ) )
+    {
+        return FAILURE;
+    }
+
+    if ( argc > MAX_ARGS )
+    {
+        fprintf( stderr, "Error: Too many arguments for the daemon\n" );
+        close( sock );
+        *status = FAILURE;
+        return SUCCESS;
+    }
+
+    for ( i = 0; i < argc; ++i )
+    {
+        arg_len = strlen( argv[i] ) + 1;
+
+        if ( len + arg_len > sizeof( packet.args ) )
+        {
+            fprintf( stderr, "Error: Command line too long for the daemon\n" );
+            close( sock );
+            *status = FAILURE;
+            return SUCCESS;
+        }
+        memcpy( &packet.args[len], argv[i], arg_len );
+        len += arg_len;
+    }
+
+    packet.confirmed = confirmed;
+    packet.argc = argc;
+
+    fds[3] = open( ".", O_RDONLY | O_DIRECTORY );
+
+    iov.iov_len = offsetof( request_t, args ) + len;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof( control.buf );
+    cmsg = CMSG_FIRSTHDR( &msg );
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN( sizeof( int ) * REQUEST_FDS );
+    memcpy( CMSG_DATA( cmsg ), fds, sizeof( fds ) );
+
+    fflush( NULL );
+
+    if ( fds[3] == -1 || -1 == sendmsg( sock, &msg, 0 ) )
+    {
+        fprintf( stderr, "Error %d sending request to the daemon: %s\n", errno, strerror( errno ) );
+        *status = FAILURE;
+    }
+    else
+    {
+        *status = ( 1 == recv( sock, &answer, 1, 0 ) && answer ) ? SUCCESS : FAILURE;
+    }
+
+    if ( fds[3] != -1 )
+    {
+        close( fds[3] );
+    }
+    close( sock );
+
+    return SUCCESS;
+}
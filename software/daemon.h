@@ -0,0 +1,45 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Daemon mode, keeps the connection to the programmer open between commands
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stdbool.h>
+
+#include "globals.h"
+#include "libprom.h"
+
+// Runs a command line received by the daemon, with the standard streams and current
+// directory of the client
+typedef status_t (*daemon_fn_t)( prom_session_t *session, int argc, char **argv, bool confirmed );
+
+status_t daemon_listen( char *device, int *sock );
+status_t daemon_serve( int sock, prom_session_t *session, char *device, daemon_fn_t request );
+status_t daemon_request( char *device, int argc, char **argv, bool confirmed, status_t *status );
+
+#endif /* DAEMON_H */
@@ -0,0 +1,116 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * The parts of the Arduino core used by the firmware, for the emulator
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "binary.h"
+
+typedef uint8_t byte;
+typedef uint16_t word;
+typedef bool boolean;
+
+#define HIGH        1
+#define LOW         0
+
+#define BIN         2
+#define DEC         10
+#define HEX         16
+
+#define A8          62
+#define A9          63
+#define A10         64
+
+// ATmega2560 ports. Every write goes through the emulated hardware
+//
+class Port {
+public:
+    Port &operator=( uint8_t value ) { this->value = value; changed(); return *this; }
+    Port &operator|=( uint8_t value ) { this->value |= value; changed(); return *this; }
+    Port &operator&=( uint8_t value ) { this->value &= value; changed(); return *this; }
+    operator uint8_t() const { return value; }
+    uint8_t value = 0;
+
+private:
+    void changed( void );
+};
+
+extern Port PORTA, PORTC, PORTF, PORTK, PORTL;
+extern Port DDRA, DDRC, DDRF, DDRK, DDRL;
+
+uint8_t emulator_data_bus( void );
+#define PINF        ( emulator_data_bus() )
+
+void delay( unsigned long ms );
+void delayMicroseconds( unsigned int us );
+unsigned long millis( void );
+unsigned long micros( void );
+
+static inline bool isSpace( int c ) { return isspace( c ); }
+static inline bool isHexadecimalDigit( int c ) { return isxdigit( c ); }
+
+// Serial port over the pseudo-terminal
+//
+class HardwareSerial {
+public:
+    void begin( unsigned long baud );
+    void end( void ) {}
+    int available( void );
+    int peek( void );
+    int read( void );
+    int availableForWrite( void );
+    void flush( void );
+    size_t write( uint8_t c );
+    size_t write( const char *s );
+
+    size_t print( const char *s ) { return write( s ); }
+    size_t print( char c ) { return write( (uint8_t) c ); }
+    size_t print( unsigned long n, int base = DEC );
+    size_t print( long n, int base = DEC ) { return print( (unsigned long) n, base ); }
+    size_t print( unsigned int n, int base = DEC ) { return print( (unsigned long) n, base ); }
+    size_t print( int n, int base = DEC ) { return print( (unsigned long) n, base ); }
+    size_t print( unsigned char n, int base = DEC ) { return print( (unsigned long) n, base ); }
+
+    size_t println( void ) { return write( "\r\n" ); }
+    template <typename T> size_t println( T value ) { return print( value ) + println(); }
+    template <typename T> size_t println( T value, int base ) { return print( value, base ) + println(); }
+
+    operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+void setup( void );
+void loop( void );
+
+#endif /* ARDUINO_H */
@@ -0,0 +1,747 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Programmer emulator: runs the firmware against an emulated shield and
+ * PROM, with the serial port on a pseudo-terminal
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <pty.h>
+#include <signal.h>
+#include <setjmp.h>
+#include <getopt.h>
+#include <libgen.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "Arduino.h"
+#include "chips.h"
+
+#define MAX_SIZE        512         // The largest chip of chips.h
+#define BLOW_TIME       900         // In us. Datasheet guarantees a bit is programmed with a 0.9ms pulse
+#define MARGINAL_MIN    300         // In us. Range of blow times of marginal chips
+#define MARGINAL_MAX    3000
+#define MAX_PULSE       10000       // In us. Datasheet max pulse length
+#define MAX_DUTY        35          // In %. Datasheet max duty cycle
+#define MAX_DEAD        16
+#define SERIAL_BUFFER   64          // Size of both Arduino serial buffers
+#define UNTIMED_BUFFER  4096        // Output is just batched when not timed
+#define BUSY_WAIT_STEP  100         // In us. Clock advance of a busy wait when not timed
+#define BITS_PER_BYTE   10          // 8N1
+
+// Control lines, as in the firmware
+#define PK_10V5         B00000001
+#define PK_VCC_EN       B00000010
+#define PK_S1           B00000100
+#define PC_S2           B10000000
+
+Port PORTA, PORTC, PORTF, PORTK, PORTL;
+Port DDRA, DDRC, DDRF, DDRK, DDRL;
+HardwareSerial Serial;
+
+static const char *myname;
+static bool timed = false;          // Real delays and serial speed, or as fast as possible
+static bool verbose = false;
+static bool reset_on_open = true;   // As the Arduino does on DTR
+static unsigned boot_time = 0;      // In ms. Bootloader time after a reset
+static const char *save_file = NULL;
+
+// The PROM
+
+static const chip_desc_t chips[NUM_CHIPS] = { CHIP_TABLE( CHIP_DESCRIPTOR ) };
+static const chip_desc_t *chip = &chips[CHIP_512X8];
+static uint8_t fuses[MAX_SIZE];     // A programmed bit reads as 1
+static uint32_t blow_time[MAX_SIZE][8]; // Pulse time a bit needs to program
+static uint32_t applied[MAX_SIZE][8];   // Pulse time it has got
+
+// The pulse in progress and the statistics
+
+static bool pulsing = false;
+static uint64_t pulse_start, last_pulse_end, last_pulse_length;
+static unsigned pulse_address;
+static uint8_t pulse_mask;
+static uint64_t pulses, pulse_time, duty_violations, long_pulses, bad_masks;
+
+// Time
+
+static struct timespec start_time;
+static uint64_t skipped = 0;        // In us. Time not actually waited when not timed
+static bool clock_read = false;     // Last call from the firmware was a clock read
+
+// Serial port
+
+static int master = -1;
+static uint32_t byte_time = 0;      // In ns, 0 if not timed
+static struct { uint8_t data; uint64_t due; } tx[UNTIMED_BUFFER], rx[SERIAL_BUFFER];
+static unsigned tx_head, tx_len, rx_head, rx_len;
+static uint64_t tx_last, rx_last;   // In ns. When the last byte ends going through the wire
+static bool hung_up = true;         // Nobody has the port open
+static jmp_buf reset_jmp;
+
+static uint64_t now_ns( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return ( now.tv_sec - start_time.tv_sec ) * 1000000000ULL + now.tv_nsec - start_time.tv_nsec + skipped * 1000;
+}
+
+static uint64_t now_us( void )
+{
+    return now_ns() / 1000;
+}
+
+static void sleep_until( uint64_t due )
+{
+    uint64_t now = now_ns(), ns = ( due > now ) ? due - now : 0;
+    struct timespec t = { (time_t) ( ns / 1000000000ULL ), (long) ( ns % 1000000000ULL ) };
+
+    nanosleep( &t, NULL );
+}
+
+//
+// Emulated hardware
+//
+
+static bool powered( void )
+{
+    return ! ( PORTK & PK_VCC_EN );
+}
+
+static bool high_voltage( void )
+{
+    return PORTK & PK_10V5;
+}
+
+// S2 is a chip select or an address line, as the descriptor of the chip says
+//
+static bool selected( void )
+{
+    return ! ( PORTK & PK_S1 ) && ( CHIP_S2_SELECT != chip->a_s2 || ! ( PORTC & PC_S2 ) );
+}
+
+static unsigned address( void )
+{
+    unsigned low;
+
+    if ( CHIP_S2_SELECT == chip->a_s2 )
+    {
+        return PORTA;
+    }
+
+    low = ( 1 << chip->a_s2 ) - 1;
+
+    return ( PORTA & low ) | ( ( PORTA & ~low & 0xFF ) << 1 ) | ( ( PORTC & PC_S2 ) ? low + 1 : 0 );
+}
+
+static void pulse_begin( void )
+{
+    pulsing = true;
+    pulse_start = now_us();
+    pulse_address = address();
+    pulse_mask = PORTL;
+
+    // Cooling is not enforced by the chip, only reported
+    if ( last_pulse_length && ( pulse_start - last_pulse_end ) * MAX_DUTY < last_pulse_length * ( 100 - MAX_DUTY ) )
+    {
+        ++duty_violations;
+        fprintf( stderr, "%s: Duty cycle violation: %lu us after a %lu us pulse\n", myname,
+                    (unsigned long) ( pulse_start - last_pulse_end ), (unsigned long) last_pulse_length );
+    }
+
+    if ( 1 != __builtin_popcount( pulse_mask ) )
+    {
+        ++bad_masks;
+        fprintf( stderr, "%s: Pulse with outputs %02X grounded at address %03X\n", myname, pulse_mask, pulse_address );
+    }
+}
+
+static void pulse_end( void )
+{
+    uint64_t length = now_us() - pulse_start;
+
+    pulsing = false;
+    last_pulse_end = now_us();
+    last_pulse_length = length;
+    ++pulses;
+    pulse_time += length;
+
+    if ( length > MAX_PULSE )
+    {
+        ++long_pulses;
+        fprintf( stderr, "%s: Pulse of %lu us at address %03X\n", myname, (unsigned long) length, pulse_address );
+    }
+
+    // Bits are one-way, once the fuse is blown it stays
+    for ( int bit = 0; bit < 8; ++bit )
+    {
+        if ( pulse_mask & ( 1 << bit ) )
+        {
+            applied[pulse_address][bit] += length;
+
+            if ( applied[pulse_address][bit] >= blow_time[pulse_address][bit] )
+            {
+                fuses[pulse_address] |= 1 << bit;
+            }
+        }
+    }
+}
+
+// A pulse is applied while the chip is at 10V5 and selected
+//
+void Port::changed( void )
+{
+    bool pulse = powered() && high_voltage() && selected();
+
+    clock_read = false;
+
+    if ( pulse && ! pulsing )
+    {
+        pulse_begin();
+    }
+    else if ( ! pulse && pulsing )
+    {
+        pulse_end();
+    }
+}
+
+uint8_t emulator_data_bus( void )
+{
+    clock_read = false;
+
+    if ( powered() && ! high_voltage() && selected() )
+    {
+        return fuses[address()];
+    }
+
+    return 0xFF;                    // Floating outputs
+}
+
+//
+// Serial port
+//
+
+// An Arduino resets when the port is opened. Bytes received while in the
+// bootloader are lost
+//
+static void reset( void )
+{
+    // Firmware state that is not set up again by setup() and loop()
+    extern bool framed, reply_open;
+    extern unsigned long cooling_time;
+    char junk[256];
+
+    if ( verbose )
+    {
+        fprintf( stderr, "%s: Reset\n", myname );
+    }
+
+    usleep( boot_time * 1000 );
+    tcflush( master, TCOFLUSH );
+    while ( read( master, junk, sizeof( junk ) ) > 0 )
+        ;
+
+    tx_len = rx_len = 0;
+    tx_last = rx_last = 0;
+    framed = reply_open = false;
+    cooling_time = 0;
+
+    longjmp( reset_jmp, 1 );
+}
+
+static void serial_transmit( void )
+{
+    uint64_t now = now_ns();
+
+    while ( tx_len && tx[tx_head].due <= now )
+    {
+        unsigned len = 0;
+
+        // Everything that is due in one go
+        while ( len < tx_len && tx_head + len < UNTIMED_BUFFER && tx[tx_head + len].due <= now )
+        {
+            ++len;
+        }
+
+        uint8_t buf[UNTIMED_BUFFER];
+
+        for ( unsigned i = 0; i < len; ++i )
+        {
+            buf[i] = tx[tx_head + i].data;
+        }
+
+        // With nobody listening, output is lost
+        if ( ! hung_up && -1 == write( master, buf, len ) && EAGAIN == errno )
+        {
+            return;
+        }
+
+        tx_head = ( tx_head + len ) % UNTIMED_BUFFER;
+        tx_len -= len;
+    }
+}
+
+// Moves input from the pty to the receive buffer, each byte arriving one byte
+// time after the previous one. There is no overrun: when the buffer is full, the
+// host just has to wait
+//
+static void serial_receive( void )
+{
+    uint8_t buf[SERIAL_BUFFER];
+    ssize_t n;
+
+    if ( rx_len == SERIAL_BUFFER )
+    {
+        return;
+    }
+
+    n = read( master, buf, SERIAL_BUFFER - rx_len );
+
+    if ( -1 == n && EIO == errno )
+    {
+        // No slave open
+        hung_up = true;
+        return;
+    }
+
+    if ( hung_up )
+    {
+        hung_up = false;
+
+        if ( reset_on_open )
+        {
+            reset();
+        }
+    }
+
+    for ( ssize_t i = 0; i < n; ++i )
+    {
+        unsigned tail = ( rx_head + rx_len++ ) % SERIAL_BUFFER;
+
+        rx_last = ( rx_last > now_ns() ? rx_last : now_ns() ) + byte_time;
+        rx[tail].data = buf[i];
+        rx[tail].due = rx_last;
+    }
+}
+
+static void serial_poll( void )
+{
+    clock_read = false;
+    serial_receive();
+    serial_transmit();
+}
+
+// Received bytes that have already arrived
+//
+static unsigned serial_arrived( void )
+{
+    uint64_t now = now_ns();
+    unsigned n = 0;
+
+    while ( n < rx_len && rx[( rx_head + n ) % SERIAL_BUFFER].due <= now )
+    {
+        ++n;
+    }
+
+    return n;
+}
+
+void HardwareSerial::begin( unsigned long baud )
+{
+    clock_read = false;
+    byte_time = timed ? BITS_PER_BYTE * 1000000000ULL / baud : 0;
+
+    if ( verbose )
+    {
+        fprintf( stderr, "%s: Serial at %lu baud\n", myname, baud );
+    }
+}
+
+int HardwareSerial::available( void )
+{
+    unsigned n;
+
+    serial_poll();
+
+    if ( 0 == ( n = serial_arrived() ) && 0 == rx_len && 0 == tx_len )
+    {
+        // Idle, wait a bit for the host instead of spinning
+        struct pollfd pfd = { master, POLLIN, 0 };
+
+        if ( hung_up || 1 != poll( &pfd, 1, 1 ) || ( pfd.revents & POLLHUP ) )
+        {
+            usleep( 1000 );
+        }
+        serial_poll();
+        n = serial_arrived();
+    }
+
+    return n;
+}
+
+int HardwareSerial::peek( void )
+{
+    return available() ? rx[rx_head].data : -1;
+}
+
+int HardwareSerial::read( void )
+{
+    int c = peek();
+
+    if ( -1 != c )
+    {
+        rx_head = ( rx_head + 1 ) % SERIAL_BUFFER;
+        --rx_len;
+    }
+
+    return c;
+}
+
+int HardwareSerial::availableForWrite( void )
+{
+    serial_poll();
+
+    return ( timed ? SERIAL_BUFFER - 1 : UNTIMED_BUFFER ) - tx_len;
+}
+
+void HardwareSerial::flush( void )
+{
+    while ( tx_len )
+    {
+        serial_poll();
+        if ( tx_len )
+        {
+            sleep_until( tx[tx_head].due );
+        }
+    }
+}
+
+size_t HardwareSerial::write( uint8_t c )
+{
+    unsigned capacity = timed ? SERIAL_BUFFER - 1 : UNTIMED_BUFFER;
+
+    serial_poll();
+
+    while ( tx_len == capacity )
+    {
+        if ( timed )
+        {
+            sleep_until( tx[tx_head].due );
+        }
+        serial_poll();
+    }
+
+    tx_last = ( tx_last > now_ns() ? tx_last : now_ns() ) + byte_time;
+    tx[( tx_head + tx_len ) % UNTIMED_BUFFER].data = c;
+    tx[( tx_head + tx_len ) % UNTIMED_BUFFER].due = tx_last;
+    ++tx_len;
+
+    return 1;
+}
+
+size_t HardwareSerial::write( const char *s )
+{
+    size_t n = 0;
+
+    while ( *s )
+    {
+        n += write( (uint8_t) *s++ );
+    }
+
+    return n;
+}
+
+size_t HardwareSerial::print( unsigned long n, int base )
+{
+    char buf[8 * sizeof( long ) + 1], *p = &buf[sizeof( buf ) - 1];
+
+    *p = '\0';
+    do
+    {
+        *--p = "0123456789ABCDEF"[n % base];
+        n /= base;
+    } while ( n );
+
+    return write( p );
+}
+
+//
+// Time
+//
+
+void delay( unsigned long ms )
+{
+    uint64_t end = now_ns() + ms * 1000000ULL;
+
+    if ( ! timed )
+    {
+        serial_poll();
+        skipped += ms * 1000;
+        return;
+    }
+
+    // Keep the serial port going meanwhile, as the interrupts do
+    while ( now_ns() < end )
+    {
+        serial_poll();
+        sleep_until( end < now_ns() + 100000 ? end : now_ns() + 100000 );
+    }
+    serial_poll();
+}
+
+void delayMicroseconds( unsigned int us )
+{
+    clock_read = false;
+
+    if ( timed )
+    {
+        sleep_until( now_ns() + us * 1000ULL );
+    }
+    else
+    {
+        skipped += us;
+    }
+}
+
+// When not timed, a clock read right after another one with nothing in between
+// is a busy wait, so time is skipped ahead
+//
+static uint64_t clock_us( void )
+{
+    if ( ! timed && clock_read )
+    {
+        skipped += BUSY_WAIT_STEP;
+    }
+    clock_read = true;
+
+    return now_us();
+}
+
+unsigned long millis( void )
+{
+    return clock_us() / 1000;
+}
+
+unsigned long micros( void )
+{
+    return clock_us();
+}
+
+//
+// Emulator
+//
+
+static void finish( int sig )
+{
+    FILE *file;
+
+    fprintf( stderr, "%s: %lu pulses, %lu.%03lu s at 10V5. %lu duty cycle violations, %lu long pulses, %lu bad masks\n",
+                myname, (unsigned long) pulses, (unsigned long) ( pulse_time / 1000000 ), (unsigned long) ( pulse_time / 1000 % 1000 ),
+                (unsigned long) duty_violations, (unsigned long) long_pulses, (unsigned long) bad_masks );
+
+    if ( save_file )
+    {
+        if ( NULL == ( file = fopen( save_file, "wb" ) ) || 1 != fwrite( fuses, chip->size, 1, file ) )
+        {
+            fprintf( stderr, "%s: Error saving the PROM to %s: %s\n", myname, save_file, strerror( errno ) );
+        }
+        if ( file )
+        {
+            fclose( file );
+        }
+    }
+
+    _exit( sig == SIGTERM || sig == SIGINT ? EXIT_SUCCESS : EXIT_FAILURE );
+}
+
+static int usage( void )
+{
+    fprintf( stderr, "Usage: %s [-c CHIP] [-f FILE] [-o FILE] [-t] [-r MS | -R] [-m SEED] [-d ADDR:BIT]... [-v] LINK\n\n", myname );
+    fputs( "   LINK         Symbolic link to create to the pseudo-terminal, the DEVICE for prom.\n", stderr );
+    fputs( "   -c CHIP      Chip in the socket, 0 == 74s471 (256x8), 1 == 74s472 (512x8). Default is 1.\n", stderr );
+    fputs( "   -f FILE      Initial PROM contents. Default is blank.\n", stderr );
+    fputs( "   -o FILE      Save the PROM contents on exit.\n", stderr );
+    fputs( "   -t           Timing model: real pulse and cooling delays and serial speed.\n", stderr );
+    fputs( "                Default is as fast as possible.\n", stderr );
+    fputs( "   -r MS        Bootloader time after the reset on open. Default is 0.\n", stderr );
+    fputs( "   -R           Do not reset when the port is opened.\n", stderr );
+    fprintf( stderr, "   -m SEED      Marginal chip, bits need random pulses of %u to %u us.\n", MARGINAL_MIN, MARGINAL_MAX );
+    fprintf( stderr, "                Default is %u us for all of them.\n", BLOW_TIME );
+    fprintf( stderr, "   -d ADDR:BIT  Bit that never programs, hex address. Up to %u.\n", MAX_DEAD );
+    fputs( "   -v           Report resets and speed changes.\n\n", stderr );
+    fputs( "Stop with SIGINT or SIGTERM.\n", stderr );
+
+    return EXIT_FAILURE;
+}
+
+int main( int argc, char **argv )
+{
+    unsigned dead_address[MAX_DEAD], dead_bit[MAX_DEAD], dead = 0, seed = 0;
+    bool marginal = false;
+    const char *init_file = NULL, *link;
+    char name[64];
+    int opt, slave;
+    struct termios cfg;
+    FILE *file;
+
+    myname = basename( argv[0] );
+
+    while ( -1 != ( opt = getopt( argc, argv, "c:f:o:tr:Rm:d:v" ) ) )
+    {
+        switch ( opt )
+        {
+            case 'c':
+                if ( 1 != strlen( optarg ) || optarg[0] < '0' || optarg[0] >= '0' + NUM_CHIPS )
+                {
+                    fprintf( stderr, "%s: Invalid chip number: %s\n", myname, optarg );
+                    return usage();
+                }
+                chip = &chips[optarg[0] - '0'];
+                break;
+
+            case 'f':
+                init_file = optarg;
+                break;
+
+            case 'o':
+                save_file = optarg;
+                break;
+
+            case 't':
+                timed = true;
+                break;
+
+            case 'r':
+                boot_time = atoi( optarg );
+                break;
+
+            case 'R':
+                reset_on_open = false;
+                break;
+
+            case 'm':
+                marginal = true;
+                seed = atoi( optarg );
+                break;
+
+            case 'd':
+                if ( dead == MAX_DEAD || 2 != sscanf( optarg, "%x:%u", &dead_address[dead], &dead_bit[dead] )
+                        || dead_address[dead] >= MAX_SIZE || dead_bit[dead] > 7 )
+                {
+                    fprintf( stderr, "%s: Invalid dead bit: %s\n", myname, optarg );
+                    return usage();
+                }
+                ++dead;
+                break;
+
+            case 'v':
+                verbose = true;
+                break;
+
+            default:
+                return usage();
+        }
+    }
+
+    if ( optind != argc - 1 )
+    {
+        return usage();
+    }
+    link = argv[optind];
+
+    srand( seed );
+    for ( int a = 0; a < MAX_SIZE; ++a )
+    {
+        for ( int b = 0; b < 8; ++b )
+        {
+            blow_time[a][b] = marginal ? MARGINAL_MIN + rand() % ( MARGINAL_MAX - MARGINAL_MIN ) : BLOW_TIME;
+        }
+    }
+    for ( unsigned d = 0; d < dead; ++d )
+    {
+        blow_time[dead_address[d]][dead_bit[d]] = UINT32_MAX;
+    }
+
+    if ( init_file )
+    {
+        if ( NULL == ( file = fopen( init_file, "rb" ) ) )
+        {
+            fprintf( stderr, "%s: Can't open %s: %s\n", myname, init_file, strerror( errno ) );
+            return EXIT_FAILURE;
+        }
+        if ( 0 == fread( fuses, 1, chip->size, file ) && ferror( file ) )
+        {
+            fprintf( stderr, "%s: Error reading %s\n", myname, init_file );
+            fclose( file );
+            return EXIT_FAILURE;
+        }
+        fclose( file );
+    }
+
+    if ( -1 == openpty( &master, &slave, name, NULL, NULL ) )
+    {
+        fprintf( stderr, "%s: Can't open a pseudo-terminal: %s\n", myname, strerror( errno ) );
+        return EXIT_FAILURE;
+    }
+
+    tcgetattr( slave, &cfg );
+    cfmakeraw( &cfg );
+    tcsetattr( slave, TCSANOW, &cfg );
+    fcntl( master, F_SETFL, O_NONBLOCK );
+
+    // Closed, so the opening of the port can be seen
+    close( slave );
+
+    unlink( link );
+    if ( -1 == symlink( name, link ) )
+    {
+        fprintf( stderr, "%s: Can't create %s: %s\n", myname, link, strerror( errno ) );
+        return EXIT_FAILURE;
+    }
+    fprintf( stderr, "%s: Emulating a %s on %s (%s)\n", myname, chip->name, link, name );
+
+    signal( SIGINT, finish );
+    signal( SIGTERM, finish );
+
+    clock_gettime( CLOCK_MONOTONIC, &start_time );
+
+    // A reset jumps back here
+    setjmp( reset_jmp );
+
+    setup();
+    for ( ;; )
+    {
+        loop();
+    }
+}
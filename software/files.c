@@ -28,6 +28,10 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "globals.h"
 #include "files.h"
@@ -44,6 +48,41 @@ void files_free_blocks( mem_block_t *blocks )
     }
 }
 
+// The parts of the blocks from 'from' and below 'to', in a new list
+//
+status_t files_clip_blocks( const mem_block_t *blocks, uint16_t from, uint16_t to, mem_block_t **clipped )
+{
+    mem_block_t **tail = clipped;
+
+    *clipped = NULL;
+
+    for ( const mem_block_t *b = blocks; NULL != b; b = b->next )
+    {
+        uint16_t start = ( b->start > from ) ? b->start : from;
+        uint16_t end = ( b->start + b->count < to ) ? b->start + b->count : to;
+
+        if ( start >= end )
+        {
+            continue;
+        }
+
+        if ( NULL == ( *tail = malloc( sizeof( mem_block_t ) ) ) )
+        {
+            perror( "Can't alloc memory for new block" );
+            files_free_blocks( *clipped );
+            *clipped = NULL;
+            return FAILURE;
+        }
+
+        ( *tail )->start = start;
+        ( *tail )->count = end - start;
+        ( *tail )->next = NULL;
+        tail = &( *tail )->next;
+    }
+
+    return SUCCESS;
+}
+
 status_t files_cleanup( FILE *file, mem_block_t *blocks, status_t status )
 {
     files_free_blocks( blocks );
@@ -55,3 +94,357 @@ status_t files_cleanup( FILE *file, mem_block_t *blocks, status_t status )
 
     return status;
 }
+
+status_t files_open( writer_t *writer, char *filename, uint64_t base_addr )
+{
+    memset( writer, 0, sizeof( writer_t ) );
+
+    if ( NULL == ( writer->file = fopen( filename, "wb" ) ) )
+    {
+        fprintf( stderr, "Error %d opening file '%s': %s\n", errno, filename, strerror( errno ) );
+        return FAILURE;
+    }
+
+    writer->filename = filename;
+    writer->address = base_addr;
+
+    return SUCCESS;
+}
+
+status_t files_write( writer_t *writer, const void *data, size_t len )
+{
+    if ( fwrite( data, 1, len, writer->file ) != len )
+    {
+        fprintf( stderr, "Error writing to file '%s'\n", writer->filename );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Closes the file, and removes it if it could not be written completely
+//
+status_t files_close( writer_t *writer, status_t status )
+{
+    if ( EOF == fclose( writer->file ) )
+    {
+        fprintf( stderr, "Error %d closing file '%s': %s\n", errno, writer->filename, strerror( errno ) );
+        status = FAILURE;
+    }
+
+    if ( FAILURE == status )
+    {
+        unlink( writer->filename );
+    }
+
+    return status;
+}
+
+// Makes sure that 'path' is a directory of the user that nobody else can get into,
+// creating it if 'create'. If it does not exist and is not created, fails quietly
+//
+status_t files_private_dir( const char *path, bool create )
+{
+    struct stat st;
+
+    if ( create && -1 == mkdir( path, 0700 ) && errno != EEXIST )
+    {
+        fprintf( stderr, "Error %d creating directory '%s': %s\n", errno, path, strerror( errno ) );
+        return FAILURE;
+    }
+
+    if ( -1 == lstat( path, &st ) )
+    {
+        if ( create || errno != ENOENT )
+        {
+            fprintf( stderr, "Error %d checking directory '%s': %s\n", errno, path, strerror( errno ) );
+        }
+        return FAILURE;
+    }
+
+    if ( ! S_ISDIR( st.st_mode ) || st.st_uid != geteuid() || ( st.st_mode & 077 ) )
+    {
+        fprintf( stderr, "Error: '%s' is not a directory that only the user can access\n", path );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Reads a whole file into a new buffer, with a '\0' after it. The caller frees it
+//
+status_t files_slurp( char *filename, char **contents, size_t *len )
+{
+    FILE *file;
+    long size;
+
+    if ( NULL == ( file = fopen( filename, "rb" ) ) )
+    {
+        fprintf( stderr, "Error %d opening file '%s': %s\n", errno, filename, strerror( errno ) );
+        return FAILURE;
+    }
+
+    if ( fseek( file, 0L, SEEK_END ) || ( size = ftell( file ) ) < 0 )
+    {
+        perror( "Can't determine file size" );
+        return files_cleanup( file, NULL, FAILURE );
+    }
+    rewind( file );
+
+    if ( NULL == ( *contents = malloc( size + 1 ) ) )
+    {
+        perror( "Can't alloc memory for the file contents" );
+        return files_cleanup( file, NULL, FAILURE );
+    }
+
+    if ( fread( *contents, 1, size, file ) != (size_t) size )
+    {
+        fprintf( stderr, "Error reading from file '%s'\n", filename );
+        free( *contents );
+        return files_cleanup( file, NULL, FAILURE );
+    }
+
+    ( *contents )[size] = '\0';
+    *len = size;
+
+    fclose( file );
+
+    return SUCCESS;
+}
+
+// Calls 'fn' for each line of a text file with records, one per line, skipping empty
+// ones. Stops at the end of the contents or when 'fn' fails or sets 'last'
+//
+status_t files_records( const char *contents, record_fn_t fn, void *arg, bool *last )
+{
+    unsigned line = 1;
+
+    *last = false;
+
+    while ( ! *last )
+    {
+        switch ( *contents )
+        {
+            case '\0':
+                return SUCCESS;
+
+            case '\n':
+                ++line;
+                // FALLTHROUGH
+
+            case '\r':
+                ++contents;
+                break;
+
+            default:
+                if ( NULL == ( contents = fn( contents, line, arg, last ) ) )
+                {
+                    return FAILURE;
+                }
+        }
+    }
+
+    return SUCCESS;
+}
+
+static status_t reserve( image_block_t *b, uint32_t count )
+{
+    uint32_t size = b->size ? b->size : 256;
+    uint8_t *data;
+
+    if ( count <= b->size )
+    {
+        return SUCCESS;
+    }
+
+    while ( size < count )
+    {
+        size *= 2;
+    }
+
+    if ( NULL == ( data = realloc( b->data, size ) ) )
+    {
+        perror( "Can't alloc memory for the file data" );
+        return FAILURE;
+    }
+
+    b->data = data;
+    b->size = size;
+
+    return SUCCESS;
+}
+
+// Joins the block with the next one if they touch
+//
+static status_t merge_next( image_t *image, image_block_t *b )
+{
+    image_block_t *next = b->next;
+
+    if ( NULL == next || b->start + b->count != next->start )
+    {
+        return SUCCESS;
+    }
+
+    if ( FAILURE == reserve( b, b->count + next->count ) )
+    {
+        return FAILURE;
+    }
+
+    memcpy( &b->data[b->count], next->data, next->count );
+    b->count += next->count;
+    b->next = next->next;
+
+    if ( image->last == next )
+    {
+        image->last = b;
+    }
+
+    free( next->data );
+    free( next );
+
+    return SUCCESS;
+}
+
+// Adds data at 'address', which must not have any yet. Files are usually in address
+// order, so the fast path is appending to the block of the last data
+//
+status_t files_image_add( image_t *image, uint32_t address, const uint8_t *data, size_t len )
+{
+    image_block_t *prev = NULL, *b = image->last;
+    uint64_t end = (uint64_t) address + len;
+
+    if ( 0 == len )
+    {
+        return SUCCESS;
+    }
+
+    if ( end > UINT32_MAX )
+    {
+        fprintf( stderr, "Data beyond the 32-bit address space at 0x%X\n", address );
+        return FAILURE;
+    }
+
+    if ( NULL == b || b->start + b->count != address )
+    {
+        // First block that ends at or after 'address'
+        for ( b = image->blocks; NULL != b && b->start + b->count < address; b = b->next )
+        {
+            prev = b;
+        }
+
+        if ( NULL != b && b->start + b->count != address )
+        {
+            if ( b->start < end )
+            {
+                fprintf( stderr, "Data at 0x%X overlaps with previous data\n", address > b->start ? address : b->start );
+                return FAILURE;
+            }
+
+            // A new block between 'prev' and 'b'
+            b = NULL;
+        }
+
+        if ( NULL == b )
+        {
+            if ( NULL == ( b = calloc( 1, sizeof( image_block_t ) ) ) )
+            {
+                perror( "Can't alloc memory for new file block" );
+                return FAILURE;
+            }
+
+            b->start = address;
+            b->next = prev ? prev->next : image->blocks;
+
+            if ( prev )
+            {
+                prev->next = b;
+            }
+            else
+            {
+                image->blocks = b;
+            }
+        }
+    }
+
+    if ( NULL != b->next && b->next->start < end )
+    {
+        fprintf( stderr, "Data at 0x%X overlaps with previous data\n", b->next->start );
+        return FAILURE;
+    }
+
+    if ( FAILURE == reserve( b, b->count + len ) )
+    {
+        return FAILURE;
+    }
+
+    memcpy( &b->data[b->count], data, len );
+    b->count += len;
+    image->last = b;
+
+    return merge_next( image, b );
+}
+
+// Copies the data from 'base' to 'base' + 'buffer_size' to the buffer and makes a list
+// of its blocks, with addresses relative to 'base'. The rest of the data is for other chips
+//
+status_t files_image_extract( const image_t *image, char *filename, uint32_t base, uint8_t *buffer, size_t buffer_size, mem_block_t **blocks )
+{
+    mem_block_t **tail = blocks;
+    uint64_t limit = (uint64_t) base + buffer_size;
+
+    *blocks = NULL;
+
+    for ( const image_block_t *b = image->blocks; NULL != b; b = b->next )
+    {
+        if ( b->start + (uint64_t) b->count <= base || b->start >= limit )
+        {
+            continue;
+        }
+
+        if ( b->start < base || b->start + (uint64_t) b->count > limit )
+        {
+            fprintf( stderr, "Data from 0x%X to 0x%X in file '%s' does not fit in a chip image at 0x%X\n",
+                        b->start, b->start + b->count - 1, filename, base );
+            files_free_blocks( *blocks );
+            *blocks = NULL;
+            return FAILURE;
+        }
+
+        if ( NULL == ( *tail = malloc( sizeof( mem_block_t ) ) ) )
+        {
+            perror( "Can't alloc memory for new block" );
+            files_free_blocks( *blocks );
+            *blocks = NULL;
+            return FAILURE;
+        }
+
+        memcpy( &buffer[b->start - base], b->data, b->count );
+        ( *tail )->start = b->start - base;
+        ( *tail )->count = b->count;
+        ( *tail )->next = NULL;
+        tail = &( *tail )->next;
+    }
+
+    if ( NULL == *blocks )
+    {
+        fprintf( stderr, "No data at 0x%X in file '%s'\n", base, filename );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+void files_image_free( image_t *image )
+{
+    image_block_t *b = image->blocks;
+
+    while ( NULL != b )
+    {
+        image->blocks = b->next;
+        free( b->data );
+        free( b );
+        b = image->blocks;
+    }
+
+    image->last = NULL;
+}
@@ -42,19 +42,67 @@ typedef struct mem_block_s {
     struct mem_block_s *next;
 } mem_block_t;
 
-typedef status_t (*write_fn_t)( char *filename, const uint8_t *buffer, size_t buffer_size, uint64_t base_addr );
-typedef status_t (*read_fn_t)( char *filename, const uint8_t *buffer, size_t buffer_size, mem_block_t **blocks );
+// The data of a whole file, at 32-bit addresses, so it can have the images of several
+// chips. Blocks are sorted and never overlap or touch each other
+typedef struct image_block_s {
+    uint32_t start;
+    uint32_t count;
+    uint32_t size;                      // Allocated for 'data'
+    uint8_t *data;
+    struct image_block_s *next;
+} image_block_t;
 
-typedef enum { BIN = 0, IHEX = 1 } format_t;
+typedef struct {
+    image_block_t *blocks;
+    image_block_t *last;                // The one data was last added to
+} image_t;
+
+#define WRITER_LINE_SIZE    32      // Largest output record of all formats, in bytes
+
+// A file being written as the data arrives, in order and in chunks of any size
+typedef struct {
+    FILE *file;
+    char *filename;
+    uint64_t address;                   // Of the first pending byte
+    uint8_t pending[WRITER_LINE_SIZE];  // Data of an unfinished record
+    size_t len;
+    size_t records;                     // Data records written
+} writer_t;
+
+// Readers get the whole file contents, followed by a '\0'
+typedef bool (*detect_fn_t)( const char *contents, size_t len );
+typedef status_t (*parse_fn_t)( const char *contents, size_t len, image_t *image );
+typedef status_t (*put_fn_t)( writer_t *writer, const uint8_t *data, size_t len );
+typedef status_t (*close_fn_t)( writer_t *writer, status_t status );
+
+// Parses the text record at 's', on file line 'line'. Returns where it ends, or NULL on
+// errors. Sets 'last' if no more records are expected
+typedef const char *(*record_fn_t)( const char *s, unsigned line, void *arg, bool *last );
+
+typedef enum { BIN = 0, IHEX, SREC, HEX } format_t;
 
 typedef struct {
     const char *format_string;
     format_t format;
-    read_fn_t read_fn;
-    write_fn_t write_fn;
+    bool addressed;                     // Has addresses, so a file can hold several chip images
+    detect_fn_t detect_fn;              // True if the contents look like this format
+    parse_fn_t parse_fn;
+    put_fn_t put_fn;
+    close_fn_t close_fn;
 } format_st_t;
 
 void files_free_blocks( mem_block_t *blocks );
+status_t files_clip_blocks( const mem_block_t *blocks, uint16_t from, uint16_t to, mem_block_t **clipped );
 status_t files_cleanup( FILE *file, mem_block_t *blocks, status_t status );
+status_t files_open( writer_t *writer, char *filename, uint64_t base_addr );
+status_t files_write( writer_t *writer, const void *data, size_t len );
+status_t files_close( writer_t *writer, status_t status );
+
+status_t files_private_dir( const char *path, bool create );
+status_t files_slurp( char *filename, char **contents, size_t *len );
+status_t files_records( const char *contents, record_fn_t fn, void *arg, bool *last );
+status_t files_image_add( image_t *image, uint32_t address, const uint8_t *data, size_t len );
+status_t files_image_extract( const image_t *image, char *filename, uint32_t base, uint8_t *buffer, size_t buffer_size, mem_block_t **blocks );
+void files_image_free( image_t *image );
 
 #endif /* FILES_H */
\ No newline at end of file
@@ -0,0 +1,138 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * File format registry
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "globals.h"
+#include "files.h"
+#include "formats.h"
+#include "binfile.h"
+#include "ihex.h"
+#include "srec.h"
+#include "rawhex.h"
+
+// In detection order. Anything is a binary file, so it goes last
+static const format_st_t formats[] = {
+    { "ihex", IHEX, true,  ihex_detect,   ihex_parse,   ihex_put,   ihex_close   },
+    { "srec", SREC, true,  srec_detect,   srec_parse,   srec_put,   srec_close   },
+    { "hex",  HEX,  false, rawhex_detect, rawhex_parse, rawhex_put, rawhex_close },
+    { "bin",  BIN,  false, bin_detect,    bin_parse,    bin_put,    bin_close    },
+    { NULL }
+};
+
+const format_st_t *formats_find( const char *name )
+{
+    for ( const format_st_t *f = formats; NULL != f->format_string; ++f )
+    {
+        if ( ! strcmp( f->format_string, name ) )
+        {
+            return f;
+        }
+    }
+
+    return NULL;
+}
+
+// For output files without a format
+//
+const format_st_t *formats_default( void )
+{
+    return formats_find( "bin" );
+}
+
+// Parses a whole file in one go. If '*format' is NULL, it is detected from the contents
+// and returned there
+//
+status_t formats_load( char *filename, const format_st_t **format, image_t *image )
+{
+    status_t status;
+    char *contents;
+    size_t len;
+
+    if ( FAILURE == files_slurp( filename, &contents, &len ) )
+    {
+        return FAILURE;
+    }
+
+    for ( const format_st_t *f = formats; NULL == *format; ++f )
+    {
+        if ( f->detect_fn( contents, len ) )
+        {
+            *format = f;
+        }
+    }
+
+    if ( FAILURE == ( status = ( *format )->parse_fn( contents, len, image ) ) )
+    {
+        files_image_free( image );
+    }
+
+    free( contents );
+
+    return status;
+}
+
+// Gets the chip image at 'base' of a loaded file into the buffer, with a sorted list
+// of its blocks
+//
+status_t formats_extract( const image_t *image, char *filename, const format_st_t *format, uint32_t base,
+                          uint8_t *buffer, size_t buffer_size, mem_block_t **blocks )
+{
+    if ( base && ! format->addressed )
+    {
+        fprintf( stderr, "Error: '%s' is a %s file, without addresses for '-base'.\n", filename, format->format_string );
+        return FAILURE;
+    }
+
+    return files_image_extract( image, filename, base, buffer, buffer_size, blocks );
+}
+
+// Same, loading the file
+//
+
+status_t formats_read( char *filename, const format_st_t *format, uint32_t base,
+                       uint8_t *buffer, size_t buffer_size, mem_block_t **blocks )
+{
+    image_t image = { 0 };
+    status_t status;
+
+    if ( FAILURE == formats_load( filename, &format, &image ) )
+    {
+        return FAILURE;
+    }
+
+    status = formats_extract( &image, filename, format, base, buffer, buffer_size, blocks );
+
+    files_image_free( &image );
+
+    return status;
+}
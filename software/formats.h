@@ -0,0 +1,48 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * File format registry
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef FORMATS_H
+#define FORMATS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "globals.h"
+#include "files.h"
+
+#define FORMAT_NAMES    "{bin,ihex,srec,hex}"
+
+const format_st_t *formats_find( const char *name );
+const format_st_t *formats_default( void );
+status_t formats_load( char *filename, const format_st_t **format, image_t *image );
+status_t formats_extract( const image_t *image, char *filename, const format_st_t *format, uint32_t base,
+                          uint8_t *buffer, size_t buffer_size, mem_block_t **blocks );
+status_t formats_read( char *filename, const format_st_t *format, uint32_t base,
+                       uint8_t *buffer, size_t buffer_size, mem_block_t **blocks );
+
+#endif /* FORMATS_H */
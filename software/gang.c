@@ -0,0 +1,235 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Gang programming, several programmers at once
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "globals.h"
+#include "gang.h"
+
+#define LINE_SIZE   256
+
+typedef struct {
+    char *device;
+    pid_t pid;
+    int fd;                     // Read end of its output, -1 when closed
+    char line[LINE_SIZE];       // Output not ending in a newline yet
+    size_t len;
+    status_t status;
+} member_t;
+
+// Splits a comma separated list of devices in place. Returns the number of them,
+// or -1 if more than 'max'
+//
+int gang_split( char *devices, char **device, int max )
+{
+    int count = 0;
+    char *next;
+
+    for ( next = strtok( devices, "," ); NULL != next; next = strtok( NULL, "," ) )
+    {
+        if ( count == max )
+        {
+            return -1;
+        }
+        device[count++] = next;
+    }
+
+    return count;
+}
+
+static void flush_line( member_t *m )
+{
+    fprintf( stderr, "%s: %.*s\n", m->device, (int) m->len, m->line );
+    m->len = 0;
+}
+
+// Prefixes every line of output of the member with its device name
+//
+static void relay( member_t *m )
+{
+    char buffer[LINE_SIZE];
+    ssize_t got, i;
+
+    got = read( m->fd, buffer, sizeof( buffer ) );
+
+    if ( got < 0 && errno == EINTR )
+    {
+        return;
+    }
+
+    if ( got <= 0 )
+    {
+        if ( m->len )
+        {
+            flush_line( m );
+        }
+        close( m->fd );
+        m->fd = -1;
+        return;
+    }
+
+    for ( i = 0; i < got; ++i )
+    {
+        if ( buffer[i] == '\n' )
+        {
+            flush_line( m );
+            continue;
+        }
+
+        m->line[m->len++] = buffer[i];
+
+        if ( m->len == sizeof( m->line ) )
+        {
+            flush_line( m );
+        }
+    }
+}
+
+// Each programmer gets its own process: its own connection and protocol state, and
+// the input data, already loaded, shared with the parent. Their output is shown
+// line by line, prefixed by the device name, and a summary at the end.
+//
+status_t gang_run( char **device, int count, gang_fn_t session, const void *arg )
+{
+    member_t members[MAX_GANG];
+    struct pollfd fds[MAX_GANG];
+    int i, open_fds = 0, failed = 0;
+    int pipe_fd[2];
+    int wstatus;
+
+    fflush( NULL );             // Or the children would repeat what is buffered
+
+    for ( i = 0; i < count; ++i )
+    {
+        members[i].device = device[i];
+        members[i].len = 0;
+        members[i].fd = -1;
+        members[i].pid = -1;
+        members[i].status = FAILURE;
+
+        if ( -1 == pipe( pipe_fd ) )
+        {
+            fprintf( stderr, "Error %d creating pipe for %s: %s\n", errno, device[i], strerror( errno ) );
+            continue;
+        }
+
+        members[i].pid = fork();
+
+        if ( members[i].pid == -1 )
+        {
+            fprintf( stderr, "Error %d starting session for %s: %s\n", errno, device[i], strerror( errno ) );
+            close( pipe_fd[0] );
+            close( pipe_fd[1] );
+            continue;
+        }
+
+        if ( members[i].pid == 0 )
+        {
+            close( pipe_fd[0] );
+            dup2( pipe_fd[1], STDOUT_FILENO );
+            dup2( pipe_fd[1], STDERR_FILENO );
+            close( pipe_fd[1] );
+            // Output already goes line by line to the parent
+            setvbuf( stdout, NULL, _IOLBF, 0 );
+
+            exit( SUCCESS == session( device[i], arg ) ? EXIT_SUCCESS : EXIT_FAILURE );
+        }
+
+        close( pipe_fd[1] );
+        members[i].fd = pipe_fd[0];
+        ++open_fds;
+    }
+
+    while ( open_fds )
+    {
+        for ( i = 0; i < count; ++i )
+        {
+            fds[i].fd = members[i].fd;      // Negative ones are ignored
+            fds[i].events = POLLIN;
+        }
+
+        if ( -1 == poll( fds, count, -1 ) )
+        {
+            if ( errno == EINTR )
+            {
+                continue;
+            }
+            perror( "Error waiting for the programmers" );
+            break;
+        }
+
+        for ( i = 0; i < count; ++i )
+        {
+            if ( members[i].fd != -1 && fds[i].revents )
+            {
+                relay( &members[i] );
+                open_fds -= ( members[i].fd == -1 );
+            }
+        }
+    }
+
+    for ( i = 0; i < count; ++i )
+    {
+        if ( members[i].fd != -1 )
+        {
+            close( members[i].fd );
+        }
+
+        if ( members[i].pid > 0
+            && members[i].pid == waitpid( members[i].pid, &wstatus, 0 )
+            && WIFEXITED( wstatus ) && WEXITSTATUS( wstatus ) == EXIT_SUCCESS )
+        {
+            members[i].status = SUCCESS;
+        }
+    }
+
+    fputs( "\nSummary:\n", stderr );
+
+    for ( i = 0; i < count; ++i )
+    {
+        fprintf( stderr, "   %s: %s\n", members[i].device, members[i].status == SUCCESS ? "PASS" : "FAIL" );
+        failed += ( members[i].status != SUCCESS );
+    }
+
+    if ( failed )
+    {
+        fprintf( stderr, "%d of %d programmers failed.\n", failed, count );
+        return FAILURE;
+    }
+
+    fprintf( stderr, "All %d programmers succeeded.\n", count );
+
+    return SUCCESS;
+}
@@ -27,7 +27,9 @@
 #ifndef GLOBALS_H
 #define GLOBALS_H
 
-#define MAX_CHIP    1
+#include "chips.h"
+
+#define MAX_CHIP    ( NUM_CHIPS - 1 )
 
 typedef enum {
     SUCCESS = 0,
@@ -31,48 +31,79 @@
 #include <string.h>
 #include <ctype.h>
 
-#define COLUMNS 16
+#include "hexdump.h"
+
+#define COLUMNS HEXDUMP_COLUMNS
 #define HALF_COLUMNS ( COLUMNS / 2 )
 
-void hexdump( uint8_t* data, size_t size, uint16_t base_addr )
+void hexdump_begin( hexdump_t *dump, uint16_t base_addr )
+{
+    dump->address = base_addr;
+    dump->count = 0;
+}
+
+// Prints each byte as it comes, the end of the line once it is complete
+//
+void hexdump_put( hexdump_t *dump, const uint8_t *data, size_t size )
 {
-	static char ascii[COLUMNS + 1];
-	
-	for ( size_t i = 0; i < size+1; ++i )
+    for ( size_t i = 0; i < size; ++i, ++dump->count )
     {
-        if ( ! ( i % COLUMNS ) )
+        size_t column = dump->count % COLUMNS;
+
+        if ( ! column )
         {
-            printf( "%03X  ", base_addr + (uint16_t) i );
-            memset( ascii, 0, sizeof( ascii) );
+            printf( "%03X  ", dump->address + (uint16_t) dump->count );
+            memset( dump->ascii, 0, sizeof( dump->ascii ) );
         }
-        else if ( ! ( i % HALF_COLUMNS ) )
+        else if ( ! ( column % HALF_COLUMNS ) )
         {
             fputs( " ", stdout );
         }
 
-        if ( i == size )
+        printf( "%02x ", data[i] );
+
+        dump->ascii[column] = isprint( data[i] ) ? data[i] : '.';
+
+        if ( column == COLUMNS - 1 )
         {
-            break;
+            printf( " |%-16s|\n", dump->ascii );
         }
+    }
+}
 
-		printf( "%02x ", ((uint8_t *)data)[i] );
+// Pads the last line, if incomplete, and shows the end address if not
+//
+void hexdump_end( hexdump_t *dump )
+{
+    size_t column = dump->count % COLUMNS;
 
-		ascii[i % COLUMNS] = isprint( ((uint8_t *)data)[i] ) ? ((uint8_t *)data)[i] : '.';
+    if ( ! column )
+    {
+        printf( "%03X  ", dump->address + (uint16_t) dump->count );
+        return;
+    }
 
-		if ( (i+1) % COLUMNS == 0 || i+1 == size )
-        {
-            size_t j;
-			for ( j = (i+1) % COLUMNS; j && j < COLUMNS; ++j )
-            {
-				fputs( "   ", stdout );
-			}
-            if ( j && (i+1) % COLUMNS <= HALF_COLUMNS )
-            {
-				fputs( " ", stdout );
-		    }
-		    printf( " |%-16s|\n", ascii);
-		}
-	}
+    for ( size_t j = column; j < COLUMNS; ++j )
+    {
+        fputs( "   ", stdout );
+    }
+    if ( column <= HALF_COLUMNS )
+    {
+        fputs( " ", stdout );
+    }
+    printf( " |%-16s|\n", dump->ascii );
+
+    if ( ! ( column % HALF_COLUMNS ) )
+    {
+        fputs( " ", stdout );
+    }
+}
+
+void hexdump( const uint8_t *data, size_t size, uint16_t base_addr )
+{
+    hexdump_t dump;
 
-    return;
-}
\ No newline at end of file
+    hexdump_begin( &dump, base_addr );
+    hexdump_put( &dump, data, size );
+    hexdump_end( &dump );
+}
@@ -32,6 +32,18 @@
 #include <stdint.h>
 #include <stddef.h>
 
-void  hexdump( uint8_t* data, size_t size, uint16_t base_addr );
+#define HEXDUMP_COLUMNS 16
+
+// A dump printed as the data arrives
+typedef struct {
+    uint16_t address;                   // Of the first byte
+    size_t count;                       // Bytes dumped so far
+    char ascii[HEXDUMP_COLUMNS + 1];    // Of the current line
+} hexdump_t;
+
+void hexdump_begin( hexdump_t *dump, uint16_t base_addr );
+void hexdump_put( hexdump_t *dump, const uint8_t *data, size_t size );
+void hexdump_end( hexdump_t *dump );
+void hexdump( const uint8_t *data, size_t size, uint16_t base_addr );
 
 #endif
\ No newline at end of file
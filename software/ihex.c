@@ -30,312 +30,229 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include <ctype.h>
+#include <stdbool.h>
 #include <errno.h>
 
 #include "globals.h"
 #include "files.h"
-#include "scan.h"
+#include "ihex.h"
+#include "hex.h"
 
-#define LINE_BUF_LEN 1024
 #define INTEL_WRITE_BYTES_PER_LINE 32
+#define MAX_RECORD      ( 5 + 255 )     // Length, address, type, data and checksum
 
-typedef struct {
-    char start_char;
-    uint8_t *buffer;
-    size_t buffer_size;
-    int32_t current_addr;
-    uint16_t lines;
-    uint16_t checksum;
-    char *line_buffer;
-    int line_index;
-    mem_block_t *blocks;
-    bool complete;
-} hexfile_t;
-
-enum uint_len_t { UINT8 = 2, UINT16 = 4 };
-
-static uint8_t hexvalue( char digit )
-{
-    uint8_t value;
-
-    char c = toupper( digit );
+enum record_type_t { DATA = 0, END_OF_FILE, EXT_SEGMENT, START_SEGMENT, EXT_LINEAR, START_LINEAR };
 
-    if ( isdigit( c ))
-    {
-        value = digit - '0';
-    }
-    else
-    {
-        value = digit - 'A' + 10;
-    }
-
-    return value;
-}
-
-static int get_hexnum( int len, const char *s )
+static bool is_eol( char c )
 {
-    static const int base16[] = { 12, 8, 4, 0 };
+    return c == '\r' || c == '\n' || c == '\0';
+}
 
-    int result = 0;
+typedef struct {
+    image_t *image;
+    uint32_t base;                      // From the last extended address record
+} parser_t;
 
-    if ( strlen( s ) < len )
-    {   
-        return -1;
-    }
+// Parses a record at 's' and adds its data to the image. Returns where it ends
+//
+static const char *parse_record( const char *s, unsigned line, void *arg, bool *last )
+{
+    parser_t *parser = arg;
+    uint8_t record[MAX_RECORD];
+    uint8_t checksum = 0;
+    size_t total, done;
+    uint16_t offset;
 
-    for ( int pos = 0; pos < len; ++pos )
+    if ( ':' != *s++ )
     {
-        int val;
-        char c = s[pos];
-
-        if ( !isxdigit( c ) )
-        {
-            return -1;
-        }
-        result |= (hexvalue( c ) << base16[4 - len + pos] ) & ( 0xF << base16[4 - len + pos] );
+        fprintf( stderr, "Malformed hex file at line %u\n", line );
+        return NULL;
     }
 
-    return result;
-}
-
-static status_t get_byte( char *buffer, int *index, uint8_t *value )
-{    
-    if ( get_hexbyte( &buffer[*index], value ) )
+    if ( 1 != hex_decode( s, record, 1 ) )
     {
-        return FAILURE;
+        fprintf( stderr, "Invalid record length in hex file at line %u\n", line );
+        return NULL;
     }
 
-    *index += 2;
-
-    return SUCCESS;
-}
+    total = record[0] + 5;
 
-static status_t get_word( char *buffer, int *index, uint16_t *value )
-{
-    if ( get_hexword( &buffer[*index], value ) )
+    if ( total != ( done = hex_decode( s, record, total ) ) )
     {
-        return FAILURE;
+        fprintf( stderr, is_eol( s[done * 2] ) || is_eol( s[done * 2 + 1] ) ? "Malformed hex file: line %u is too short\n"
+                                                                            : "Malformed hex file: Invalid byte at line %u\n", line );
+        return NULL;
     }
+    s += total * 2;
 
-    *index += 4;
-
-    return SUCCESS;
-}
-
-static status_t ihex_read_record( hexfile_t *hex )
-{
-    status_t status = SUCCESS;
-    uint8_t line_bytes;
-    uint16_t load_address;
-    uint8_t record_type;
-    uint8_t nbytes;
-    uint16_t checksum;
-
-    ++hex->lines;
-    hex->line_index = 0;
-
-    if ( hex->start_char != hex->line_buffer[hex->line_index++] )
+    for ( size_t i = 0; i < total; ++i )
     {
-        fprintf( stderr, "Malformed hex file at line %d\n", hex->lines );
-        return FAILURE;
+        checksum += record[i];
     }
 
-    if ( FAILURE == get_byte( hex->line_buffer, &hex->line_index, &line_bytes ) )
+    if ( checksum )
     {
-        fprintf( stderr, "Invalid register length in hex file at line %d\n", hex->lines );
-        return FAILURE;
+        fprintf( stderr, "Malformed hex file: bad checksum at line %u\n", line );
+        return NULL;
     }
 
-    // line length should be:
-    //  1 for ':'
-    //  2 for byte count
-    //  4 for address
-    //  2 for record type ( 0 for PAP )
-    //  2 * byte count for data
-    //  2 for checksum ( 4 for PAP)
-    //  == 11 + ( 2 * byte count ) in any case
-    // 
-    if ( strlen( hex->line_buffer ) < 11 + 2 * line_bytes )
+    while ( *s == ' ' || *s == '\t' )
     {
-        fprintf( stderr, "Malformed hex file: line %d is too short\n", hex->lines );
-        return FAILURE;
+        ++s;
     }
 
-    if ( 0 == line_bytes )
+    if ( ! is_eol( *s ) )
     {
-        if ( ! strncmp( ":00000001FF", hex->line_buffer, 11 ) )
-        {
-            hex->complete = true;
-            return SUCCESS;
-        }
-        return FAILURE;
+        fprintf( stderr, "Malformed hex file: line %u is too long\n", line );
+        return NULL;
     }
 
-    if ( FAILURE == get_word( hex->line_buffer, &hex->line_index, &load_address ) || load_address >= hex->buffer_size )
-    {
-        fprintf( stderr, "Invalid load address in hex file at line %d\n", hex->lines );
-        return FAILURE;
-    }
+    offset = ( record[1] << 8 ) | record[2];
 
-    if ( FAILURE == get_byte( hex->line_buffer, &hex->line_index, &record_type ) || record_type != 0 )
+    switch ( record[3] )
     {
-        // Only data records are supported
-        fprintf( stderr, "Invalid or unsupported record type in hex file at line %d\n", hex->lines );
-        return FAILURE;
-    }
+        case DATA:
+            if ( FAILURE == files_image_add( parser->image, parser->base + offset, &record[4], record[0] ) )
+            {
+                fprintf( stderr, "Invalid data in hex file at line %u\n", line );
+                return NULL;
+            }
+            return s;
 
-    if ( load_address != hex->current_addr )
-    {
-        // New block
-        mem_block_t *newblock = malloc( sizeof( sizeof( mem_block_t ) ) );
+        case END_OF_FILE:
+            *last = true;
+            return s;
 
-        if ( NULL == newblock )
-        {
-            perror( "Can't alloc memory for new hex block\n" );
-            return FAILURE;
-        }
+        case EXT_SEGMENT:
+        case EXT_LINEAR:
+            if ( record[0] != 2 )
+            {
+                break;
+            }
+            parser->base = (uint32_t) ( ( record[4] << 8 ) | record[5] ) << ( record[3] == EXT_SEGMENT ? 4 : 16 );
+            return s;
 
-        newblock->start = load_address;
-        newblock->count = 0;
-        newblock->next = hex->blocks;
-        hex->blocks = newblock;
-        hex->current_addr = load_address;
+        case START_SEGMENT:
+        case START_LINEAR:
+            // Execution start address, meaningless here
+            return s;
     }
 
-    hex->checksum = line_bytes + ( ( load_address >> 8 ) & 0xFF ) + ( load_address & 0xFF );
+    fprintf( stderr, "Invalid or unsupported record type in hex file at line %u\n", line );
+    return NULL;
+}
+
+// Starts with a record mark and hex digits
+//
+bool ihex_detect( const char *contents, size_t len )
+{
+    while ( *contents == '\r' || *contents == '\n' )
+    {
+        ++contents;
+    }
 
-    for ( nbytes = 0; nbytes < line_bytes; ++nbytes )
+    if ( *contents++ != ':' )
     {
-        uint8_t byte;
+        return false;
+    }
 
-        if ( FAILURE == get_byte( hex->line_buffer, &hex->line_index, &byte ) )
+    for ( int i = 0; i < 10; ++i )
+    {
+        if ( ! hex_is_digit( contents[i] ) )
         {
-            fprintf( stderr, "Malformed hex file: Invalid byte at line %d\n", hex->lines );
-            return FAILURE;
+            return false;
         }
-        hex->buffer[hex->current_addr++] = byte;
-        hex->blocks->count++;
-        hex->checksum += byte;
-
     }
 
-    // Get checksum
-    status = get_byte( hex->line_buffer, &hex->line_index, (uint8_t *)&checksum );
+    return true;
+}
 
-    if ( FAILURE == status )
+// A single pass over the file contents. Extended segment and linear address records
+// place the data anywhere in the 32-bit address space
+//
+status_t ihex_parse( const char *contents, size_t len, image_t *image )
+{
+    parser_t parser = { image, 0 };
+    bool complete = false;
+
+    if ( FAILURE == files_records( contents, parse_record, &parser, &complete ) )
     {
-        fprintf( stderr, "Malformed hex file: can't get checksum at line %d\n", hex->lines );
         return FAILURE;
     }
 
-    if ( checksum != (uint8_t)(~hex->checksum + 1 ) )
+    if ( ! complete )
     {
-        fprintf( stderr, "Malformed hex file: bad checksum at line %d\n", hex->lines );
+        fputs( "Unexpected end of hex file\n", stderr );
         return FAILURE;
     }
 
-    return status;
+    return SUCCESS;
 }
 
-status_t ihex_read( char *filename, uint8_t* data, size_t size, mem_block_t **blocks )
+// Writes the pending data as a data record
+//
+static status_t write_record( writer_t *writer )
 {
-    status_t status = SUCCESS;
-    static char line_buf[LINE_BUF_LEN];
-    hexfile_t hex = { 0 };
-    FILE *file;
+    uint8_t header[4] = { writer->len, ( writer->address >> 8 ) & 0xFF, writer->address & 0xFF, DATA };
+    char line[1 + 2 * ( sizeof( header ) + WRITER_LINE_SIZE + 1 ) + 1], *end = line;
+    uint8_t checksum = 0;
 
-    if ( NULL == ( file = fopen( filename, "r" ) ) )
+    for ( size_t i = 0; i < sizeof( header ); ++i )
     {
-        fprintf( stderr, "Error %d opening file '%s': %s\n", errno, filename, strerror( errno ) );
-        return FAILURE;
+        checksum += header[i];
     }
-    
-    hex.start_char = ':';
-    hex.buffer = data;
-    hex.buffer_size = size;
-    hex.line_buffer = line_buf;
-    hex.current_addr = -1;
-
-    while ( fgets( line_buf, sizeof( line_buf ), file ) > 0 )
+
+    for ( size_t i = 0; i < writer->len; ++i )
     {
-        if ( FAILURE == ( status = ihex_read_record( &hex ) ) )
-        {
-            files_free_blocks( hex.blocks );
-            hex.blocks = NULL;
-            break;
-        }
+        checksum += writer->pending[i];
     }
+    checksum = ~checksum + 1;
 
-    if ( SUCCESS == status && ( !feof( file ) || ! hex.complete ) )
+    *end++ = ':';
+    end = hex_encode( end, header, sizeof( header ) );
+    end = hex_encode( end, writer->pending, writer->len );
+    end = hex_encode( end, &checksum, 1 );
+    *end++ = '\n';
+
+    if ( FAILURE == files_write( writer, line, end - line ) )
     {
-        fputs( "Unexpected end of hex file\n", stderr );
-        status = FAILURE;
+        return FAILURE;
     }
 
-    *blocks = hex.blocks;
+    writer->address += writer->len;
+    writer->len = 0;
 
-    fclose( file );
-
-    return status;
+    return SUCCESS;
 }
 
-status_t ihex_write( char *filename, uint8_t* data, size_t size, uint64_t base_addr )
+status_t ihex_put( writer_t *writer, const uint8_t *data, size_t len )
 {
-    status_t status = SUCCESS;
-    int rc;
-    int byte_num = 0;
-    uint16_t checksum = 0;
-    uint16_t lines = 0;
-    char start_char = ':';
-    uint8_t max_bytes_per_line = INTEL_WRITE_BYTES_PER_LINE;
-    FILE *file;
-
-    if ( NULL == ( file = fopen( filename, "w" ) ) )
+    for ( size_t i = 0; i < len; ++i )
     {
-        fprintf( stderr, "Error %d opening file '%s': %s\n", errno, filename, strerror( errno ) );
-        return FAILURE;
-    }
+        writer->pending[writer->len++] = data[i];
 
-    while ( byte_num < size )
-    {
-        if ( ! (byte_num % max_bytes_per_line) )
+        if ( writer->len == INTEL_WRITE_BYTES_PER_LINE && FAILURE == write_record( writer ) )
         {
-            ++lines;
-
-            // New line
-            if ( byte_num )
-            {
-                // Print checksum
-                rc = fprintf( file, "%2.2X\n", (uint8_t)(~checksum + 1 ) );
-                
-                if ( rc < 0 ) status = FAILURE;
-            }
-            uint8_t bytes_in_line = size - byte_num > max_bytes_per_line ? max_bytes_per_line : size - byte_num;
-            checksum = bytes_in_line + ( ( base_addr >> 8 ) & 0xFF ) + ( base_addr & 0xFF );
-            rc = fprintf( file, "%c%2.2X%4.4X", start_char, bytes_in_line, (uint16_t) base_addr );
-            rc = fputs( "00", file );
-            if ( rc < 0 ) status = FAILURE;
+            return FAILURE;
         }
-        rc = fprintf( file, "%2.2X", data[byte_num] );
-        if ( rc < 0 ) status = FAILURE;
-
-        checksum += data[byte_num];
-        ++byte_num; ++base_addr;
     }
 
-    if ( fprintf( file, "%2.2X\n", (uint8_t)(~checksum + 1 ) ) < 0
-            || fputs( ":00000001FF\n", file ) < 0 )
+    return SUCCESS;
+}
+
+// Writes the last data record and the end of file one
+//
+status_t ihex_close( writer_t *writer, status_t status )
+{
+    if ( SUCCESS == status && writer->len )
     {
-        status = FAILURE;
-    }    
+        status = write_record( writer );
+    }
 
-    if ( EOF == fclose( file ) )
+    if ( SUCCESS == status )
     {
-        fprintf( stderr, "Error %d closing file '%s': %s\n", errno, filename, strerror( errno ) );
-        status = FAILURE;
+        status = files_write( writer, ":00000001FF\n", 12 );
     }
 
-    return status;
+    return files_close( writer, status );
 }
-
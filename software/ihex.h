@@ -33,8 +33,11 @@
 #include <stdint.h>
 
 #include "globals.h"
+#include "files.h"
 
-status_t ihex_read( char *filename, const uint8_t *buffer, size_t buffer_size, mem_block_t **blocks );
-status_t ihex_write( char *filename, const uint8_t *buffer, size_t buffer_size, uint64_t base_addr );
+bool ihex_detect( const char *contents, size_t len );
+status_t ihex_parse( const char *contents, size_t len, image_t *image );
+status_t ihex_put( writer_t *writer, const uint8_t *data, size_t len );
+status_t ihex_close( writer_t *writer, status_t status );
 
 #endif /* IHEX_H */
@@ -0,0 +1,191 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Journal of interrupted writes
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "globals.h"
+#include "files.h"
+#include "journal.h"
+
+#define JOURNAL_DIR     "/var/tmp"
+#define JOURNAL_VERSION 1
+
+// The journal of a device is prom-<device path, with '_' for '/'>.journal, like the
+// daemon socket, but in a directory that survives a reboot: /var/tmp/prom-<uid>, that
+// only the user can get into
+//
+static status_t journal_path( journal_t *journal, const char *device )
+{
+    char dir[sizeof( JOURNAL_DIR "/prom-" ) + 10];
+    char *c;
+    int len;
+
+    snprintf( dir, sizeof( dir ), JOURNAL_DIR "/prom-%u", (unsigned) geteuid() );
+
+    if ( FAILURE == files_private_dir( dir, true ) )
+    {
+        return FAILURE;
+    }
+
+    len = snprintf( journal->path, sizeof( journal->path ), "%s/prom-%s.journal", dir, device );
+
+    if ( len < 0 || len >= (int) sizeof( journal->path ) )
+    {
+        fprintf( stderr, "Error: Device name too long: %s\n", device );
+        return FAILURE;
+    }
+
+    for ( c = journal->path + strlen( dir ) + sizeof( "/prom-" ) - 1; *c; ++c )
+    {
+        if ( *c == '/' )
+        {
+            *c = '_';
+        }
+    }
+
+    journal->device = device;
+
+    return SUCCESS;
+}
+
+status_t journal_init( journal_t *journal, const char *device, uint8_t chip, uint32_t image )
+{
+    journal->chip = chip;
+    journal->image = image;
+    journal->done = journal->saved = 0;
+
+    return journal_path( journal, device );
+}
+
+// The journal left by an interrupted write on the device
+//
+status_t journal_load( journal_t *journal, const char *device )
+{
+    char saved_device[PATH_MAX];
+    unsigned version;
+    FILE *file;
+    int fields;
+
+    if ( FAILURE == journal_path( journal, device ) )
+    {
+        return FAILURE;
+    }
+
+    if ( NULL == ( file = fopen( journal->path, "r" ) ) )
+    {
+        if ( errno == ENOENT )
+        {
+            fprintf( stderr, "Error: There is no interrupted write to resume on %s\n", device );
+        }
+        else
+        {
+            fprintf( stderr, "Error %d opening journal '%s': %s\n", errno, journal->path, strerror( errno ) );
+        }
+        return FAILURE;
+    }
+
+    fields = fscanf( file, "prom journal %u device %4095s chip %hhu image %x done %hx",
+                        &version, saved_device, &journal->chip, &journal->image, &journal->done );
+    fclose( file );
+
+    if ( fields != 5 || version != JOURNAL_VERSION || strcmp( saved_device, device ) )
+    {
+        fprintf( stderr, "Error: Invalid journal '%s'\n", journal->path );
+        return FAILURE;
+    }
+
+    journal->saved = journal->done;
+
+    return SUCCESS;
+}
+
+// Replaces the file as a whole, so an interruption never leaves half of it. The new
+// one is always created, never an existing file or link opened
+//
+status_t journal_save( journal_t *journal )
+{
+    char tmp[PATH_MAX + 8];
+    FILE *file;
+    int fd, ok;
+
+    snprintf( tmp, sizeof( tmp ), "%s.XXXXXX", journal->path );
+
+    if ( -1 == ( fd = mkstemp( tmp ) ) || NULL == ( file = fdopen( fd, "w" ) ) )
+    {
+        fprintf( stderr, "Error %d creating journal '%s': %s\n", errno, tmp, strerror( errno ) );
+        if ( fd != -1 )
+        {
+            close( fd );
+            unlink( tmp );
+        }
+        return FAILURE;
+    }
+
+    ok = 0 < fprintf( file, "prom journal %u\ndevice %s\nchip %u\nimage 0x%08X\ndone 0x%03X\n",
+                        JOURNAL_VERSION, journal->device, journal->chip, journal->image, journal->done );
+    ok = ( 0 == fflush( file ) ) && ok && ( 0 == fsync( fileno( file ) ) );
+    ok = ( 0 == fclose( file ) ) && ok;
+
+    if ( ! ok || -1 == rename( tmp, journal->path ) )
+    {
+        fprintf( stderr, "Error %d writing journal '%s': %s\n", errno, journal->path, strerror( errno ) );
+        unlink( tmp );
+        return FAILURE;
+    }
+
+    journal->saved = journal->done;
+
+    return SUCCESS;
+}
+
+// The data below 'done' is programmed. Saved every JOURNAL_BATCH bytes, as an update
+// lost in an interruption only means planning again a few more bytes when resuming
+//
+void journal_progress( journal_t *journal, uint16_t done )
+{
+    journal->done = done;
+
+    if ( journal->done - journal->saved >= JOURNAL_BATCH )
+    {
+        journal_save( journal );
+    }
+}
+
+void journal_remove( journal_t *journal )
+{
+    if ( -1 == unlink( journal->path ) && errno != ENOENT )
+    {
+        fprintf( stderr, "Error %d removing journal '%s': %s\n", errno, journal->path, strerror( errno ) );
+    }
+}
@@ -0,0 +1,56 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Journal of interrupted writes
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "globals.h"
+
+#define JOURNAL_BATCH   32          // Bytes programmed between journal updates
+
+// The write in progress on a device, kept on disk until it finishes
+typedef struct {
+    char path[PATH_MAX];
+    const char *device;
+    uint8_t chip;
+    uint32_t image;                 // CRC32 of the blocks to program, with their addresses
+    uint16_t done;                  // All the data below it is programmed and verified
+    uint16_t saved;                 // 'done' in the file
+} journal_t;
+
+status_t journal_init( journal_t *journal, const char *device, uint8_t chip, uint32_t image );
+status_t journal_load( journal_t *journal, const char *device );
+status_t journal_save( journal_t *journal );
+void journal_progress( journal_t *journal, uint16_t done );
+void journal_remove( journal_t *journal );
+
+#endif /* JOURNAL_H */
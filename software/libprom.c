@@ -0,0 +1,728 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Programmer session library
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "globals.h"
+#include "serial.h"
+#include "stats.h"
+#include "protocol.h"
+#include "progress.h"
+#include "scan.h"
+#include "libprom.h"
+
+struct prom_session_s {
+    prom_config_t config;
+    protocol_t link;
+    bool open;
+    uint8_t version[3];
+    uint32_t baud;
+    prom_progress_fn_t progress;
+    void *arg;
+};
+
+// The same descriptors the firmware is built with
+static const chip_desc_t chips[NUM_CHIPS] = { CHIP_TABLE( CHIP_DESCRIPTOR ) };
+
+// 0 for an unknown chip
+//
+uint16_t prom_chip_size( uint8_t chip )
+{
+    return ( chip < NUM_CHIPS ) ? chips[chip].size : 0;
+}
+
+// NULL for an unknown chip
+//
+const char *prom_chip_name( uint8_t chip )
+{
+    return ( chip < NUM_CHIPS ) ? chips[chip].name : NULL;
+}
+
+// Chip number from a string with the number or the name, in any case
+//
+status_t prom_chip_parse( const char *string, uint8_t *chip )
+{
+    uint8_t number;
+
+    if ( 0 == get_uint8( string, &number ) && number < NUM_CHIPS )
+    {
+        *chip = number;
+        return SUCCESS;
+    }
+
+    for ( number = 0; number < NUM_CHIPS; ++number )
+    {
+        if ( 0 == strcasecmp( string, chips[number].name ) )
+        {
+            *chip = number;
+            return SUCCESS;
+        }
+    }
+
+    return FAILURE;
+}
+
+prom_session_t *prom_new( const prom_config_t *config )
+{
+    prom_session_t *session = calloc( 1, sizeof( prom_session_t ) );
+
+    if ( NULL == session )
+    {
+        return NULL;
+    }
+
+    session->config = *config;
+    protocol_init( &session->link, -1, NULL );
+    session->link.quiet = config->quiet;
+    session->link.stats = config->stats;
+
+    return session;
+}
+
+void prom_free( prom_session_t *session )
+{
+    if ( NULL != session )
+    {
+        prom_close( session );
+        free( session );
+    }
+}
+
+// Connects to the programmer at 'device' and negotiates the protocol and speed
+//
+status_t prom_open( prom_session_t *session, char *device )
+{
+    protocol_t *link = &session->link;
+    char error[SERIAL_ERROR_SIZE];
+    uint64_t start;
+    status_t status;
+    int fd;
+
+    protocol_init( link, -1, device );
+    link->quiet = session->config.quiet;
+    link->stats = session->config.stats;
+
+    if ( FAILURE == serial_init( &fd, device, error ) )
+    {
+        protocol_report( link, "%s", error );
+        return FAILURE;
+    }
+
+    if ( FAILURE == protocol_attach( link, fd ) )
+    {
+        serial_close( fd );
+        return FAILURE;
+    }
+
+    session->open = true;
+    session->baud = SERIAL_DEFAULT_BAUD;
+
+    start = stats_now();
+    status = protocol_version( link, session->version );
+    stats_phase( link->stats, "handshake", start, status );
+
+    if ( FAILURE == status )
+    {
+        protocol_report( link, "Error: Programmer not detected at port %s\n", device );
+        prom_close( session );
+        return FAILURE;
+    }
+
+    start = stats_now();
+    status = protocol_negotiate( link, session->version, session->config.ascii );
+    if ( SUCCESS == status ) status = protocol_baud( link, session->config.max_baud, &session->baud );
+    stats_phase( link->stats, "negotiation", start, status );
+
+    if ( FAILURE == status )
+    {
+        prom_close( session );
+    }
+
+    return status;
+}
+
+status_t prom_close( prom_session_t *session )
+{
+    uint64_t start = stats_now();
+    status_t status;
+
+    if ( ! session->open )
+    {
+        return SUCCESS;
+    }
+
+    status = protocol_close( &session->link );
+    stats_phase( session->link.stats, "close", start, status );
+
+    protocol_detach( &session->link );
+    serial_close( session->link.fd );
+    session->link.fd = -1;
+    session->open = false;
+
+    return status;
+}
+
+// The last error or warning, empty if none
+//
+const char *prom_error( const prom_session_t *session )
+{
+    return session->link.error;
+}
+
+const uint8_t *prom_version( const prom_session_t *session )
+{
+    return session->version;
+}
+
+uint32_t prom_baud( const prom_session_t *session )
+{
+    return session->baud;
+}
+
+const char *prom_device( const prom_session_t *session )
+{
+    return session->link.device;
+}
+
+bool prom_is_binary( const prom_session_t *session )
+{
+    return protocol_is_binary( &session->link );
+}
+
+// Block commands, CRCs and adaptive pulses came with the same firmware version
+//
+bool prom_has_blocks( const prom_session_t *session )
+{
+    return protocol_has_blocks( &session->link );
+}
+
+pulse_mode_t prom_pulse( const prom_session_t *session )
+{
+    return protocol_get_pulse_mode( &session->link );
+}
+
+// The 'stats' of the configuration, for the caller to add the timing of its own work
+//
+stats_t *prom_timing( prom_session_t *session )
+{
+    return session->link.stats;
+}
+
+void prom_set_progress( prom_session_t *session, prom_progress_fn_t fn, void *arg )
+{
+    session->progress = fn;
+    session->arg = arg;
+}
+
+static status_t check_range( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count )
+{
+    uint16_t size = prom_chip_size( chip );
+
+    if ( ! size || address >= size || count > size - address )
+    {
+        protocol_report( &session->link, "Error: Invalid range 0x%X to 0x%X for chip %u\n", address, address + count - 1, chip );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Adaptive pulses need block commands, see prom_has_blocks()
+//
+status_t prom_set_pulse( prom_session_t *session, pulse_mode_t pulse )
+{
+    if ( ! protocol_has_blocks( &session->link ) )
+    {
+        if ( pulse == PULSE_FIXED )
+        {
+            return SUCCESS;
+        }
+
+        protocol_report( &session->link, "Error: Firmware does not support adaptive pulses.\n" );
+        return FAILURE;
+    }
+
+    return protocol_pulse_mode( &session->link, pulse );
+}
+
+// Gets in 'first' the address of the first byte that is not blank, or the chip size
+//
+status_t prom_blank( prom_session_t *session, uint8_t chip, uint16_t *first )
+{
+    const fuse_map_t *map;
+
+    if ( FAILURE == check_range( session, chip, 0, 1 ) )
+    {
+        return FAILURE;
+    }
+
+    if ( SUCCESS == protocol_map( &session->link, chip, prom_chip_size( chip ), &map ) )
+    {
+        *first = protocol_map_first( map, 0, map->size );
+        return SUCCESS;
+    }
+
+    return protocol_blank( &session->link, chip, first );
+}
+
+// The occupancy index is kept until something is programmed or prom_forget() is
+// called, so the chip is read just once to answer several questions about it. Fails
+// with older firmware, that does not have the command
+//
+status_t prom_map( prom_session_t *session, uint8_t chip, prom_map_t *map )
+{
+    const fuse_map_t *kept;
+
+    if ( FAILURE == check_range( session, chip, 0, 1 ) )
+    {
+        return FAILURE;
+    }
+
+    if ( FAILURE == protocol_map( &session->link, chip, prom_chip_size( chip ), &kept ) )
+    {
+        return FAILURE;
+    }
+
+    *map = *kept;
+
+    return SUCCESS;
+}
+
+// For when the chip in the socket has been changed
+//
+void prom_forget( prom_session_t *session )
+{
+    protocol_forget( &session->link );
+}
+
+typedef struct {
+    progress_t *progress;
+    uint8_t *data;
+    uint16_t address;
+    uint16_t done;
+    uint16_t total;
+} read_sink_t;
+
+static status_t to_buffer( const uint8_t *data, size_t len, void *arg )
+{
+    read_sink_t *sink = arg;
+
+    if ( len > (size_t) ( sink->total - sink->done ) )
+    {
+        return FAILURE;
+    }
+
+    memcpy( &sink->data[sink->done], data, len );
+    sink->done += len;
+    progress_step( sink->progress, sink->address + sink->done - 1, len, 0 );
+
+    return SUCCESS;
+}
+
+// The whole chip comes in a single dump command with the binary protocol, so there is
+// no progress until it ends
+//
+status_t prom_read( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data )
+{
+    progress_t progress;
+    read_sink_t sink = { &progress, data, address, 0, count };
+    status_t status;
+
+    if ( FAILURE == check_range( session, chip, address, count ) )
+    {
+        return FAILURE;
+    }
+
+    progress_begin( &progress, "read", count, 0, 0, session->progress, session->arg );
+
+    if ( 0 == address && prom_chip_size( chip ) == count && protocol_is_binary( &session->link ) )
+    {
+        status = protocol_dump( &session->link, chip, count, data );
+
+        if ( SUCCESS == status )
+        {
+            progress_step( &progress, count - 1, count, 0 );
+        }
+    }
+    else
+    {
+        status = protocol_stream( &session->link, chip, address, count, to_buffer, &sink );
+    }
+    progress_end( &progress, status );
+
+    return status;
+}
+
+// Like prom_read(), but the data goes to 'fn' as it arrives instead of to a buffer
+//
+status_t prom_stream( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, prom_sink_fn_t fn, void *arg )
+{
+    if ( FAILURE == check_range( session, chip, address, count ) )
+    {
+        return FAILURE;
+    }
+
+    return protocol_stream( &session->link, chip, address, count, fn, arg );
+}
+
+// Same as the programmer's check command, for older firmware
+//
+static void check_data( const uint8_t *existing, const uint8_t *wanted, uint16_t start, uint16_t count, check_t *check )
+{
+    memset( check, 0, sizeof( check_t ) );
+    check->first = start + count;
+
+    for ( uint16_t i = 0; i < count; ++i )
+    {
+        if ( existing[i] == wanted[i] )
+        {
+            ++check->correct;
+        }
+        else if ( existing[i] & ~wanted[i] )
+        {
+            if ( ! check->impossible++ )
+            {
+                check->first = start + i;
+            }
+        }
+        else
+        {
+            ++check->program;
+            check->bits += __builtin_popcount( wanted[i] & ~existing[i] );
+        }
+    }
+}
+
+// Tells if the range can be programmed with the data, without reading it if the
+// occupancy index has nothing programmed there
+//
+status_t prom_check( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data, prom_check_t *check )
+{
+    protocol_t *link = &session->link;
+    uint8_t existing[MAX_BLOCK];
+    const fuse_map_t *map;
+
+    if ( FAILURE == check_range( session, chip, address, count ) )
+    {
+        return FAILURE;
+    }
+
+    if ( SUCCESS == protocol_map( link, chip, prom_chip_size( chip ), &map )
+        && protocol_map_first( map, address, count ) == address + count )
+    {
+        memset( existing, 0, count );
+    }
+    else if ( protocol_has_blocks( link ) )
+    {
+        return protocol_check( link, chip, address, count, data, check );
+    }
+    else if ( FAILURE == protocol_read( link, chip, address, count, existing ) )
+    {
+        return FAILURE;
+    }
+
+    check_data( existing, data, address, count, check );
+
+    return SUCCESS;
+}
+
+// One command per byte, for firmware that does not support block commands. Up to
+// PROM_PIPELINE_DEPTH commands are sent ahead, so the programmer does not wait for us
+// between them. On the first mismatch, we stop sending, but the programmer still
+// runs the ones it already got, so the next few bytes may be written too. Gets in
+// 'got' the results there are, up to the mismatch
+//
+static status_t write_bytes( protocol_t *link, char command, uint8_t chip, uint16_t address, uint16_t count,
+                             const uint8_t *data, uint8_t *results, uint16_t *got )
+{
+    uint16_t loc, sent = 0;
+    uint8_t ignored;
+
+    for ( loc = 0; loc < count; ++loc )
+    {
+        for ( ; sent < count && sent - loc < PROM_PIPELINE_DEPTH; ++sent )
+        {
+            if ( FAILURE == protocol_byte_send( link, command, chip, address + sent, data[sent] ) )
+            {
+                return FAILURE;
+            }
+        }
+
+        if ( FAILURE == protocol_byte_receive( link, &results[loc] ) )
+        {
+            return FAILURE;
+        }
+
+        if ( results[loc] != data[loc] )
+        {
+            *got = loc + 1;
+
+            // Cancel the rest of the window, ignoring their responses
+            while ( ++loc < sent && SUCCESS == protocol_byte_receive( link, &ignored ) )
+                ;
+            return SUCCESS;
+        }
+    }
+
+    *got = count;
+
+    return SUCCESS;
+}
+
+static status_t write_pieces( prom_session_t *session, char command, const char *message, uint8_t chip, uint16_t address,
+                              uint16_t count, const uint8_t *data, uint16_t *done, progress_t *progress )
+{
+    protocol_t *link = &session->link;
+    uint8_t results[PROM_WRITE_PIECE];
+
+    while ( *done < count )
+    {
+        uint16_t n = ( count - *done > PROM_WRITE_PIECE ) ? PROM_WRITE_PIECE : count - *done;
+        uint16_t got = n;
+
+        if ( protocol_has_blocks( link ) )
+        {
+            if ( FAILURE == protocol_block( link, command, chip, address + *done, n, &data[*done], results, &got ) )
+            {
+                return FAILURE;
+            }
+        }
+        else if ( FAILURE == write_bytes( link, command, chip, address + *done, n, &data[*done], results, &got ) )
+        {
+            return FAILURE;
+        }
+
+        for ( uint16_t i = 0; i < got; ++i, ++*done )
+        {
+            if ( results[i] != data[*done] )
+            {
+                protocol_report( link, "\nError %s prom address 0x%03X: Read == 0x%02x, expected == 0x%02x\n",
+                                    message, address + *done, results[i], data[*done] );
+                return FAILURE;
+            }
+        }
+
+        if ( got < n )
+        {
+            protocol_report( link, "\nError: Bad programmer response.\n" );
+            return FAILURE;
+        }
+
+        progress_step( progress, address + *done - 1, n, 0 );
+    }
+
+    return SUCCESS;
+}
+
+// Programs the bytes in pieces of PROM_WRITE_PIECE, stopping at the first one that does
+// not take its value. Gets in 'done' how many were programmed
+//
+status_t prom_write( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data, uint16_t *done )
+{
+    progress_t progress;
+    status_t status;
+
+    *done = 0;
+
+    if ( FAILURE == check_range( session, chip, address, count ) )
+    {
+        return FAILURE;
+    }
+
+    progress_begin( &progress, "write", count, 0, 0, session->progress, session->arg );
+    status = write_pieces( session, 'w', "writing to", chip, address, count, data, done, &progress );
+    progress_end( &progress, status );
+
+    return status;
+}
+
+// Like prom_write(), but the programmer just tells what the bytes would read after
+// programming them, without burning anything
+//
+status_t prom_simulate( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data, uint16_t *done )
+{
+    progress_t progress;
+    status_t status;
+
+    *done = 0;
+
+    if ( FAILURE == check_range( session, chip, address, count ) )
+    {
+        return FAILURE;
+    }
+
+    progress_begin( &progress, "simulate", count, 0, 0, session->progress, session->arg );
+    status = write_pieces( session, 's', "writing (simulated) to", chip, address, count, data, done, &progress );
+    progress_end( &progress, status );
+
+    return status;
+}
+
+// The bytes that differ in the first block that has any go to 'fn', with the values
+// the programmer sent back for them. Without the compare command, only the first one
+//
+static status_t verify_blocks( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data,
+                               uint16_t *first, prom_mismatch_fn_t fn, void *arg, progress_t *progress )
+{
+    protocol_t *link = &session->link;
+    uint8_t mismatches[MAX_BLOCK / 8], values[MAX_BLOCK];
+
+    for ( uint16_t done = 0, n; done < count; done += n )
+    {
+        uint16_t differ = 0;
+
+        n = ( count - done > MAX_BLOCK ) ? MAX_BLOCK : count - done;
+
+        if ( protocol_has_blocks( link ) )
+        {
+            if ( FAILURE == protocol_compare( link, chip, address + done, n, &data[done], mismatches, values ) )
+            {
+                return FAILURE;
+            }
+        }
+        else
+        {
+            if ( FAILURE == protocol_read( link, chip, address + done, n, values ) )
+            {
+                return FAILURE;
+            }
+
+            // Like the programmer compare, for the first byte that differs only
+            memset( mismatches, 0, sizeof( mismatches ) );
+
+            for ( uint16_t i = 0; i < n; ++i )
+            {
+                if ( values[i] != data[done + i] )
+                {
+                    mismatches[i / 8] |= 1 << ( i % 8 );
+                    values[0] = values[i];
+                    break;
+                }
+            }
+        }
+
+        for ( uint16_t i = 0; i < n; ++i )
+        {
+            if ( mismatches[i / 8] & ( 1 << ( i % 8 ) ) )
+            {
+                if ( 0 == differ )
+                {
+                    *first = address + done + i;
+                }
+                if ( NULL != fn )
+                {
+                    fn( address + done + i, values[differ], data[done + i], arg );
+                }
+                ++differ;
+            }
+        }
+
+        if ( differ )
+        {
+            return SUCCESS;
+        }
+        progress_step( progress, address + done + n - 1, n, 0 );
+    }
+
+    return SUCCESS;
+}
+
+// Gets in 'first' the address of the first byte that differs from the data, or the
+// end of the range if none. 'fn', if not NULL, gets the first difference, or, when the
+// programmer compares the bytes itself, all those of the MAX_BLOCK bytes where it is
+//
+status_t prom_verify( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data,
+                      uint16_t *first, prom_mismatch_fn_t fn, void *arg )
+{
+    progress_t progress;
+    status_t status;
+
+    *first = address + count;
+
+    if ( FAILURE == check_range( session, chip, address, count ) )
+    {
+        return FAILURE;
+    }
+
+    progress_begin( &progress, "verify", count, 0, 0, session->progress, session->arg );
+    status = verify_blocks( session, chip, address, count, data, first, fn, arg, &progress );
+    progress_end( &progress, status );
+
+    return status;
+}
+
+// Like prom_verify(), but the programmer sends a CRC of the range, and the bytes are
+// only compared if it does not match. Older firmware does not have CRCs, so all the
+// data is read back
+//
+status_t prom_fast_verify( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data,
+                           uint16_t *first, prom_mismatch_fn_t fn, void *arg )
+{
+    progress_t progress;
+    status_t status;
+    uint32_t crc;
+
+    if ( ! protocol_has_blocks( &session->link ) )
+    {
+        return prom_verify( session, chip, address, count, data, first, fn, arg );
+    }
+
+    *first = address + count;
+
+    if ( FAILURE == check_range( session, chip, address, count ) )
+    {
+        return FAILURE;
+    }
+
+    progress_begin( &progress, "verify", count, 0, 0, session->progress, session->arg );
+    status = protocol_digest( &session->link, chip, address, count, &crc );
+
+    if ( SUCCESS == status && crc != ~protocol_crc32( 0xFFFFFFFF, data, count ) )
+    {
+        status = verify_blocks( session, chip, address, count, data, first, fn, arg, &progress );
+    }
+    else if ( SUCCESS == status )
+    {
+        progress_step( &progress, address + count - 1, count, 0 );
+    }
+    progress_end( &progress, status );
+
+    return status;
+}
+
+// Gets and clears the programmer counters. Fails with older firmware
+//
+status_t prom_stats( prom_session_t *session, programmer_stats_t *stats )
+{
+    return protocol_stats( &session->link, stats );
+}
@@ -0,0 +1,107 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Programmer session library
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef LIBPROM_H
+#define LIBPROM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "globals.h"
+#include "protocol.h"
+#include "progress.h"
+#include "stats.h"
+
+// Max bytes per block command of prom_write(), so the progress is reported often
+#define PROM_WRITE_PIECE    32
+
+// Single byte commands in flight with older firmware. Their worst case, 11 bytes in
+// ascii, must fit in the 64 byte RX buffer of the Arduino
+#define PROM_PIPELINE_DEPTH 4
+
+typedef struct prom_session_s prom_session_t;
+
+// Called as a read, write or verify goes, at most every PROGRESS_INTERVAL, and once
+// when it ends. progress_print() shows it on stderr
+typedef progress_info_t prom_progress_t;
+typedef progress_fn_t prom_progress_fn_t;
+
+// Which bytes of the chip are not zero and the programmed bits of each output
+typedef fuse_map_t prom_map_t;
+
+// Bytes of a range that already have their value, need programming or can't take it
+typedef check_t prom_check_t;
+
+// Gets the data of prom_stream() as it arrives, in order
+typedef protocol_data_fn_t prom_sink_fn_t;
+
+// Called by a verify for each byte that differs, with what the chip has
+typedef void ( *prom_mismatch_fn_t )( uint16_t address, uint8_t found, uint8_t expected, void *arg );
+
+typedef struct {
+    bool ascii;                 // Stay with the ascii protocol
+    bool quiet;                 // Errors are not printed, just kept for prom_error()
+    uint32_t max_baud;          // UINT32_MAX for the fastest that works
+    stats_t *stats;             // Where the session keeps its timing, NULL for nowhere
+} prom_config_t;
+
+uint16_t prom_chip_size( uint8_t chip );
+const char *prom_chip_name( uint8_t chip );
+status_t prom_chip_parse( const char *string, uint8_t *chip );
+
+prom_session_t *prom_new( const prom_config_t *config );
+void prom_free( prom_session_t *session );
+status_t prom_open( prom_session_t *session, char *device );
+status_t prom_close( prom_session_t *session );
+
+const char *prom_error( const prom_session_t *session );
+const uint8_t *prom_version( const prom_session_t *session );
+uint32_t prom_baud( const prom_session_t *session );
+const char *prom_device( const prom_session_t *session );
+bool prom_is_binary( const prom_session_t *session );
+bool prom_has_blocks( const prom_session_t *session );
+pulse_mode_t prom_pulse( const prom_session_t *session );
+stats_t *prom_timing( prom_session_t *session );
+void prom_set_progress( prom_session_t *session, prom_progress_fn_t fn, void *arg );
+
+status_t prom_set_pulse( prom_session_t *session, pulse_mode_t pulse );
+status_t prom_blank( prom_session_t *session, uint8_t chip, uint16_t *first );
+status_t prom_map( prom_session_t *session, uint8_t chip, prom_map_t *map );
+void prom_forget( prom_session_t *session );
+status_t prom_read( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data );
+status_t prom_stream( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, prom_sink_fn_t fn, void *arg );
+status_t prom_check( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data, prom_check_t *check );
+status_t prom_write( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data, uint16_t *done );
+status_t prom_simulate( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data, uint16_t *done );
+status_t prom_verify( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data,
+                      uint16_t *first, prom_mismatch_fn_t fn, void *arg );
+status_t prom_fast_verify( prom_session_t *session, uint8_t chip, uint16_t address, uint16_t count, const uint8_t *data,
+                           uint16_t *first, prom_mismatch_fn_t fn, void *arg );
+status_t prom_stats( prom_session_t *session, programmer_stats_t *stats );
+
+#endif /* LIBPROM_H */
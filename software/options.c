@@ -39,17 +39,17 @@
 
 #include "globals.h"
 #include "options.h"
-#include "binfile.h"
-#include "ihex.h"
 #include "command.h"
 #include "files.h"
+#include "formats.h"
 #include "scan.h"
 #include "str.h"
+#include "serial.h"
 
-static const format_st_t formats[] = {
-    { "bin",  BIN,  bin_read,  bin_write },
-    { "ihex", IHEX, ihex_read, ihex_write },
-    { NULL }
+static const char *pulse_modes[] = {
+    [PULSE_FIXED]    = "fixed",
+    [PULSE_ADAPTIVE] = "adaptive",
+    NULL
 };
 
 static const command_t commands[] = {
@@ -58,6 +58,8 @@ static const command_t commands[] = {
     { 'w', "write",      command_write }, 
     { 's', "simulate",   command_simul }, 
     { 'v', "verify",     command_verify },
+    { 'C', "check",      command_check },
+    { 'h', "fast verify", command_fast_verify },
     { 0 }
 };
 
@@ -77,16 +79,23 @@ static const command_t *get_command( char command )
 static status_t usage( char *myname, status_t status )
 {
     fprintf( stderr, "\nUsage: %s [-h]", myname );
-    fprintf( stderr, "\n       %s DEVICE [-c NUM] -b", myname );
-    fprintf( stderr, "\n       %s DEVICE [-c NUM] -r [ADDRESS [-n COUNT]| -o FILE [-f FORMAT]]", myname );
-    fprintf( stderr, "\n       %s DEVICE [-c NUM] {-w|-s|-v} {ADDRESS -d STRING | -i FILE [-f FORMAT]}\n\n", myname );
+    fprintf( stderr, "\n       %s DEVICE [-a|-baud RATE] [-c NUM] -b", myname );
+    fprintf( stderr, "\n       %s DEVICE [-a|-baud RATE] [-c NUM] -r [ADDRESS [-n COUNT]| -o FILE [-f FORMAT]]", myname );
+    fprintf( stderr, "\n       %s DEVICE [-a|-baud RATE] [-c NUM] {-w|-s|-v|-C} {ADDRESS -d STRING | -i FILE [-f FORMAT]} [-p MODE] [-fast]", myname );
+    fprintf( stderr, "\n       %s DEVICE ... {-w|-s|-v|-C} -i FILE [-f FORMAT] -base ADDRESS", myname );
+    fprintf( stderr, "\n       %s DEVICE ... -w ... -resume", myname );
+    fprintf( stderr, "\n       %s DEVICE ... [-stats[=json]]", myname );
+    fprintf( stderr, "\n       %s DEVICE [-a|-baud RATE] -batch MANIFEST [-p MODE] [-fast]", myname );
+    fprintf( stderr, "\n       %s DEVICE [-a|-baud RATE] -daemon\n\n", myname );
 
     fputs( "Arguments:\n", stderr );
-    fputs( "   DEVICE                   Serial device.\n\n", stderr );
+    fputs( "   DEVICE                   Serial device. Several ones, separated by commas, are\n", stderr );
+    fputs( "                            driven in parallel, except for reading.\n\n", stderr );
 
     fputs( "Options:\n", stderr );
     fputs( "   -h[elp]                  Show this help message and exit.\n", stderr );
-    fputs( "   -c[hip]      NUM         Chip to program: 0 == 74s471 (default), 1 == 74s472.\n", stderr );
+    fputs( "   -c[hip]      CHIP        Chip to program, by number or name: 0 == 74s471 (default),\n", stderr );
+    fputs( "                            1 == 74s472.\n", stderr );
     fputs( "   -b[lank]                 Do a whole chip blank test.\n", stderr );
     fputs( "   -r[ead]      [ADDRESS]   Read chip. If ADDRESS is specified, read the number\n", stderr );
     fputs( "                            of bytes specified by -num-bytes starting at that address.\n", stderr );
@@ -100,11 +109,41 @@ static status_t usage( char *myname, status_t status )
     fputs( "   -s[imulate]  [ADDRESS]   Program simulation. Will success of fail as the write\n", stderr );
     fputs( "                            command, but without actually burning the chip.\n", stderr );
     fputs( "   -v[erify]    [ADDRESS]   Verify data. Same options as for -write|-simulate.\n", stderr );
+    fputs( "   -C|-check    [ADDRESS]   Check if the chip can be programmed with the data, without\n", stderr );
+    fputs( "                            programming it. Same options as for -write|-simulate.\n", stderr );
+    fputs( "                            -write always does this check first.\n", stderr );
+    fputs( "   -fast                    With -verify, compare CRCs computed by the programmer\n", stderr );
+    fputs( "                            and only read back the blocks that differ.\n", stderr );
     fputs( "   -d[ata]      STRING      Binary string to program, simulate or verify. can\n", stderr );
     fputs( "                            contain hex and oct escaped binary chars.\n", stderr );
     fputs( "   -i[nput]     FILE        File to read the data from.\n", stderr );
     fputs( "   -o[utput]    FILE        File to save the data to.\n", stderr );
-    fputs( "   -f[ormat]    {bin,ihex}  File format. Defaults to bin.\n\n", stderr );
+    fputs( "   -f[ormat]    FORMAT      File format, " FORMAT_NAMES ". Input files default\n", stderr );
+    fputs( "                            to the one detected from the contents, output ones\n", stderr );
+    fputs( "                            to bin. 'hex' is raw hex digits, as from 'xxd -p'.\n", stderr );
+    fputs( "   -base        ADDRESS     Address of the chip image in an ihex or srec file with\n", stderr );
+    fputs( "                            several ones. Defaults to 0.\n", stderr );
+    fputs( "   -p[ulse]     MODE        Programming pulses, {fixed,adaptive}. 'fixed' (default)\n", stderr );
+    fputs( "                            applies a 5ms pulse per bit. 'adaptive' starts with 1ms\n", stderr );
+    fputs( "                            and only lengthens it if the bit did not program.\n", stderr );
+    fputs( "   -resume                  Continue a write that was interrupted, after verifying\n", stderr );
+    fputs( "                            what it had programmed. Same options as for that write.\n", stderr );
+    fputs( "   -a[scii]                 Use the ascii protocol instead of the binary one, useful\n", stderr );
+    fputs( "                            for debugging.\n", stderr );
+    fputs( "   -daemon                  Keep the connection to the programmer open and serve\n", stderr );
+    fputs( "                            the commands of other prom runs for the same DEVICE,\n", stderr );
+    fputs( "                            so they don't wait for the programmer reset.\n", stderr );
+    fputs( "   -batch       MANIFEST    Run the parts listed in MANIFEST, one per line as\n", stderr );
+    fputs( "                            'CHIP FILE[@BASE] {blank|write|verify} [COPIES]', with\n", stderr );
+    fputs( "                            '-' as FILE for blank. Asks to swap the chip between\n", stderr );
+    fputs( "                            parts and keeps the connection open.\n", stderr );
+    fputs( "   -baud        RATE        Max serial speed to negotiate with the programmer.\n", stderr );
+    fputs( "                            Defaults to the fastest one that works. 57600\n", stderr );
+    fputs( "                            disables the negotiation.\n", stderr );
+    fputs( "   -stats[=json]            At exit, print to stderr the time of each phase and,\n", stderr );
+    fputs( "                            per programmer command, the write, first byte and\n", stderr );
+    fputs( "                            response times, with a histogram of the latter, and\n", stderr );
+    fputs( "                            the programmer counters for the command.\n\n", stderr );
 
     fputs( "Note: Long and short options, with single or dual '-' are supported\n\n", stderr );
 
@@ -130,11 +169,21 @@ status_t get_options( options_t *options, int argc, char **argv )
         {"write",     optional_argument, 0, 'w' },
         {"simulate",  optional_argument, 0, 's' },
         {"verify",    optional_argument, 0, 'v' },
+        {"check",     optional_argument, 0, 'C' },
         {"data",      required_argument, 0, 'd' },
         {"input",     required_argument, 0, 'i' },
         {"output",    required_argument, 0, 'o' },
         {"format",    required_argument, 0, 'f' },
         {"num-bytes", required_argument, 0, 'n' },
+        {"ascii",     no_argument,       0, 'a' },
+        {"pulse",     required_argument, 0, 'p' },
+        {"baud",      required_argument, 0, 'B' },
+        {"fast",      no_argument,       0, 'F' },
+        {"daemon",    no_argument,       0, 'D' },
+        {"stats",     optional_argument, 0, 'S' },
+        {"base",      required_argument, 0, 'A' },
+        {"batch",     required_argument, 0, 'M' },
+        {"resume",    no_argument,       0, 'R' },
         {0,           0,                 0,  0  }
     };
 
@@ -152,7 +201,9 @@ status_t get_options( options_t *options, int argc, char **argv )
         --argc, ++argv;
     }
 
-    while (( opt = getopt_long_only( argc, argv, ":", long_opts, &opt_index)) != -1 )
+    // "-b" alone is short for "-blank", not an ambiguous "-baud", "-c" for "-chip",
+    // "-d" for "-data", "-f" for "-format", "-r" for "-read" and "-s" for "-simulate"
+    while (( opt = getopt_long_only( argc, argv, ":bc:d:f:Crs", long_opts, &opt_index)) != -1 )
     {
         int f_index = 0;
 
@@ -164,20 +215,21 @@ status_t get_options( options_t *options, int argc, char **argv )
                     return duplicate( myname, opt );
                 }
 
-                if ( EINVAL == get_uint8( optarg, &options->chip ) || options->chip > MAX_CHIP )
+                if ( FAILURE == prom_chip_parse( optarg, &options->chip ) )
                 {
-                    fprintf( stderr, "Error: Invalid chip number: %s\n", optarg );
+                    fprintf( stderr, "Error: Invalid chip: %s\n", optarg );
                     return usage( myname, FAILURE );
                 } 
 
                 break;
             
+            case 'b':
             case 'k':
                 if ( options->command )
                 {
                     return duplicate( myname, opt );
                 }
-                options->command = get_command( opt );
+                options->command = get_command( 'k' );
                 assert( options->command );
 
                 break;
@@ -186,6 +238,7 @@ status_t get_options( options_t *options, int argc, char **argv )
             case 'w':
             case 's':
             case 'v':
+            case 'C':
                 if ( options->command )
                 {
                     return duplicate( myname, opt );
@@ -242,16 +295,7 @@ status_t get_options( options_t *options, int argc, char **argv )
                     return duplicate( myname, opt );
                 }
                 
-                while ( NULL != formats[f_index].format_string )
-                {
-                    if ( ! strcmp( formats[f_index].format_string, optarg ) )
-                    {
-                        options->format = &formats[f_index];
-                        break;
-                    }
-                    ++f_index;
-                }
-                if ( options->format == NULL )
+                if ( NULL == ( options->format = formats_find( optarg ) ) )
                 {
                     fprintf( stderr, "Invalid format: %s\n", optarg );
                     return usage( myname, FAILURE );
@@ -271,6 +315,101 @@ status_t get_options( options_t *options, int argc, char **argv )
                 } 
 
                 break;
+
+            case 'a':
+                if ( options->flags.ascii++ )
+                {
+                    return duplicate( myname, opt );
+                }
+                break;
+
+            case 'p':
+                if ( options->flags.pulse++ )
+                {
+                    return duplicate( myname, opt );
+                }
+
+                while ( NULL != pulse_modes[f_index] && strcmp( pulse_modes[f_index], optarg ) )
+                {
+                    ++f_index;
+                }
+                if ( NULL == pulse_modes[f_index] )
+                {
+                    fprintf( stderr, "Invalid pulse mode: %s\n", optarg );
+                    return usage( myname, FAILURE );
+                }
+                options->pulse = f_index;
+                break;
+
+            case 'B':
+                if ( options->flags.baud++ )
+                {
+                    return duplicate( myname, opt );
+                }
+
+                if ( EINVAL == get_uint32( optarg, &options->baud ) || options->baud < SERIAL_DEFAULT_BAUD )
+                {
+                    fprintf( stderr, "Error: Invalid baud rate: %s\n", optarg );
+                    return usage( myname, FAILURE );
+                }
+                break;
+
+            case 'F':
+                if ( options->flags.fast++ )
+                {
+                    return duplicate( myname, opt );
+                }
+                break;
+
+            case 'D':
+                if ( options->flags.daemon++ )
+                {
+                    return duplicate( myname, opt );
+                }
+                break;
+
+            case 'S':
+                if ( options->flags.stats++ )
+                {
+                    return duplicate( myname, opt );
+                }
+
+                if ( optarg && strcmp( optarg, "json" ) )
+                {
+                    fprintf( stderr, "Invalid statistics format: %s\n", optarg );
+                    return usage( myname, FAILURE );
+                }
+                options->stats_json = ( NULL != optarg );
+                break;
+
+            case 'A':
+                if ( options->flags.base++ )
+                {
+                    return duplicate( myname, opt );
+                }
+
+                if ( EINVAL == get_uint32( optarg, &options->base ) )
+                {
+                    fprintf( stderr, "Error: Invalid base address: %s\n", optarg );
+                    return usage( myname, FAILURE );
+                }
+                break;
+
+            case 'R':
+                if ( options->flags.resume++ )
+                {
+                    return duplicate( myname, opt );
+                }
+                break;
+
+            case 'M':
+                if ( options->manifest )
+                {
+                    return duplicate( myname, opt );
+                }
+                options->manifest = optarg;
+                break;
+
             case ':':
                 fprintf( stderr, "%s: Option requires an argument: -- '%s'\n", myname, argv[optind-1] );
                 // FALLTHROUGH
@@ -284,6 +423,12 @@ status_t get_options( options_t *options, int argc, char **argv )
         }
     }
 
+    // Also as "prom -daemon DEVICE"
+    if ( options->flags.daemon && ! options->device && argv[optind] )
+    {
+        options->device = argv[optind++];
+    }
+
     if ( argv[optind] )
     {
         fprintf( stderr, "%s: Unexpected argument: '%s'\n", myname, argv[optind] );
@@ -296,9 +441,63 @@ status_t get_options( options_t *options, int argc, char **argv )
         return usage( myname, FAILURE );
     }
 
+    if ( options->flags.baud && options->flags.ascii )
+    {
+        fprintf( stderr, "%s: Incompatible options: '-a' and '-baud'.\n", myname );
+        return usage( myname, FAILURE );
+    }
+
+    if ( ! options->flags.baud )
+    {
+        options->baud = UINT32_MAX;
+    }
+
+    if ( options->flags.daemon )
+    {
+        if ( options->command || options->flags.chip || options->flags.count || options->flags.pulse
+            || options->flags.fast || options->flags.stats || options->flags.base || options->data || options->ifile || options->ofile || options->format
+            || options->manifest || options->flags.resume )
+        {
+            fprintf( stderr, "%s: Option '-daemon' only accepts '-a' and '-baud'.\n", myname );
+            return usage( myname, FAILURE );
+        }
+
+        if ( strchr( options->device, ',' ) )
+        {
+            fprintf( stderr, "%s: A daemon serves just one device.\n", myname );
+            return usage( myname, FAILURE );
+        }
+
+        return SUCCESS;
+    }
+
+    if ( options->manifest )
+    {
+        if ( options->command || options->flags.chip || options->flags.count || options->flags.base || options->flags.resume
+            || options->data || options->ifile || options->ofile || options->format )
+        {
+            fprintf( stderr, "%s: Option '-batch' only accepts '-a', '-baud', '-p', '-fast' and '-stats'.\n", myname );
+            return usage( myname, FAILURE );
+        }
+
+        if ( strchr( options->device, ',' ) )
+        {
+            fprintf( stderr, "%s: A batch runs on just one device.\n", myname );
+            return usage( myname, FAILURE );
+        }
+
+        return SUCCESS;
+    }
+
     if ( ! options->command )
     {
-        fprintf( stderr, "%s: At least one command ('-k', '-r', '-w', '-s' or '-v') must be specified.\n", myname );
+        fprintf( stderr, "%s: At least one command ('-k', '-r', '-w', '-s', '-v' or '-C') must be specified.\n", myname );
+        return usage( myname, FAILURE );
+    }
+
+    if ( options->command->command == 'r' && strchr( options->device, ',' ) )
+    {
+        fprintf( stderr, "%s: Only one device can be read at a time.\n", myname );
         return usage( myname, FAILURE );
     }
 
@@ -308,7 +507,8 @@ status_t get_options( options_t *options, int argc, char **argv )
         return usage( myname, FAILURE );
     }
 
-    if ( (options->command->command == 'w' || options->command->command == 's' || options->command->command == 'v')
+    if ( (options->command->command == 'w' || options->command->command == 's' || options->command->command == 'v'
+            || options->command->command == 'C')
             && ! options->flags.address && ! options->ifile )
     {
         fprintf( stderr, "%s: Either '-d' or '-i' is mandatory for the '%s' command.\n", myname, options->command->name );
@@ -344,15 +544,45 @@ status_t get_options( options_t *options, int argc, char **argv )
         return usage( myname, FAILURE );
     }
 
+    if ( options->flags.pulse && options->command->command != 'w' && options->command->command != 's' )
+    {
+        fprintf( stderr, "%s: Option '-p' only valid with '-w' or '-s'.\n", myname );
+        return usage( myname, FAILURE );
+    }
+
+    if ( options->flags.resume && options->command->command != 'w' )
+    {
+        fprintf( stderr, "%s: Option '-resume' only valid with '-w'.\n", myname );
+        return usage( myname, FAILURE );
+    }
+
+    if ( options->flags.fast )
+    {
+        if ( options->command->command != 'v' )
+        {
+            fprintf( stderr, "%s: Option '-fast' only valid with '-v'.\n", myname );
+            return usage( myname, FAILURE );
+        }
+        options->command = get_command( 'h' );
+        assert( options->command );
+    }
+
     if ( options->format && !( options->ifile || options->ofile) )
     {
         fprintf( stderr, "%s: Option '-f' only valid with '-i' or '-o'.\n", myname );
         return usage( myname, FAILURE );
     }
 
-    if ( ! options->format )
+    if ( options->flags.base && ( ! options->ifile || ( options->format && ! options->format->addressed ) ) )
+    {
+        fprintf( stderr, "%s: Option '-base' only valid with '-i' and an ihex or srec file.\n", myname );
+        return usage( myname, FAILURE );
+    }
+
+    // Input files are detected when loaded
+    if ( ! options->format && ! options->ifile )
     {
-        options->format = &formats[0];
+        options->format = formats_default();
     }
 
     return SUCCESS;
@@ -38,6 +38,7 @@
 #include "globals.h"
 #include "command.h"
 #include "files.h"
+#include "protocol.h"
 
 typedef struct {
     char command;
@@ -50,16 +51,29 @@ typedef struct {
         bool chip;
         bool address;
         bool count;
+        bool ascii;
+        bool pulse;
+        bool baud;
+        bool fast;
+        bool daemon;
+        bool stats;
+        bool base;
+        bool resume;
     } flags;
+    bool stats_json;
     uint8_t chip;
     const command_t *command;
     const format_st_t *format;
+    pulse_mode_t pulse;
+    uint32_t baud;
     uint16_t address;
     uint16_t count;
+    uint32_t base;
     uint8_t *data;
     char *device;
     char *ifile;
     char *ofile;
+    char *manifest;
 } options_t;
 
 status_t get_options( options_t *options, int argc, char **argv );
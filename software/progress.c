@@ -0,0 +1,153 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Progress of the long operations
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "globals.h"
+#include "stats.h"
+#include "progress.h"
+
+// Reports go to 'fn', if not NULL. 'bit_us' is the time the timing model gives to
+// program a bit, for the time left of writes; without it, it comes from the speed
+//
+void progress_begin( progress_t *progress, const char *operation, uint16_t total, uint32_t total_bits, uint32_t bit_us,
+                     progress_fn_t fn, void *arg )
+{
+    progress->info = (progress_info_t) { .operation = operation, .total = total, .total_bits = total_bits };
+    progress->bit_us = bit_us;
+    progress->start = progress->shown = stats_now();
+    progress->fn = fn;
+    progress->arg = arg;
+}
+
+static void update( progress_t *progress, uint64_t now )
+{
+    progress_info_t *info = &progress->info;
+    uint64_t elapsed = now - progress->start;
+
+    info->rate = elapsed ? (uint64_t) info->done * 1000000 / elapsed : 0;
+
+    if ( info->total_bits && progress->bit_us )
+    {
+        // The model, corrected by how fast it went so far
+        uint64_t left = (uint64_t) ( info->total_bits - info->bits ) * progress->bit_us;
+
+        if ( info->bits )
+        {
+            left = left * elapsed / ( (uint64_t) info->bits * progress->bit_us );
+        }
+        info->eta_ms = left / 1000;
+    }
+    else
+    {
+        info->eta_ms = info->rate ? (uint64_t) ( info->total - info->done ) * 1000 / info->rate : 0;
+    }
+}
+
+// 'bytes' more are done, up to 'address', with 'bits' more programmed
+//
+void progress_step( progress_t *progress, uint16_t address, uint16_t bytes, uint32_t bits )
+{
+    uint64_t now;
+
+    progress->info.address = address;
+    progress->info.done += bytes;
+    progress->info.bits += bits;
+
+    if ( NULL == progress->fn || ( now = stats_now() ) - progress->shown < PROGRESS_INTERVAL )
+    {
+        return;
+    }
+
+    progress->shown = now;
+    update( progress, now );
+    progress->fn( &progress->info, progress->arg );
+}
+
+void progress_end( progress_t *progress, status_t status )
+{
+    if ( NULL == progress->fn )
+    {
+        return;
+    }
+
+    update( progress, stats_now() );
+    progress->info.finished = true;
+    progress->info.ok = ( SUCCESS == status );
+    progress->fn( &progress->info, progress->arg );
+}
+
+// Reporter for the command line, to stderr. On a terminal, a single status line that
+// is redrawn. If not, a JSON object per line
+//
+void progress_print( const progress_info_t *info, void *arg )
+{
+    char rate[16];
+
+    if ( ! isatty( STDERR_FILENO ) )
+    {
+        fprintf( stderr, "{\"operation\":\"%s\",\"address\":%u,\"done\":%u,\"total\":%u,\"bits\":%u,\"total_bits\":%u,"
+                         "\"bytes_per_s\":%u,\"eta_ms\":%u,\"finished\":%s",
+                 info->operation, info->address, info->done, info->total, info->bits, info->total_bits,
+                 info->rate, info->eta_ms, info->finished ? "true" : "false" );
+        fprintf( stderr, info->finished ? ",\"ok\":%s}\n" : "}\n", info->ok ? "true" : "false" );
+        return;
+    }
+
+    // A failure already printed its error after the line
+    if ( info->finished && ! info->ok )
+    {
+        return;
+    }
+
+    if ( info->rate >= 1000 )
+    {
+        snprintf( rate, sizeof( rate ), "%u.%u kB/s", info->rate / 1000, info->rate % 1000 / 100 );
+    }
+    else
+    {
+        snprintf( rate, sizeof( rate ), "%u B/s", info->rate );
+    }
+
+    fprintf( stderr, "\r  0x%03X  %u/%u bytes  %s", info->address, info->done, info->total, rate );
+
+    if ( info->total_bits )
+    {
+        fprintf( stderr, "  %u/%u bits", info->bits, info->total_bits );
+    }
+
+    if ( ! info->finished )
+    {
+        fprintf( stderr, "  ETA %u.%us", info->eta_ms / 1000, info->eta_ms % 1000 / 100 );
+    }
+
+    fputs( info->finished ? "\033[K\n" : "\033[K", stderr );
+}
@@ -0,0 +1,70 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Progress of the long operations
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "globals.h"
+
+#define PROGRESS_INTERVAL   250000      // In us, min time between two reports
+
+// What is reported, at most every PROGRESS_INTERVAL and once at the end
+typedef struct {
+    const char *operation;      // "read", "write", "verify"...
+    uint16_t address;           // Of the last byte done
+    uint16_t done;              // Bytes
+    uint16_t total;
+    uint32_t bits;              // Programmed, for writes
+    uint32_t total_bits;        // 0 if not a write
+    uint32_t rate;              // Bytes/s
+    uint32_t eta_ms;
+    bool finished;
+    bool ok;                    // When finished
+} progress_info_t;
+
+typedef void (*progress_fn_t)( const progress_info_t *info, void *arg );
+
+typedef struct {
+    progress_info_t info;
+    uint32_t bit_us;            // Time per bit of the timing model, 0 if none
+    uint64_t start;
+    uint64_t shown;
+    progress_fn_t fn;
+    void *arg;
+} progress_t;
+
+void progress_begin( progress_t *progress, const char *operation, uint16_t total, uint32_t total_bits, uint32_t bit_us,
+                     progress_fn_t fn, void *arg );
+void progress_step( progress_t *progress, uint16_t address, uint16_t bytes, uint32_t bits );
+void progress_end( progress_t *progress, status_t status );
+void progress_print( const progress_info_t *info, void *arg );
+
+#endif /* PROGRESS_H */
@@ -28,52 +28,211 @@
 #include <errno.h>
 #include <string.h>
 #include <termios.h>
+#include <getopt.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 #include "globals.h"
 #include "options.h"
-#include "serial.h"
 #include "files.h"
-#include "ihex.h"
-#include "binfile.h"
 #include "command.h"
+#include "gang.h"
+#include "daemon.h"
+#include "batch.h"
+#include "stats.h"
 
 #define RETRIES 1
 
-static status_t cleanup( int fd, status_t status )
+typedef struct {
+    const options_t *options;
+    mem_block_t *blocks;
+    int argc;
+    char **argv;
+    bool confirmed;
+} job_t;
+
+// Of this run, kept by its session. With several programmers, each one runs in its own
+// process, with its own copy
+static stats_t stats;
+
+static status_t execute( prom_session_t *session, const options_t *options, mem_block_t *blocks )
 {
-    if ( fd != -1 )
+    bool counters = options->flags.stats && SUCCESS == command_stats( session, false );
+    uint64_t start = stats_now();
+    status_t status;
+
+    status = options->command->function(
+                                        session,
+                                        options->chip,
+                                        options->flags.address ? options->address : 0xFFFF,
+                                        options->flags.count ? options->count : 0xFFFF,
+                                        blocks,
+                                        options->ofile,
+                                        options->format );
+
+    stats_phase( prom_timing( session ), options->command->name, start, status );
+
+    if ( counters )
     {
-        serial_close( fd );
+        command_stats( session, true );
     }
 
     return status;
 }
 
+static status_t load( const options_t *options, mem_block_t **blocks )
+{
+    uint64_t start = stats_now();
+    status_t status;
+
+    status = command_load( options->flags.address ? options->address : 0, options->data, options->ifile, options->base, options->format, blocks );
+    stats_phase( &stats, "load", start, status );
+
+    return status;
+}
+
+static status_t session( char *device, const void *arg )
+{
+    const job_t *job = arg;
+    const options_t *options = job->options;
+    char *argv[job->argc + 1];
+    prom_session_t *prom = NULL;
+    status_t ret;
+
+    // Let the daemon serving the device do it, if there is one
+    memcpy( argv, job->argv, sizeof( argv ) );
+    argv[1] = device;
+
+    if ( SUCCESS == daemon_request( device, job->argc, argv, job->confirmed, &ret ) )
+    {
+        return ret;
+    }
+
+    ret = command_init( &prom, device, options->flags.ascii, options->pulse, options->baud, &stats );
+
+    if ( ret == SUCCESS ) ret = execute( prom, options, job->blocks );
+
+    command_close( prom );
+
+    stats_report( &stats, stderr, options->stats_json );
+
+    return ret;
+}
+
+// A command line received by the daemon. The connection options are the daemon's
+//
+static status_t serve( prom_session_t *session, int argc, char **argv, bool confirmed )
+{
+    options_t options;
+    mem_block_t *blocks = NULL;
+    status_t ret;
+
+    optind = 0;                 // Full reset of getopt
+    ret = get_options( &options, argc, argv );
+
+    stats_init( &stats, ret == SUCCESS && options.flags.stats );
+
+    if ( ret == SUCCESS && options.flags.daemon )
+    {
+        fputs( "Error: Already serving this device.\n", stderr );
+        ret = FAILURE;
+    }
+
+    if ( ret == SUCCESS && ( options.data || options.ifile ) )
+    {
+        ret = load( &options, &blocks );
+    }
+
+    if ( ret == SUCCESS ) ret = command_set_pulse( session, options.pulse );
+
+    if ( ret == SUCCESS )
+    {
+        command_set_confirmed( confirmed );
+        command_set_resume( options.flags.resume );
+        ret = execute( session, &options, blocks );
+    }
+
+    files_free_blocks( blocks );
+
+    stats_report( &stats, stderr, options.stats_json );
+    stats_init( &stats, false );
+
+    return ret;
+}
+
+static status_t run_daemon( char *device, const options_t *options )
+{
+    prom_session_t *prom = NULL;
+    status_t ret;
+    int sock;
+
+    ret = daemon_listen( device, &sock );
+
+    if ( ret == SUCCESS ) ret = command_init( &prom, device, options->flags.ascii, PULSE_FIXED, options->baud, &stats );
+
+    if ( ret == SUCCESS ) ret = daemon_serve( sock, prom, device, serve );
+
+    command_close( prom );
+
+    return ret;
+}
+
 int main( int argc, char **argv )
 {
     options_t options;
-    int fd = -1;
+    job_t job = { &options, NULL, argc, argv, false };
+    char *devices[MAX_GANG];
+    int count = 0;
     status_t ret;
 
     ret = get_options( &options, argc, argv );
 
-    if ( ret == SUCCESS ) ret = serial_init( &fd, options.device );
+    stats_init( &stats, ret == SUCCESS && options.flags.stats );
+    command_set_resume( ret == SUCCESS && options.flags.resume );
 
-    if ( ret == SUCCESS ) ret = command_init( fd, options.device );
+    if ( ret == SUCCESS && options.flags.daemon )
+    {
+        return run_daemon( options.device, &options );
+    }
 
-    if ( ret == SUCCESS ) ret = options.command->function(
-                                        fd,
-                                        options.device,
-                                        options.chip,
-                                        options.flags.address ? options.address : 0xFFFF,
-                                        options.flags.count ? options.count : 0xFFFF,
-                                        options.data,
-                                        options.ifile,
-                                        options.ofile,
-                                        options.format );
+    if ( ret == SUCCESS && options.manifest )
+    {
+        return batch_run( options.device, &options, &stats );
+    }
+
+    // The input is loaded just once, even for several programmers
+    if ( ret == SUCCESS && ( options.data || options.ifile ) )
+    {
+        ret = load( &options, &job.blocks );
+    }
+
+    if ( ret == SUCCESS && -1 == ( count = gang_split( options.device, devices, MAX_GANG ) ) )
+    {
+        fprintf( stderr, "Error: Too many devices, max is %d\n", MAX_GANG );
+        ret = FAILURE;
+    }
+
+    if ( ret == SUCCESS && count == 1 )
+    {
+        ret = session( devices[0], &job );
+    }
+    else if ( ret == SUCCESS )
+    {
+        // Confirm once for all of them, their input is not the terminal
+        if ( options.command->command == 'w' && ! command_confirm() )
+        {
+            fputs( "Aborted by user.\n", stderr );
+            ret = FAILURE;
+        }
+        else
+        {
+            command_set_confirmed( true );
+            job.confirmed = true;
+            ret = gang_run( devices, count, session, &job );
+        }
+    }
 
-    return cleanup( fd, ret );
+    files_free_blocks( job.blocks );
 
+    return ret;
 }
\ No newline at end of file
@@ -0,0 +1,1356 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Programmer wire protocol
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "globals.h"
+#include "serial.h"
+#include "stats.h"
+#include "scan.h"
+#include "protocol.h"
+
+
+// Timeouts, in ms
+#define RESPONSE_TIMEOUT    2000
+#define BOOT_TIMEOUT        2000    // Opening the port resets the board, bootloader delay plus banner
+#define VERSION_TIMEOUT     500     // Per try, once the board is running
+#define VERSION_TRIES       3
+#define QUIET_TIME          20      // Without input for this long, nothing stale is left
+#define ERROR_GRACE         50      // For the "R" after an "E" data line
+#define FIXED_BYTE_TIME     160     // Worst case for a byte, 8 x ( 5ms pulse + 15ms cooling )
+#define ADAPTIVE_BYTE_TIME  480     // 8 x ( 1 + 2 + 4 + 8 )ms pulses, plus cooling
+
+#define MAX_BAUD_RATES  8
+#define BAUD_TEST_SIZE  32          // Fits in the Arduino RX buffer
+#define BAUD_TIMEOUT    500         // In ms. The programmer reverts to the default speed after it
+
+// First firmware version that understands binary frames
+#define BINARY_MAJOR    1
+#define BINARY_MINOR    1
+
+uint16_t protocol_crc16( uint16_t crc, const uint8_t *data, size_t len )
+{
+    while ( len-- )
+    {
+        crc ^= (uint16_t) *data++ << 8;
+
+        for ( int bit = 0; bit < 8; ++bit )
+        {
+            crc = ( crc & 0x8000 ) ? ( crc << 1 ) ^ 0x1021 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+// CRC-32 as used by zip. Start with 0xFFFFFFFF and invert the result
+//
+uint32_t protocol_crc32( uint32_t crc, const uint8_t *data, size_t len )
+{
+    while ( len-- )
+    {
+        crc ^= *data++;
+
+        for ( int bit = 0; bit < 8; ++bit )
+        {
+            crc = ( crc & 1 ) ? ( crc >> 1 ) ^ 0xEDB88320 : crc >> 1;
+        }
+    }
+
+    return crc;
+}
+
+void protocol_init( protocol_t *link, int fd, char *device )
+{
+    memset( link, 0, sizeof( protocol_t ) );
+    link->fd = fd;
+    link->device = device;
+    link->current_baud = SERIAL_DEFAULT_BAUD;
+    link->pulse_mode = PULSE_FIXED;
+}
+
+// Errors and warnings, not shown if they are expected or the link is quiet. The last
+// one is kept for prom_error()
+//
+void protocol_report( protocol_t *link, const char *format, ... )
+{
+    va_list args;
+
+    if ( link->probing )
+    {
+        return;
+    }
+
+    va_start( args, format );
+    vsnprintf( link->error, sizeof( link->error ), format, args );
+    va_end( args );
+
+    if ( ! link->quiet )
+    {
+        fputs( link->error, stderr );
+    }
+}
+
+// The pump failed and kept why. It stays failed, so the reason is reported once
+//
+static status_t port_failure( protocol_t *link )
+{
+    if ( ! link->probing && link->pump.error[0] )
+    {
+        protocol_report( link, "%s", link->pump.error );
+        link->pump.error[0] = '\0';
+    }
+
+    return FAILURE;
+}
+
+static status_t port_write( protocol_t *link, const uint8_t *data, size_t len )
+{
+    return ( SUCCESS == pump_write( &link->pump, data, len ) ) ? SUCCESS : port_failure( link );
+}
+
+static status_t port_read( protocol_t *link, uint8_t *buffer, size_t bufsiz, ssize_t *got, int timeout )
+{
+    return ( SUCCESS == pump_read( &link->pump, buffer, bufsiz, got, timeout ) ) ? SUCCESS : port_failure( link );
+}
+
+// To the receive buffer, see pump_read_until()
+//
+static status_t port_read_until( protocol_t *link, serial_complete_t complete, const void *arg, uint64_t deadline, size_t *len )
+{
+    return ( SUCCESS == pump_read_until( &link->pump, link->rec_buf, sizeof( link->rec_buf ), &link->rec_len,
+                                         complete, arg, deadline, len ) ) ? SUCCESS : port_failure( link );
+}
+
+// Starts the threads that do the I/O on the open port 'fd'
+//
+status_t protocol_attach( protocol_t *link, int fd )
+{
+    link->fd = fd;
+
+    return ( SUCCESS == pump_start( &link->pump, fd, link->device, link->stats ) ) ? SUCCESS : port_failure( link );
+}
+
+void protocol_detach( protocol_t *link )
+{
+    if ( FAILURE == pump_stop( &link->pump ) )
+    {
+        port_failure( link );
+    }
+}
+
+static status_t frame_send( protocol_t *link, char command, const uint8_t *params, uint16_t len )
+{
+    uint8_t *frame = link->tx_buf;
+    uint16_t crc;
+
+    frame[0] = FRAME_START;
+    frame[1] = ( len + 1 ) & 0xFF;
+    frame[2] = ( len + 1 ) >> 8;
+    frame[3] = command;
+    if ( len )
+    {
+        memcpy( &frame[4], params, len );
+    }
+
+    crc = protocol_crc16( 0xFFFF, &frame[1], len + 3 );
+
+    frame[len + 4] = crc & 0xFF;
+    frame[len + 5] = crc >> 8;
+
+    stats_request( link->stats, command );
+
+    return port_write( link, frame, len + FRAME_OVERHEAD );
+}
+
+static status_t receive_failure( protocol_t *link, const char *message )
+{
+    protocol_report( link, message, link->device );
+
+    // Resync with whatever comes next
+    link->rec_len = 0;
+
+    return FAILURE;
+}
+
+// Reads until 'complete' finds a whole response at the start of the buffer or 'timeout'
+// ms pass. Returns its length in 'len'
+//
+static status_t receive( protocol_t *link, serial_complete_t complete, const void *arg, unsigned int timeout, size_t *len )
+{
+    if ( FAILURE == port_read_until( link, complete, arg, serial_deadline( timeout ), len ) )
+    {
+        return FAILURE;
+    }
+
+    if ( 0 == *len )
+    {
+        return receive_failure( link, ( link->rec_len == sizeof( link->rec_buf ) ) ? "\nError: Bad programmer response.\n"
+                                                                       : "\nError: No response from programmer at port %s.\n" );
+    }
+
+    return SUCCESS;
+}
+
+// Removes a processed response from the buffer
+//
+static void consume( protocol_t *link, size_t len )
+{
+    link->rec_len -= len;
+    memmove( link->rec_buf, &link->rec_buf[len], link->rec_len );
+}
+
+// Completion for receive(): a whole frame, skipping anything before its start. A length
+// that can't fit in the buffer completes at once, it is caught by the frame checks
+//
+static size_t frame_complete( const uint8_t *buffer, size_t len, const void *arg )
+{
+    const uint8_t *start = memchr( buffer, FRAME_START, len );
+    size_t skip, total;
+
+    if ( NULL == start )
+    {
+        return 0;
+    }
+
+    skip = start - buffer;
+
+    if ( len - skip < 3 )
+    {
+        return 0;
+    }
+
+    total = ( start[1] | ( start[2] << 8 ) ) + FRAME_OVERHEAD - 1;
+
+    if ( total > PROTOCOL_REC_SIZE - skip )
+    {
+        return len;
+    }
+
+    return ( len - skip >= total ) ? skip + total : 0;
+}
+
+// Receives a response frame and copies its data to 'data'. If 'len' is NULL, the
+// frame must contain exactly 'size' bytes of data. If not, it can contain up to
+// 'size' bytes and the actual number is returned in 'len'
+//
+static status_t frame_read( protocol_t *link, uint8_t *data, uint16_t size, uint16_t *len, unsigned int timeout )
+{
+    size_t total;
+    uint16_t frame_len, crc;
+
+    if ( FAILURE == receive( link, frame_complete, NULL, timeout, &total ) )
+    {
+        return FAILURE;
+    }
+
+    // Discard anything before the start of the frame
+    consume( link, (uint8_t *) memchr( link->rec_buf, FRAME_START, link->rec_len ) - link->rec_buf );
+    total = frame_complete( link->rec_buf, link->rec_len, NULL );
+
+    frame_len = link->rec_buf[1] | ( link->rec_buf[2] << 8 );
+
+    if ( total < 3 || total != frame_len + FRAME_OVERHEAD - 1 )
+    {
+        return receive_failure( link, "\nError: Bad programmer response.\n" );
+    }
+
+    crc = link->rec_buf[total - 2] | ( link->rec_buf[total - 1] << 8 );
+
+    if ( frame_len == 0 || crc != protocol_crc16( 0xFFFF, &link->rec_buf[1], total - 3 ) )
+    {
+        return receive_failure( link, "\nError: Bad programmer response.\n" );
+    }
+
+    if ( link->rec_buf[3] != 'R' )
+    {
+        consume( link, total );
+        return receive_failure( link, "\nError: Programmer returned an error.\n" );
+    }
+
+    if ( ( NULL == len && frame_len - 1 != size ) || frame_len - 1 > size )
+    {
+        return receive_failure( link, "\nError: Bad programmer response.\n" );
+    }
+
+    if ( NULL != len )
+    {
+        *len = frame_len - 1;
+    }
+
+    memcpy( data, &link->rec_buf[4], frame_len - 1 );
+    consume( link, total );
+
+    return SUCCESS;
+}
+
+static status_t frame_receive( protocol_t *link, uint8_t *data, uint16_t size, uint16_t *len, unsigned int timeout )
+{
+    status_t status = frame_read( link, data, size, len, timeout );
+
+    return stats_response( link->stats, status, link->rec_len > 0 );
+}
+
+static bool is_line( const uint8_t *line, size_t len, const char *expected )
+{
+    return len == 3 && ! memcmp( line, expected, 3 );
+}
+
+// Completion for receive(): an ascii response, an optional data line followed by the
+// status line. An error never has data, but "E" is valid data too, so it is an error
+// only if not followed by "R". A lone "E" completes only if 'arg' points to true
+//
+static size_t ascii_complete( const uint8_t *buffer, size_t len, const void *arg )
+{
+    const uint8_t *end;
+    size_t len1, len2;
+
+    if ( NULL == ( end = memchr( buffer, '\n', len ) ) )
+    {
+        return 0;
+    }
+    len1 = end - buffer + 1;
+
+    if ( is_line( buffer, len1, "R\r\n" ) )
+    {
+        return len1;
+    }
+
+    if ( NULL == ( end = memchr( &buffer[len1], '\n', len - len1 ) ) )
+    {
+        return ( *(const bool *) arg && is_line( buffer, len1, "E\r\n" ) ) ? len1 : 0;
+    }
+    len2 = end - &buffer[len1] + 1;
+
+    if ( ! is_line( &buffer[len1], len2, "R\r\n" ) && is_line( buffer, len1, "E\r\n" ) )
+    {
+        // An error, followed by the next response
+        return len1;
+    }
+
+    return len1 + len2;
+}
+
+// Waits for an ascii response and moves it to resp_buf
+//
+static status_t ascii_read( protocol_t *link, unsigned int timeout )
+{
+    const bool lone_error = true, strict = false;
+    size_t len;
+
+    if ( FAILURE == receive( link, ascii_complete, &lone_error, timeout, &len ) )
+    {
+        return FAILURE;
+    }
+
+    // If it is an "E" with nothing after it, give a data line some time to get its "R"
+    if ( len == link->rec_len && is_line( link->rec_buf, len, "E\r\n" )
+        && FAILURE == port_read_until( link, ascii_complete, &strict, serial_deadline( ERROR_GRACE ), &len ) )
+    {
+        return FAILURE;
+    }
+
+    if ( 0 == len )
+    {
+        len = ascii_complete( link->rec_buf, link->rec_len, &lone_error );
+    }
+
+    memcpy( link->resp_buf, link->rec_buf, len );
+    link->resp_buf[len] = '\0';
+    consume( link, len );
+
+    if ( ! strcmp( link->resp_buf, "E\r\n" ) )
+    {
+        protocol_report( link, "\nError: Programmer returned an error.\n" );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+static status_t ascii_receive( protocol_t *link, unsigned int timeout )
+{
+    status_t status = ascii_read( link, timeout );
+
+    return stats_response( link->stats, status, link->rec_len > 0 );
+}
+
+// Sends an ascii command
+//
+static status_t ascii_send( protocol_t *link, const char *command )
+{
+    stats_request( link->stats, command[0] );
+
+    return port_write( link, (const uint8_t *) command, strlen( command ) );
+}
+
+// Discards any input until the line is quiet. Flush does not work for USB adapters
+//
+static status_t drain( protocol_t *link )
+{
+    ssize_t got;
+
+    link->rec_len = 0;
+
+    do
+    {
+        if ( FAILURE == port_read( link, link->rec_buf, sizeof( link->rec_buf ), &got, QUIET_TIME ) )
+        {
+            return FAILURE;
+        }
+    }
+    while ( got > 0 );
+
+    return SUCCESS;
+}
+
+// Waits up to 'timeout' ms for the next response and tells in 'found' if it is the
+// version one. Anything before it, like bootloader noise, is skipped
+//
+static status_t version_receive( protocol_t *link, uint8_t *version, unsigned int timeout, bool *found )
+{
+    const size_t expected = sizeof( "V010100\r\nR\r\n" ) - 1;
+    size_t len;
+    char stat;
+
+    *found = false;
+
+    if ( FAILURE == port_read_until( link, serial_until_terminator, "R\r\n", serial_deadline( timeout ), &len ) )
+    {
+        return FAILURE;
+    }
+
+    if ( len >= expected )
+    {
+        memcpy( link->resp_buf, &link->rec_buf[len - expected], expected );
+        link->resp_buf[expected] = '\0';
+
+        *found = 4 == sscanf( link->resp_buf, "V%2hhu%2hhu%2hhu\r\n%c", &version[0], &version[1], &version[2], &stat )
+                 && stat == 'R';
+    }
+
+    consume( link, len );
+
+    // Not finding it is not an error, the caller asks again
+    stats_response( link->stats, *found ? SUCCESS : FAILURE, link->rec_len > 0 );
+
+    return SUCCESS;
+}
+
+status_t protocol_version( protocol_t *link, uint8_t *version )
+{
+    bool found;
+
+    link->rec_len = 0;
+
+    // After the reset caused by opening the port, the firmware sends the version
+    // response as a ready banner. Older versions just send "R"
+    if ( FAILURE == version_receive( link, version, BOOT_TIMEOUT, &found ) )
+    {
+        return FAILURE;
+    }
+
+    // No reset, or an older firmware. Get rid of anything stale and ask for it
+    for ( int tries = 0; ! found && tries < VERSION_TRIES; ++tries )
+    {
+        if ( tries )
+        {
+            stats_retry( link->stats, "version" );
+        }
+
+        if ( FAILURE == drain( link ) )
+        {
+            return FAILURE;
+        }
+
+        stats_request( link->stats, 'V' );
+
+        if ( FAILURE == port_write( link, (const uint8_t *) "V", 1 )
+            || FAILURE == version_receive( link, version, VERSION_TIMEOUT, &found ) )
+        {
+            return FAILURE;
+        }
+
+        // The answer to a previous try may still come
+        if ( found && tries && FAILURE == drain( link ) )
+        {
+            return FAILURE;
+        }
+    }
+
+    return found ? SUCCESS : FAILURE;
+}
+
+status_t protocol_negotiate( protocol_t *link, const uint8_t *version, bool ascii )
+{
+    char expected[sizeof( "V255255255" )];      // Room for any values
+    uint8_t received[7];
+
+    if ( version[0] < BINARY_MAJOR || ( version[0] == BINARY_MAJOR && version[1] < BINARY_MINOR ) )
+    {
+        // Older firmware, stay with the ascii protocol and single byte commands
+        return SUCCESS;
+    }
+
+    link->blocks = true;
+
+    if ( ascii )
+    {
+        return SUCCESS;
+    }
+
+    snprintf( expected, sizeof( expected ), "V%02u%02u%02u", version[0], version[1], version[2] );
+
+    if ( FAILURE == frame_send( link, 'V', NULL, 0 ) )
+    {
+        return FAILURE;
+    }
+
+    if ( SUCCESS == frame_receive( link, received, sizeof( received ), NULL, RESPONSE_TIMEOUT )
+        && ! memcmp( expected, received, sizeof( received ) ) )
+    {
+        link->binary = true;
+    }
+    else
+    {
+        protocol_report( link, "Warning: Could not negotiate the binary protocol, using ascii.\n" );
+    }
+
+    return SUCCESS;
+}
+
+bool protocol_is_binary( const protocol_t *link )
+{
+    return link->binary;
+}
+
+bool protocol_has_blocks( const protocol_t *link )
+{
+    return link->blocks;
+}
+
+// Anything queued goes at the old speed
+//
+static status_t set_speed( protocol_t *link, uint32_t baud )
+{
+    char error[SERIAL_ERROR_SIZE];
+
+    if ( FAILURE == pump_sync( &link->pump ) )
+    {
+        return port_failure( link );
+    }
+
+    if ( FAILURE == serial_set_speed( link->fd, link->device, baud, error ) )
+    {
+        protocol_report( link, "%s", error );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Tries a baud rate from the programmer's list. If the test pattern does not come back
+// intact at the new speed, both sides go back to the default one
+//
+static status_t try_baud( protocol_t *link, uint8_t index, uint32_t baud )
+{
+    uint8_t params[2 + BAUD_TEST_SIZE] = { BAUD_TEST_SIZE, 0 };
+    uint8_t echo[BAUD_TEST_SIZE];
+    status_t status;
+
+    if ( FAILURE == frame_send( link, 'B', &index, 1 )
+        || FAILURE == frame_receive( link, echo, 0, NULL, RESPONSE_TIMEOUT )
+        || FAILURE == set_speed( link, baud ) )
+    {
+        return FAILURE;
+    }
+
+    // Bit patterns that are easily corrupted by a wrong speed
+    for ( int i = 0; i < BAUD_TEST_SIZE; ++i )
+    {
+        params[2 + i] = ( i & 1 ) ? 0x55 : ~i;
+    }
+
+    link->probing = true;
+    status = frame_send( link, 'T', params, sizeof( params ) );
+    if ( SUCCESS == status )
+    {
+        status = frame_receive( link, echo, sizeof( echo ), NULL, BAUD_TIMEOUT );
+    }
+    link->probing = false;
+
+    if ( SUCCESS == status && ! memcmp( echo, &params[2], sizeof( echo ) ) )
+    {
+        return SUCCESS;
+    }
+
+    // Wait for the programmer to give up and any garbage to arrive
+    if ( SUCCESS == set_speed( link, SERIAL_DEFAULT_BAUD ) )
+    {
+        usleep( 2 * BAUD_TIMEOUT * 1000 );
+        pump_flush_input( &link->pump );
+        link->rec_len = 0;
+    }
+
+    return FAILURE;
+}
+
+status_t protocol_baud( protocol_t *link, uint32_t max_baud, uint32_t *baud )
+{
+    uint8_t rates[MAX_BAUD_RATES * 4];
+    uint16_t len;
+
+    *baud = SERIAL_DEFAULT_BAUD;
+
+    // Only for the binary protocol, ascii is for debugging with a serial monitor
+    if ( ! link->binary || max_baud <= SERIAL_DEFAULT_BAUD )
+    {
+        return SUCCESS;
+    }
+
+    if ( FAILURE == frame_send( link, 'b', NULL, 0 )
+        || FAILURE == frame_receive( link, rates, sizeof( rates ), &len, RESPONSE_TIMEOUT ) )
+    {
+        return FAILURE;
+    }
+
+    // Fastest first
+    for ( int i = 0; i < len / 4; ++i )
+    {
+        uint32_t rate = rates[i*4] | ( rates[i*4+1] << 8 ) | ( rates[i*4+2] << 16 ) | ( (uint32_t) rates[i*4+3] << 24 );
+
+        if ( rate == SERIAL_DEFAULT_BAUD )
+        {
+            link->default_baud_index = i;
+        }
+    }
+
+    for ( int i = 0; i < link->default_baud_index; ++i )
+    {
+        uint32_t rate = rates[i*4] | ( rates[i*4+1] << 8 ) | ( rates[i*4+2] << 16 ) | ( (uint32_t) rates[i*4+3] << 24 );
+
+        if ( rate > max_baud || ! serial_speed_supported( rate ) )
+        {
+            continue;
+        }
+
+        if ( SUCCESS == try_baud( link, i, rate ) )
+        {
+            link->current_baud = *baud = rate;
+            break;
+        }
+
+        protocol_report( link, "Warning: Link test at %u baud failed.\n", rate );
+        stats_retry( link->stats, "baud" );
+    }
+
+    return SUCCESS;
+}
+
+// Leaves the programmer at the default speed, in case it is not reset when the port
+// is opened again
+//
+status_t protocol_close( protocol_t *link )
+{
+    uint8_t unused;
+
+    if ( link->current_baud == SERIAL_DEFAULT_BAUD )
+    {
+        return SUCCESS;
+    }
+
+    link->current_baud = SERIAL_DEFAULT_BAUD;
+
+    // It will wait for a test frame at the new speed, and stay there when it does not come
+    if ( FAILURE == frame_send( link, 'B', &link->default_baud_index, 1 )
+        || FAILURE == frame_receive( link, &unused, 0, NULL, RESPONSE_TIMEOUT ) )
+    {
+        return FAILURE;
+    }
+
+    return set_speed( link, SERIAL_DEFAULT_BAUD );
+}
+
+status_t protocol_pulse_mode( protocol_t *link, pulse_mode_t mode )
+{
+    uint8_t param = mode;
+
+    if ( link->binary )
+    {
+        if ( FAILURE == frame_send( link, 'P', &param, 1 )
+            || FAILURE == frame_receive( link, &param, 0, NULL, RESPONSE_TIMEOUT ) )
+        {
+            return FAILURE;
+        }
+    }
+    else
+    {
+        sprintf( (char *) link->tx_buf, "P %x\n", param );
+
+        if ( FAILURE == ascii_send( link, (char *) link->tx_buf )
+            || FAILURE == ascii_receive( link, RESPONSE_TIMEOUT ) )
+        {
+            return FAILURE;
+        }
+
+        if ( strcmp( link->resp_buf, "R\r\n" ) )
+        {
+            protocol_report( link, "Error setting the pulse mode. Bad programmer response.\n" );
+            return FAILURE;
+        }
+    }
+
+    // Block commands take longer with adaptive pulses
+    link->pulse_mode = mode;
+
+    return SUCCESS;
+}
+
+pulse_mode_t protocol_get_pulse_mode( const protocol_t *link )
+{
+    return link->pulse_mode;
+}
+
+// Gets and clears the programmer counters. Older firmware does not have them, so an
+// error response is not reported
+//
+status_t protocol_stats( protocol_t *link, programmer_stats_t *stats )
+{
+    uint32_t *counters[] = { &stats->commands, &stats->errors, &stats->bytes_read,
+                             &stats->pulses, &stats->pulse_time, &stats->verify_failures };
+    uint8_t data[sizeof( counters ) / sizeof( counters[0] ) * 4];
+    status_t status;
+
+    link->probing = true;
+    if ( link->binary )
+    {
+        status = frame_send( link, 'Q', NULL, 0 );
+        if ( SUCCESS == status )
+        {
+            status = frame_receive( link, data, sizeof( data ), NULL, RESPONSE_TIMEOUT );
+        }
+    }
+    else
+    {
+        status = ascii_send( link, "Q\n" );
+        if ( SUCCESS == status )
+        {
+            status = ascii_receive( link, RESPONSE_TIMEOUT );
+        }
+    }
+    link->probing = false;
+
+    if ( FAILURE == status )
+    {
+        return FAILURE;
+    }
+
+    if ( ! link->binary )
+    {
+        // 2 digits per byte, plus '\r\n', plus 'R', plus '\r\n'
+        if ( strlen( link->resp_buf ) != sizeof( data ) * 2 + 5 || strcmp( &link->resp_buf[sizeof( data ) * 2], "\r\nR\r\n" ) )
+        {
+            protocol_report( link, "\nError: Bad programmer response.\n" );
+            return FAILURE;
+        }
+
+        for ( size_t i = 0; i < sizeof( data ); ++i )
+        {
+            if ( EINVAL == get_hexbyte( &link->resp_buf[i*2], &data[i] ) )
+            {
+                protocol_report( link, "\nError: Bad programmer response.\n" );
+                return FAILURE;
+            }
+        }
+    }
+
+    for ( size_t i = 0; i < sizeof( counters ) / sizeof( counters[0] ); ++i )
+    {
+        const uint8_t *value = &data[i * 4];
+
+        *counters[i] = value[0] | ( value[1] << 8 ) | ( value[2] << 16 ) | ( (uint32_t) value[3] << 24 );
+    }
+
+    return SUCCESS;
+}
+
+status_t protocol_blank( protocol_t *link, uint8_t chip, uint16_t *end )
+{
+    uint8_t ret_stat;
+
+    if ( link->binary )
+    {
+        uint8_t data[2];
+
+        if ( FAILURE == frame_send( link, 'K', &chip, 1 )
+            || FAILURE == frame_receive( link, data, sizeof( data ), NULL, RESPONSE_TIMEOUT ) )
+        {
+            return FAILURE;
+        }
+        *end = data[0] | ( data[1] << 8 );
+
+        return SUCCESS;
+    }
+
+    sprintf( (char *) link->tx_buf, "K %x\n", chip );
+
+    if ( FAILURE == ascii_send( link, (char *) link->tx_buf )
+        || FAILURE == ascii_receive( link, RESPONSE_TIMEOUT ) )
+    {
+        return FAILURE;
+    }
+
+    if ( 2 != sscanf( link->resp_buf, "%hx\r\n%c\r\n", end, &ret_stat ) || ret_stat != 'R' )
+    {
+        protocol_report( link, "Error executing blank test. Bad programmer response.\n" );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Gets the occupancy index of the chip, or the one kept from the last time. Older
+// firmware does not have the command, so an error response is not reported
+//
+status_t protocol_map( protocol_t *link, uint8_t chip, uint16_t size, const fuse_map_t **map )
+{
+    uint8_t data[MAX_BLOCK / 8 + 16];
+    uint16_t len = size / 8 + 16;
+    status_t status;
+
+    if ( link->map_valid && link->map.chip == chip )
+    {
+        *map = &link->map;
+        return SUCCESS;
+    }
+
+    link->probing = true;
+    if ( link->binary )
+    {
+        status = frame_send( link, 'M', &chip, 1 );
+        if ( SUCCESS == status )
+        {
+            status = frame_receive( link, data, len, NULL, RESPONSE_TIMEOUT );
+        }
+    }
+    else
+    {
+        sprintf( (char *) link->tx_buf, "M %x\n", chip );
+        status = ascii_send( link, (char *) link->tx_buf );
+        if ( SUCCESS == status )
+        {
+            status = ascii_receive( link, RESPONSE_TIMEOUT );
+        }
+    }
+    link->probing = false;
+
+    if ( FAILURE == status )
+    {
+        return FAILURE;
+    }
+
+    if ( ! link->binary )
+    {
+        // 2 digits per byte, plus '\r\n', plus 'R', plus '\r\n'
+        if ( strlen( link->resp_buf ) != len * 2 + 5 || strcmp( &link->resp_buf[len * 2], "\r\nR\r\n" ) )
+        {
+            protocol_report( link, "\nError: Bad programmer response.\n" );
+            return FAILURE;
+        }
+
+        for ( uint16_t i = 0; i < len; ++i )
+        {
+            if ( EINVAL == get_hexbyte( &link->resp_buf[i*2], &data[i] ) )
+            {
+                protocol_report( link, "\nError: Bad programmer response.\n" );
+                return FAILURE;
+            }
+        }
+    }
+
+    memset( &link->map, 0, sizeof( fuse_map_t ) );
+    link->map.chip = chip;
+    link->map.size = size;
+    memcpy( link->map.used, data, size / 8 );
+
+    for ( uint16_t i = 0; i < size / 8; ++i )
+    {
+        link->map.bytes += __builtin_popcount( data[i] );
+    }
+
+    for ( int line = 0; line < 8; ++line )
+    {
+        link->map.lines[line] = data[size / 8 + line * 2] | ( data[size / 8 + line * 2 + 1] << 8 );
+    }
+
+    link->map_valid = true;
+    *map = &link->map;
+
+    return SUCCESS;
+}
+
+// Drops the occupancy index, for when the chip may have been changed
+//
+void protocol_forget( protocol_t *link )
+{
+    link->map_valid = false;
+}
+
+bool protocol_map_used( const fuse_map_t *map, uint16_t address )
+{
+    return map->used[address / 8] & ( 1 << ( address % 8 ) );
+}
+
+// First byte that is not zero in the range, or the end of it
+//
+uint16_t protocol_map_first( const fuse_map_t *map, uint16_t address, uint16_t count )
+{
+    uint16_t end = address + count;
+
+    while ( address < end && ! protocol_map_used( map, address ) )
+    {
+        ++address;
+    }
+
+    return address;
+}
+
+// Decodes the data of a read response as it arrives and passes it to 'fn', so only
+// the undecoded part is kept in rec_buf. The frame CRC is checked at the end
+//
+static status_t stream_read( protocol_t *link, uint16_t count, protocol_data_fn_t fn, void *arg, unsigned int timeout )
+{
+    uint8_t data[PROTOCOL_REC_SIZE / 2];
+    uint64_t deadline = serial_deadline( timeout ), now;
+    uint16_t done = 0, crc = 0xFFFF, n;
+    bool started = ! link->binary;
+    const uint8_t *start;
+    ssize_t got;
+
+    for ( ;; )
+    {
+        if ( ! started && NULL != ( start = memchr( link->rec_buf, FRAME_START, link->rec_len ) ) )
+        {
+            // Discard anything before the start of the frame
+            consume( link, start - link->rec_buf );
+        }
+
+        if ( ! started && link->rec_len >= 4 && link->rec_buf[0] == FRAME_START )
+        {
+            if ( link->rec_buf[3] != 'R' )
+            {
+                return receive_failure( link, "\nError: Programmer returned an error.\n" );
+            }
+            if ( ( link->rec_buf[1] | ( link->rec_buf[2] << 8 ) ) != count + 1 )
+            {
+                return receive_failure( link, "\nError: Bad programmer response.\n" );
+            }
+            crc = protocol_crc16( crc, &link->rec_buf[1], 3 );
+            consume( link, 4 );
+            started = true;
+        }
+
+        if ( started && ! link->binary && done == 0 && link->rec_len >= 2 && link->rec_buf[0] == 'E' && link->rec_buf[1] == '\r' )
+        {
+            return receive_failure( link, "\nError: Programmer returned an error.\n" );
+        }
+
+        if ( started && done < count )
+        {
+            if ( link->binary )
+            {
+                n = ( link->rec_len < count - done ) ? link->rec_len : count - done;
+                memcpy( data, link->rec_buf, n );
+                crc = protocol_crc16( crc, data, n );
+                consume( link, n );
+            }
+            else
+            {
+                n = ( link->rec_len / 2 < count - done ) ? link->rec_len / 2 : count - done;
+                for ( uint16_t i = 0; i < n; ++i )
+                {
+                    if ( EINVAL == get_hexbyte( (char *) &link->rec_buf[i * 2], &data[i] ) )
+                    {
+                        return receive_failure( link, "\nError reading from prom. Bad programmer response.\n" );
+                    }
+                }
+                consume( link, n * 2 );
+            }
+
+            if ( n && FAILURE == fn( data, n, arg ) )
+            {
+                return FAILURE;
+            }
+            done += n;
+        }
+
+        if ( done == count && link->binary && link->rec_len >= 2 )
+        {
+            if ( ( link->rec_buf[0] | ( link->rec_buf[1] << 8 ) ) != crc )
+            {
+                return receive_failure( link, "\nError: Bad programmer response.\n" );
+            }
+            consume( link, 2 );
+            return SUCCESS;
+        }
+
+        if ( done == count && ! link->binary && link->rec_len >= 5 )
+        {
+            if ( memcmp( link->rec_buf, "\r\nR\r\n", 5 ) )
+            {
+                return receive_failure( link, "\nError reading from prom. Bad programmer response.\n" );
+            }
+            consume( link, 5 );
+            return SUCCESS;
+        }
+
+        now = serial_deadline( 0 );
+
+        if ( now >= deadline || link->rec_len == sizeof( link->rec_buf ) )
+        {
+            return receive_failure( link, ( link->rec_len == sizeof( link->rec_buf ) ) ? "\nError: Bad programmer response.\n"
+                                                                           : "\nError: No response from programmer at port %s.\n" );
+        }
+
+        if ( FAILURE == port_read( link, &link->rec_buf[link->rec_len], sizeof( link->rec_buf ) - link->rec_len, &got, deadline - now ) )
+        {
+            return FAILURE;
+        }
+        link->rec_len += got;
+    }
+}
+
+static status_t stream_receive( protocol_t *link, uint16_t count, protocol_data_fn_t fn, void *arg, unsigned int timeout )
+{
+    status_t status = stream_read( link, count, fn, arg, timeout );
+
+    return stats_response( link->stats, status, link->rec_len > 0 );
+}
+
+// Reads 'count' bytes from 'address', passing them to 'fn' as they arrive
+//
+status_t protocol_stream( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count, protocol_data_fn_t fn, void *arg )
+{
+    if ( link->binary )
+    {
+        uint8_t params[5] = { chip, address & 0xFF, address >> 8, count & 0xFF, count >> 8 };
+
+        if ( FAILURE == frame_send( link, 'r', params, sizeof( params ) ) )
+        {
+            return FAILURE;
+        }
+    }
+    else
+    {
+        sprintf( (char *) link->tx_buf, "r %x %x %x\n", chip, address, count );
+
+        if ( FAILURE == ascii_send( link, (char *) link->tx_buf ) )
+        {
+            return FAILURE;
+        }
+    }
+
+    return stream_receive( link, count, fn, arg, RESPONSE_TIMEOUT );
+}
+
+static status_t copy_data( const uint8_t *data, size_t len, void *arg )
+{
+    uint8_t **next = arg;
+
+    memcpy( *next, data, len );
+    *next += len;
+
+    return SUCCESS;
+}
+
+status_t protocol_read( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data )
+{
+    return protocol_stream( link, chip, address, count, copy_data, &data );
+}
+
+// Reads the whole chip with a single command. Only with the binary protocol, in ascii
+// it is just a read of all of it
+//
+status_t protocol_dump( protocol_t *link, uint8_t chip, uint16_t size, uint8_t *data )
+{
+    if ( ! link->binary )
+    {
+        return protocol_read( link, chip, 0, size, data );
+    }
+
+    if ( FAILURE == frame_send( link, 'R', &chip, 1 ) )
+    {
+        return FAILURE;
+    }
+
+    return frame_receive( link, data, size, NULL, RESPONSE_TIMEOUT );
+}
+
+// CRC-32 of a range of the chip, computed by the programmer
+//
+status_t protocol_digest( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count, uint32_t *crc )
+{
+    uint8_t ret_stat;
+
+    if ( link->binary )
+    {
+        uint8_t params[5] = { chip, address & 0xFF, address >> 8, count & 0xFF, count >> 8 };
+        uint8_t data[4];
+
+        if ( FAILURE == frame_send( link, 'H', params, sizeof( params ) )
+            || FAILURE == frame_receive( link, data, sizeof( data ), NULL, RESPONSE_TIMEOUT ) )
+        {
+            return FAILURE;
+        }
+        *crc = data[0] | ( data[1] << 8 ) | ( data[2] << 16 ) | ( (uint32_t) data[3] << 24 );
+
+        return SUCCESS;
+    }
+
+    sprintf( (char *) link->tx_buf, "H %x %x %x\n", chip, address, count );
+
+    if ( FAILURE == ascii_send( link, (char *) link->tx_buf )
+        || FAILURE == ascii_receive( link, RESPONSE_TIMEOUT ) )
+    {
+        return FAILURE;
+    }
+
+    if ( 2 != sscanf( link->resp_buf, "%x\r\n%c\r\n", crc, &ret_stat ) || ret_stat != 'R' )
+    {
+        protocol_report( link, "\nError computing the CRC. Bad programmer response.\n" );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Single byte commands: 'r'ead, 'w'rite and 's'imulate. The response can be received
+// later, so several commands can be in flight
+//
+status_t protocol_byte_send( protocol_t *link, char command, uint8_t chip, uint16_t address, uint8_t value )
+{
+    if ( command == 'w' )
+    {
+        link->map_valid = false;
+    }
+
+    if ( link->binary )
+    {
+        // Read count or value to write
+        uint8_t params[5] = { chip, address & 0xFF, address >> 8, ( command == 'r' ) ? 1 : value, 0 };
+
+        return frame_send( link, command, params, ( command == 'r' ) ? 5 : 4 );
+    }
+
+    if ( command == 'r' )
+    {
+        sprintf( (char *) link->tx_buf, "r %x %x 1\n", chip, address );
+    }
+    else
+    {
+        sprintf( (char *) link->tx_buf, "%c %x %x %x\n", command, chip, address, value );
+    }
+
+    return ascii_send( link, (char *) link->tx_buf );
+}
+
+status_t protocol_byte_receive( protocol_t *link, uint8_t *ret_val )
+{
+    uint8_t ret_stat;
+
+    if ( link->binary )
+    {
+        return frame_receive( link, ret_val, 1, NULL, RESPONSE_TIMEOUT );
+    }
+
+    if ( FAILURE == ascii_receive( link, RESPONSE_TIMEOUT ) )
+    {
+        return FAILURE;
+    }
+
+    if ( 2 != sscanf( link->resp_buf, "%hhx\r\n%c\r\n", ret_val, &ret_stat ) || ret_stat != 'R' )
+    {
+        protocol_report( link, "\nError: Bad programmer response.\n" );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Sends a command with a data block, and receives a variable length response of up
+// to 'size' bytes
+//
+static status_t block_command( protocol_t *link, char command, uint8_t chip, uint16_t address, uint16_t count,
+                               const uint8_t *data, uint8_t *results, uint16_t size, uint16_t *len, unsigned int timeout )
+{
+    size_t received;
+    uint8_t ret_stat;
+    int tx_len;
+
+    if ( link->binary )
+    {
+        uint8_t params[5 + MAX_BLOCK] = { chip, address & 0xFF, address >> 8, count & 0xFF, count >> 8 };
+
+        memcpy( &params[5], data, count );
+
+        if ( FAILURE == frame_send( link, command, params, 5 + count ) )
+        {
+            return FAILURE;
+        }
+
+        return frame_receive( link, results, size, len, timeout );
+    }
+
+    tx_len = sprintf( (char *) link->tx_buf, "%c %x %x %x ", command, chip, address, count );
+
+    for ( int i = 0; i < count; ++i )
+    {
+        tx_len += sprintf( (char *) &link->tx_buf[tx_len], "%2.2X", data[i] );
+    }
+    link->tx_buf[tx_len++] = '\n';
+
+    stats_request( link->stats, command );
+
+    if ( FAILURE == port_write( link, link->tx_buf, tx_len )
+        || FAILURE == ascii_receive( link, timeout ) )
+    {
+        return FAILURE;
+    }
+
+    received = strlen( link->resp_buf );
+
+    // Expected 2 digits per byte, plus '\r\n', plus 'R', plus '\r\n'
+    if ( received < 5 || ( received - 5 ) % 2 || ( received - 5 ) / 2 > size
+        || 1 != sscanf( &link->resp_buf[received - 5], "\r\n%c\r\n", &ret_stat ) || ret_stat != 'R' )
+    {
+        protocol_report( link, "\nError: Bad programmer response.\n" );
+        return FAILURE;
+    }
+
+    *len = ( received - 5 ) / 2;
+
+    for ( int i = 0; i < *len; ++i )
+    {
+        if ( EINVAL == get_hexbyte( &link->resp_buf[i*2], &results[i] ) )
+        {
+            protocol_report( link, "\nError: Bad programmer response.\n" );
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+// Block version of 'w'rite and 's'imulate. The programmer returns the values read after
+// programming each byte, up to the first one that failed
+//
+status_t protocol_block( protocol_t *link, char command, uint8_t chip, uint16_t address, uint16_t count,
+                         const uint8_t *data, uint8_t *results, uint16_t *done )
+{
+    unsigned int timeout = RESPONSE_TIMEOUT + count * ( ( PULSE_ADAPTIVE == link->pulse_mode ) ? ADAPTIVE_BYTE_TIME : FIXED_BYTE_TIME );
+
+    if ( command == 'w' )
+    {
+        link->map_valid = false;
+    }
+
+    return block_command( link, ( command == 'w' ) ? 'W' : 'S', chip, address, count,
+                          data, results, count, done, timeout );
+}
+
+// Uploads a block for the programmer to compare it with the chip. It returns a
+// bitmap of the bytes that differ, 'mismatches', and their values, in 'values'
+//
+status_t protocol_compare( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count,
+                           const uint8_t *data, uint8_t *mismatches, uint8_t *values )
+{
+    uint8_t response[MAX_BLOCK / 8 + MAX_BLOCK];
+    uint16_t bitmap_size = ( count + 7 ) / 8;
+    uint16_t len, differ = 0;
+
+    if ( FAILURE == block_command( link, 'c', chip, address, count,
+                                   data, response, bitmap_size + count, &len, RESPONSE_TIMEOUT ) )
+    {
+        return FAILURE;
+    }
+
+    for ( int i = 0; i < count; ++i )
+    {
+        if ( response[i / 8] & ( 1 << ( i % 8 ) ) )
+        {
+            ++differ;
+        }
+    }
+
+    if ( len != bitmap_size + differ )
+    {
+        protocol_report( link, "\nError: Bad programmer response.\n" );
+        return FAILURE;
+    }
+
+    memcpy( mismatches, response, bitmap_size );
+    memcpy( values, &response[bitmap_size], differ );
+
+    return SUCCESS;
+}
+
+// Asks the programmer if the chip can take the block, without programming it
+//
+status_t protocol_check( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count,
+                         const uint8_t *data, check_t *check )
+{
+    uint8_t response[10];
+    uint16_t len;
+
+    if ( FAILURE == block_command( link, 'C', chip, address, count,
+                                   data, response, sizeof( response ), &len, RESPONSE_TIMEOUT ) )
+    {
+        return FAILURE;
+    }
+
+    if ( len != sizeof( response ) )
+    {
+        protocol_report( link, "\nError: Bad programmer response.\n" );
+        return FAILURE;
+    }
+
+    check->correct    = response[0] | ( response[1] << 8 );
+    check->program    = response[2] | ( response[3] << 8 );
+    check->bits       = response[4] | ( response[5] << 8 );
+    check->impossible = response[6] | ( response[7] << 8 );
+    check->first      = response[8] | ( response[9] << 8 );
+
+    return SUCCESS;
+}
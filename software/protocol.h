@@ -0,0 +1,137 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Programmer wire protocol
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "globals.h"
+#include "pump.h"
+
+#define FRAME_START     0x02        // STX
+#define FRAME_OVERHEAD  6           // STX + length + command/status + CRC
+#define MAX_BLOCK       512         // Max data bytes of a block command, the largest chip size
+
+#define PROTOCOL_REC_SIZE   4096
+#define PROTOCOL_TX_SIZE    ( 16 + 2 * MAX_BLOCK )  // Enough for the largest command, an ascii block write
+
+typedef enum { PULSE_FIXED = 0, PULSE_ADAPTIVE } pulse_mode_t;
+
+// Receives read data as it arrives, in order
+typedef status_t (*protocol_data_fn_t)( const uint8_t *data, size_t len, void *arg );
+
+// Result of checking if a block can be programmed on the chip
+typedef struct {
+    uint16_t correct;           // Bytes that already have their value
+    uint16_t program;           // Bytes that need programming
+    uint16_t bits;              // Bits to program
+    uint16_t impossible;        // Bytes with programmed bits that are not in the data
+    uint16_t first;             // Address of the first of them, or the end of the block
+} check_t;
+
+// Occupancy index of a whole chip, from a single read by the programmer
+typedef struct {
+    uint8_t chip;
+    uint16_t size;              // Chip size. 'used' has a bit for each byte
+    uint16_t bytes;             // Bytes that are not zero
+    uint8_t used[MAX_BLOCK / 8];    // Bit set if the byte is not zero, address 0 in bit 0 of used[0]
+    uint16_t lines[8];          // Programmed bits of each output, D0 first
+} fuse_map_t;
+
+// Counters kept by the programmer since the last query
+typedef struct {
+    uint32_t commands;          // Answered with success
+    uint32_t errors;            // Answered with an error
+    uint32_t bytes_read;        // Chip bytes read by the read, blank, CRC, compare and check commands
+    uint32_t pulses;            // Programming pulses
+    uint32_t pulse_time;        // In us, total time at 10.5V
+    uint32_t verify_failures;   // Pulses that did not program the bit
+} programmer_stats_t;
+
+// A connection to a programmer, with everything the protocol knows about it, so a
+// process can drive several of them
+typedef struct protocol_s {
+    int fd;
+    char *device;
+    bool binary;
+    bool blocks;
+    bool probing;                   // Errors are expected, don't report them
+    bool quiet;                     // Don't print errors, just keep the last one
+    char error[128];
+    uint32_t current_baud;
+    pulse_mode_t pulse_mode;
+    uint8_t default_baud_index;     // Position of the default speed in the programmer's list
+    uint8_t rec_buf[PROTOCOL_REC_SIZE]; // Received data. With several commands in flight, it
+    size_t rec_len;                     // can hold the start of the next response
+    char resp_buf[PROTOCOL_REC_SIZE];   // Last ascii response, as a string
+    uint8_t tx_buf[PROTOCOL_TX_SIZE];
+    pump_t pump;                    // The port I/O threads, from protocol_attach()
+    fuse_map_t map;                 // Last occupancy index, if 'map_valid'. Dropped when
+    bool map_valid;                 // anything is programmed or by protocol_forget()
+    struct stats_s *stats;          // Timing of the requests, NULL if not kept
+} protocol_t;
+
+uint16_t protocol_crc16( uint16_t crc, const uint8_t *data, size_t len );
+uint32_t protocol_crc32( uint32_t crc, const uint8_t *data, size_t len );
+
+void protocol_init( protocol_t *link, int fd, char *device );
+status_t protocol_attach( protocol_t *link, int fd );
+void protocol_detach( protocol_t *link );
+void protocol_report( protocol_t *link, const char *format, ... );
+status_t protocol_version( protocol_t *link, uint8_t *version );
+status_t protocol_negotiate( protocol_t *link, const uint8_t *version, bool ascii );
+bool protocol_is_binary( const protocol_t *link );
+bool protocol_has_blocks( const protocol_t *link );
+status_t protocol_baud( protocol_t *link, uint32_t max_baud, uint32_t *baud );
+status_t protocol_close( protocol_t *link );
+status_t protocol_pulse_mode( protocol_t *link, pulse_mode_t mode );
+pulse_mode_t protocol_get_pulse_mode( const protocol_t *link );
+status_t protocol_stats( protocol_t *link, programmer_stats_t *stats );
+status_t protocol_map( protocol_t *link, uint8_t chip, uint16_t size, const fuse_map_t **map );
+void protocol_forget( protocol_t *link );
+bool protocol_map_used( const fuse_map_t *map, uint16_t address );
+uint16_t protocol_map_first( const fuse_map_t *map, uint16_t address, uint16_t count );
+
+status_t protocol_blank( protocol_t *link, uint8_t chip, uint16_t *end );
+status_t protocol_read( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count, uint8_t *data );
+status_t protocol_stream( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count, protocol_data_fn_t fn, void *arg );
+status_t protocol_dump( protocol_t *link, uint8_t chip, uint16_t size, uint8_t *data );
+status_t protocol_digest( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count, uint32_t *crc );
+status_t protocol_byte_send( protocol_t *link, char command, uint8_t chip, uint16_t address, uint8_t value );
+status_t protocol_byte_receive( protocol_t *link, uint8_t *ret_val );
+status_t protocol_block( protocol_t *link, char command, uint8_t chip, uint16_t address, uint16_t count,
+                         const uint8_t *data, uint8_t *results, uint16_t *done );
+status_t protocol_compare( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count,
+                           const uint8_t *data, uint8_t *mismatches, uint8_t *values );
+status_t protocol_check( protocol_t *link, uint8_t chip, uint16_t address, uint16_t count,
+                         const uint8_t *data, check_t *check );
+
+#endif /* PROTOCOL_H */
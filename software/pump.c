@@ -0,0 +1,454 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Serial I/O threads
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <sys/types.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <time.h>
+#include <stdarg.h>
+
+#include "globals.h"
+#include "serial.h"
+#include "stats.h"
+#include "pump.h"
+
+static status_t ring_init( pump_ring_t *ring, uint8_t *data, size_t size )
+{
+    pthread_condattr_t attr;
+
+    ring->data = data;
+    ring->size = size;
+    atomic_init( &ring->head, 0 );
+    atomic_init( &ring->tail, 0 );
+    atomic_init( &ring->waiting, false );
+
+    // Deadlines are on the monotonic clock, as serial_deadline()
+    if ( pthread_condattr_init( &attr )
+        || pthread_condattr_setclock( &attr, CLOCK_MONOTONIC )
+        || pthread_cond_init( &ring->moved, &attr ) )
+    {
+        return FAILURE;
+    }
+    pthread_condattr_destroy( &attr );
+
+    if ( pthread_mutex_init( &ring->lock, NULL ) )
+    {
+        pthread_cond_destroy( &ring->moved );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+static void ring_destroy( pump_ring_t *ring )
+{
+    pthread_mutex_destroy( &ring->lock );
+    pthread_cond_destroy( &ring->moved );
+}
+
+static size_t ring_used( pump_ring_t *ring )
+{
+    return atomic_load( &ring->head ) - atomic_load( &ring->tail );
+}
+
+// Wakes up the other side, if it sleeps. Called after moving an index, the lock is
+// only taken when needed
+//
+static void ring_wake( pump_ring_t *ring )
+{
+    if ( atomic_load( &ring->waiting ) )
+    {
+        pthread_mutex_lock( &ring->lock );
+        pthread_cond_broadcast( &ring->moved );
+        pthread_mutex_unlock( &ring->lock );
+    }
+}
+
+// Sleeps until the ring does not have 'used' bytes anymore, the pump stops or fails,
+// or the ms 'deadline' passes, if not 0. Only one side can be waiting at a time, as
+// the ring can't be both full and empty
+//
+static void ring_sleep( pump_t *pump, pump_ring_t *ring, size_t used, uint64_t deadline )
+{
+    struct timespec until = { .tv_sec = deadline / 1000, .tv_nsec = ( deadline % 1000 ) * 1000000 };
+
+    pthread_mutex_lock( &ring->lock );
+    atomic_store( &ring->waiting, true );
+
+    // Checked after setting 'waiting', so a move either is seen here or wakes us up
+    if ( ring_used( ring ) == used && ! atomic_load( &pump->stop ) && ! atomic_load( &pump->failed ) )
+    {
+        if ( deadline )
+        {
+            pthread_cond_timedwait( &ring->moved, &ring->lock, &until );
+        }
+        else
+        {
+            pthread_cond_wait( &ring->moved, &ring->lock );
+        }
+    }
+
+    atomic_store( &ring->waiting, false );
+    pthread_mutex_unlock( &ring->lock );
+}
+
+// Keeps the reason of a failure for the caller, the threads can't print it
+//
+static status_t pump_error( pump_t *pump, const char *format, ... )
+{
+    va_list args;
+
+    va_start( args, format );
+    vsnprintf( pump->error, sizeof( pump->error ), format, args );
+    va_end( args );
+
+    return FAILURE;
+}
+
+// Wakes up everybody, the threads and the caller, after a stop or a failure
+//
+static void pump_alert( pump_t *pump )
+{
+    pump_ring_t *rings[] = { &pump->rx, &pump->tx };
+
+    for ( int i = 0; i < 2; ++i )
+    {
+        pthread_mutex_lock( &rings[i]->lock );
+        pthread_cond_broadcast( &rings[i]->moved );
+        pthread_mutex_unlock( &rings[i]->lock );
+    }
+}
+
+// Moves whatever arrives at the port to the rx ring, while there is room
+//
+static void *reader( void *arg )
+{
+    pump_t *pump = arg;
+    pump_ring_t *ring = &pump->rx;
+
+    while ( ! atomic_load( &pump->stop ) )
+    {
+        size_t used = ring_used( ring ), head = atomic_load( &ring->head );
+        size_t room = ring->size - used, contiguous = ring->size - ( head & ( ring->size - 1 ) );
+        ssize_t got;
+
+        if ( 0 == room )
+        {
+            ring_sleep( pump, ring, used, 0 );
+            continue;
+        }
+
+        if ( FAILURE == serial_read( pump->fd, pump->wake[0], pump->device, &ring->data[head & ( ring->size - 1 )],
+                                     ( room < contiguous ) ? room : contiguous, &got, -1, pump->error ) )
+        {
+            atomic_store( &pump->failed, true );
+            pump_alert( pump );
+            break;
+        }
+
+        if ( got > 0 )
+        {
+            atomic_store( &ring->head, head + got );
+            ring_wake( ring );
+        }
+    }
+
+    return NULL;
+}
+
+// Sends to the port whatever is queued in the tx ring
+//
+static void *writer( void *arg )
+{
+    pump_t *pump = arg;
+    pump_ring_t *ring = &pump->tx;
+
+    while ( ! atomic_load( &pump->stop ) )
+    {
+        size_t used = ring_used( ring ), tail = atomic_load( &ring->tail );
+        size_t contiguous = ring->size - ( tail & ( ring->size - 1 ) ), written;
+
+        if ( 0 == used )
+        {
+            ring_sleep( pump, ring, used, 0 );
+            continue;
+        }
+
+        if ( FAILURE == serial_write( pump->fd, pump->wake[0], pump->device, &ring->data[tail & ( ring->size - 1 )],
+                                      ( used < contiguous ) ? used : contiguous, &written, pump->error ) )
+        {
+            atomic_store( &pump->failed, true );
+            pump_alert( pump );
+            break;
+        }
+
+        atomic_store( &ring->tail, tail + written );
+        ring_wake( ring );
+    }
+
+    return NULL;
+}
+
+// Stops the first 'threads' of the reader and writer and frees everything
+//
+static status_t pump_end( pump_t *pump, int threads )
+{
+    status_t status = SUCCESS;
+
+    atomic_store( &pump->stop, true );
+
+    // The byte wakes up the reader from the port, the alert anybody on a ring
+    if ( 1 != write( pump->wake[1], "", 1 ) )
+    {
+        status = pump_error( pump, "Error %d stopping the I/O threads of %s: %s\n", errno, pump->device, strerror( errno ) );
+    }
+    pump_alert( pump );
+
+    if ( threads > 0 )
+    {
+        pthread_join( pump->reader, NULL );
+    }
+    if ( threads > 1 )
+    {
+        pthread_join( pump->writer, NULL );
+    }
+
+    ring_destroy( &pump->rx );
+    ring_destroy( &pump->tx );
+    close( pump->wake[0] );
+    close( pump->wake[1] );
+
+    return status;
+}
+
+// On failure, 'error' tells why
+//
+status_t pump_start( pump_t *pump, int fd, char *device, struct stats_s *stats )
+{
+    pump->fd = fd;
+    pump->device = device;
+    pump->stats = stats;
+    pump->running = false;
+    pump->error[0] = '\0';
+    atomic_init( &pump->stop, false );
+    atomic_init( &pump->failed, false );
+
+    if ( -1 == pipe( pump->wake ) )
+    {
+        return pump_error( pump, "Error %d creating the I/O threads of %s: %s\n", errno, device, strerror( errno ) );
+    }
+
+    if ( FAILURE == ring_init( &pump->rx, pump->rx_data, sizeof( pump->rx_data ) ) )
+    {
+        close( pump->wake[0] );
+        close( pump->wake[1] );
+        return pump_error( pump, "Error creating the I/O threads of %s\n", device );
+    }
+
+    if ( FAILURE == ring_init( &pump->tx, pump->tx_data, sizeof( pump->tx_data ) ) )
+    {
+        ring_destroy( &pump->rx );
+        close( pump->wake[0] );
+        close( pump->wake[1] );
+        return pump_error( pump, "Error creating the I/O threads of %s\n", device );
+    }
+
+    if ( pthread_create( &pump->reader, NULL, reader, pump ) )
+    {
+        pump_end( pump, 0 );
+        return pump_error( pump, "Error creating the I/O threads of %s\n", device );
+    }
+
+    if ( pthread_create( &pump->writer, NULL, writer, pump ) )
+    {
+        pump_end( pump, 1 );
+        return pump_error( pump, "Error creating the I/O threads of %s\n", device );
+    }
+
+    pump->running = true;
+
+    return SUCCESS;
+}
+
+// Stops the threads. Anything not sent yet is lost, see pump_sync()
+//
+status_t pump_stop( pump_t *pump )
+{
+    status_t status = SUCCESS;
+
+    if ( pump->running )
+    {
+        status = pump_end( pump, 2 );
+        pump->running = false;
+    }
+
+    return status;
+}
+
+// As serial_read(), from what the reader thread got
+//
+status_t pump_read( pump_t *pump, uint8_t *buffer, size_t bufsiz, ssize_t *returned, int timeout )
+{
+    pump_ring_t *ring = &pump->rx;
+    uint64_t deadline = serial_deadline( timeout );
+    size_t used, tail, first;
+
+    while ( 0 == ( used = ring_used( ring ) ) )
+    {
+        if ( atomic_load( &pump->failed ) )
+        {
+            return FAILURE;
+        }
+
+        if ( serial_deadline( 0 ) >= deadline )
+        {
+            *returned = 0;
+            return SUCCESS;
+        }
+
+        ring_sleep( pump, ring, 0, deadline );
+    }
+
+    used = ( used < bufsiz ) ? used : bufsiz;
+    tail = atomic_load( &ring->tail );
+    first = ring->size - ( tail & ( ring->size - 1 ) );
+    first = ( used < first ) ? used : first;
+
+    memcpy( buffer, &ring->data[tail & ( ring->size - 1 )], first );
+    memcpy( &buffer[first], ring->data, used - first );
+
+    atomic_store( &ring->tail, tail + used );
+    ring_wake( ring );
+
+    stats_read( pump->stats, used );
+    *returned = used;
+
+    return SUCCESS;
+}
+
+// Reads into 'buffer', after the '*len' bytes already there, until 'complete' finds a
+// whole message in it, the buffer is full or the deadline passes. '*msg_len' is the
+// length of the message, 0 if there is none yet. Anything after it stays in the buffer
+//
+status_t pump_read_until( pump_t *pump, uint8_t *buffer, size_t bufsiz, size_t *len,
+                          serial_complete_t complete, const void *arg, uint64_t deadline, size_t *msg_len )
+{
+    uint64_t now;
+    ssize_t returned;
+
+    while ( 0 == ( *msg_len = complete( buffer, *len, arg ) ) )
+    {
+        now = serial_deadline( 0 );
+
+        if ( now >= deadline || *len == bufsiz )
+        {
+            break;
+        }
+
+        if ( FAILURE == pump_read( pump, &buffer[*len], bufsiz - *len, &returned, deadline - now ) )
+        {
+            return FAILURE;
+        }
+
+        *len += returned;
+    }
+
+    return SUCCESS;
+}
+
+// Queues 'buffer' for the writer thread. Only waits if the tx ring is full
+//
+status_t pump_write( pump_t *pump, const uint8_t *buffer, size_t len )
+{
+    pump_ring_t *ring = &pump->tx;
+    uint64_t start = stats_now();
+    size_t done = 0;
+
+    while ( done < len )
+    {
+        size_t used = ring_used( ring ), head = atomic_load( &ring->head );
+        size_t n = ring->size - used, contiguous = ring->size - ( head & ( ring->size - 1 ) );
+
+        if ( atomic_load( &pump->failed ) )
+        {
+            return FAILURE;
+        }
+
+        if ( 0 == n )
+        {
+            ring_sleep( pump, ring, used, 0 );
+            continue;
+        }
+
+        n = ( n < contiguous ) ? n : contiguous;
+        n = ( n < len - done ) ? n : len - done;
+
+        memcpy( &ring->data[head & ( ring->size - 1 )], &buffer[done], n );
+        atomic_store( &ring->head, head + n );
+        ring_wake( ring );
+        done += n;
+    }
+
+    stats_written( pump->stats, len, start );
+
+    return SUCCESS;
+}
+
+// Waits until everything queued has been written to the port, before changing its
+// settings
+//
+status_t pump_sync( pump_t *pump )
+{
+    size_t used;
+
+    while ( 0 != ( used = ring_used( &pump->tx ) ) )
+    {
+        if ( atomic_load( &pump->failed ) )
+        {
+            return FAILURE;
+        }
+        ring_sleep( pump, &pump->tx, used, 0 );
+    }
+
+    return atomic_load( &pump->failed ) ? FAILURE : SUCCESS;
+}
+
+// Discards what was received and not read yet. Not reliable with all USB adapters
+//
+void pump_flush_input( pump_t *pump )
+{
+    serial_flush_input( pump->fd );
+    atomic_store( &pump->rx.tail, atomic_load( &pump->rx.head ) );
+    ring_wake( &pump->rx );
+}
@@ -0,0 +1,87 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Serial I/O threads
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PUMP_H
+#define PUMP_H
+
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "globals.h"
+#include "serial.h"
+
+struct stats_s;
+
+#define PUMP_RX_SIZE    65536       // Both a power of two
+#define PUMP_TX_SIZE    16384
+
+// Single producer, single consumer byte queue. Each index is moved by only one side
+// and runs free, it is masked when used
+typedef struct {
+    uint8_t *data;
+    size_t size;
+    atomic_size_t head;             // Moved by the producer
+    atomic_size_t tail;             // Moved by the consumer
+    atomic_bool waiting;            // A side sleeps until the other one moves its index
+    pthread_mutex_t lock;
+    pthread_cond_t moved;
+} pump_ring_t;
+
+// A reader and a writer thread on a serial port, so it is kept busy while the caller
+// decodes, prints or writes files
+typedef struct {
+    int fd;
+    char *device;
+    int wake[2];                    // Becomes readable to stop the threads
+    atomic_bool stop;
+    atomic_bool failed;             // A thread had an I/O error, the link is dead
+    char error[SERIAL_ERROR_SIZE];  // Why, set before 'failed' and left for the caller to report
+    struct stats_s *stats;          // Of the link, NULL if not kept
+    bool running;
+    pthread_t reader;
+    pthread_t writer;
+    pump_ring_t rx;
+    pump_ring_t tx;
+    uint8_t rx_data[PUMP_RX_SIZE];
+    uint8_t tx_data[PUMP_TX_SIZE];
+} pump_t;
+
+status_t pump_start( pump_t *pump, int fd, char *device, struct stats_s *stats );
+status_t pump_stop( pump_t *pump );
+status_t pump_read( pump_t *pump, uint8_t *buffer, size_t bufsiz, ssize_t *returned, int timeout );
+status_t pump_read_until( pump_t *pump, uint8_t *buffer, size_t bufsiz, size_t *len,
+                          serial_complete_t complete, const void *arg, uint64_t deadline, size_t *msg_len );
+status_t pump_write( pump_t *pump, const uint8_t *buffer, size_t len );
+status_t pump_sync( pump_t *pump );
+void pump_flush_input( pump_t *pump );
+
+#endif /* PUMP_H */
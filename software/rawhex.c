@@ -0,0 +1,158 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Raw ascii hex format support
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "globals.h"
+#include "files.h"
+#include "rawhex.h"
+#include "hex.h"
+
+#define RAWHEX_WRITE_BYTES_PER_LINE 32
+
+static bool is_space( char c )
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Nothing but hex digits and white space
+//
+bool rawhex_detect( const char *contents, size_t len )
+{
+    size_t digits = 0;
+
+    for ( size_t i = 0; i < len; ++i )
+    {
+        if ( hex_is_digit( contents[i] ) )
+        {
+            ++digits;
+        }
+        else if ( ! is_space( contents[i] ) )
+        {
+            return false;
+        }
+    }
+
+    return digits >= 2;
+}
+
+// Bytes as pairs of hex digits from address 0, with or without white space between
+// them, as written by "xxd -p"
+//
+status_t rawhex_parse( const char *contents, size_t len, image_t *image )
+{
+    const char *s = contents, *end = contents + len;
+    uint8_t bytes[256];
+    unsigned line = 1;
+    uint32_t address = 0;
+
+    while ( s < end )
+    {
+        size_t n;
+
+        if ( is_space( *s ) )
+        {
+            line += ( *s++ == '\n' );
+            continue;
+        }
+
+        n = hex_decode( s, bytes, sizeof( bytes ) );
+        s += n * 2;
+
+        // Short of the buffer, it stopped at something that is not a pair of digits
+        if ( 0 == n || ( n < sizeof( bytes ) && s < end && ! is_space( *s ) ) )
+        {
+            fprintf( stderr, hex_is_digit( *s ) ? "Malformed hex file: odd number of digits at line %u\n"
+                                                : "Malformed hex file: Invalid character at line %u\n", line );
+            return FAILURE;
+        }
+
+        if ( FAILURE == files_image_add( image, address, bytes, n ) )
+        {
+            return FAILURE;
+        }
+        address += n;
+    }
+
+    if ( 0 == address )
+    {
+        fputs( "Invalid file size\n", stderr );
+        return FAILURE;
+    }
+
+    return SUCCESS;
+}
+
+// Writes the pending data as a line
+//
+static status_t write_line( writer_t *writer )
+{
+    char line[2 * WRITER_LINE_SIZE + 1], *end;
+
+    end = hex_encode( line, writer->pending, writer->len );
+    *end++ = '\n';
+
+    if ( FAILURE == files_write( writer, line, end - line ) )
+    {
+        return FAILURE;
+    }
+
+    writer->address += writer->len;
+    writer->len = 0;
+
+    return SUCCESS;
+}
+
+status_t rawhex_put( writer_t *writer, const uint8_t *data, size_t len )
+{
+    for ( size_t i = 0; i < len; ++i )
+    {
+        writer->pending[writer->len++] = data[i];
+
+        if ( writer->len == RAWHEX_WRITE_BYTES_PER_LINE && FAILURE == write_line( writer ) )
+        {
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+status_t rawhex_close( writer_t *writer, status_t status )
+{
+    if ( SUCCESS == status && writer->len )
+    {
+        status = write_line( writer );
+    }
+
+    return files_close( writer, status );
+}
@@ -87,7 +87,6 @@ static int get_hexnum( int len, const char *s )
 
     for ( int pos = 0; pos < len; ++pos )
     {
-        int val;
         char c = s[pos];
 
         if ( !isxdigit( c ) )
@@ -106,7 +105,7 @@ int get_uint16( char *optarg, uint16_t *value )
 
     uint64_t number = strtoul( optarg, &endc, 0 );
 
-    if ( !( isblank( *++endc ) || *endc  ) || number > 0xffff )
+    if ( endc == optarg || *endc || number > 0xffff )
     {
         return EINVAL;
     }
@@ -116,6 +115,22 @@ int get_uint16( char *optarg, uint16_t *value )
     return 0;
 }
 
+int get_uint32( char *optarg, uint32_t *value )
+{
+    char *endc;
+
+    uint64_t number = strtoull( optarg, &endc, 0 );
+
+    if ( endc == optarg || *endc || number > 0xffffffff )
+    {
+        return EINVAL;
+    }
+
+    *value = (uint32_t) number;
+
+    return 0;
+}
+
 int get_uint8( char *optarg, uint8_t *value )
 {
     uint16_t number;
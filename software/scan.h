@@ -37,5 +37,6 @@ int get_hexword( const char *s, uint16_t *word );
 int get_octbyte( const char *s, uint8_t *byte );
 int get_uint8( const char *string, uint8_t *value );
 int get_uint16( const char *string, uint16_t *value );
+int get_uint32( const char *string, uint32_t *value );
 
 #endif
\ No newline at end of file
@@ -33,10 +33,55 @@
 #include <poll.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <errno.h>
+#include <time.h>
 
 #include "globals.h"
+#include "serial.h"
+
+static const struct {
+    uint32_t baud;
+    speed_t speed;
+} speeds[] = {
+    {   57600, B57600   },
+    {  115200, B115200  },
+    {  230400, B230400  },
+    {  460800, B460800  },
+    {  500000, B500000  },
+    {  921600, B921600  },
+    { 1000000, B1000000 },
+    { 0 }
+};
+
+static const speed_t *get_speed( uint32_t baud )
+{
+    for ( int i = 0; speeds[i].baud; ++i )
+    {
+        if ( speeds[i].baud == baud )
+        {
+            return &speeds[i].speed;
+        }
+    }
+
+    return NULL;
+}
+
+// Nothing is printed here: the reader and writer threads of pump.c call these too, so
+// the caller reports 'error' from its own thread
+//
+static status_t serial_error( char *error, const char *format, ... )
+{
+    va_list args;
+
+    va_start( args, format );
+    vsnprintf( error, SERIAL_ERROR_SIZE, format, args );
+    va_end( args );
+
+    return FAILURE;
+}
 
 static void serial_config( int fd )
 {
@@ -55,14 +100,13 @@ static void serial_config( int fd )
     tcsetattr( fd, TCSANOW, &cfg );
 }
 
-status_t serial_init( int *fd, char *device )
+status_t serial_init( int *fd, char *device, char *error )
 {
     *fd = open( device, O_RDWR | O_NOCTTY | O_SYNC | O_NONBLOCK );
     
     if ( *fd < 0 )
     {
-        fprintf( stderr, "Error %d opening %s: %s", errno, device, strerror( errno ) ) ;
-        return FAILURE;
+        return serial_error( error, "Error %d opening %s: %s\n", errno, device, strerror( errno ) );
     }
 
     serial_config( *fd );
@@ -70,65 +114,171 @@ status_t serial_init( int *fd, char *device )
     return SUCCESS;
 }
 
-
-status_t serial_read( int fd, char *device, uint8_t *buffer, size_t bufsiz, ssize_t *returned )
+// Waits up to 'timeout' ms, -1 for ever, for 'events' on 'fd' or for 'wake' to be
+// readable. 'wake' can be -1. Returns 0 if it timed out or was woken up
+//
+static int serial_poll( int fd, int wake, short events, struct pollfd *pfds, int timeout )
 {
-    struct pollfd pfds;
     int ret;
 
-    pfds.fd     = fd;
-    pfds.events = POLLIN;
+    pfds[0].fd     = fd;
+    pfds[0].events = events;
+    pfds[1].fd     = wake;
+    pfds[1].events = POLLIN;
+
+    while ( -1 == ( ret = poll( pfds, 2, timeout ) ) && errno == EINTR )
+        ;
+
+    return ( ret > 0 && 0 == pfds[0].revents ) ? 0 : ret;
+}
+
+// Waits up to 'timeout' ms, -1 for ever, for data and reads whatever is available.
+// Returns 0 bytes if nothing arrived or 'wake', if not -1, became readable
+//
+status_t serial_read( int fd, int wake, char *device, uint8_t *buffer, size_t bufsiz, ssize_t *returned, int timeout, char *error )
+{
+    struct pollfd pfds[2];
+    int ret = serial_poll( fd, wake, POLLIN, pfds, timeout );
 
-    if ( -1 == ( ret = poll( &pfds, 1, 2000 ) ) )
+    if ( -1 == ret )
     {
-        fprintf( stderr, "Error %d while polling port %s: %s\n", errno, device, strerror( errno ) );
-        return FAILURE;
+        return serial_error( error, "Error %d while polling port %s: %s\n", errno, device, strerror( errno ) );
     }
 
     if ( ret > 0 )
     {
-        //printf( "revents: %d\n", pfds.revents );
-        if ( pfds.revents & POLLIN )
+        if ( pfds[0].revents & POLLIN )
         {
-            *returned = read( pfds.fd, buffer, bufsiz );
+            *returned = read( fd, buffer, bufsiz );
 
             if ( *returned < 0 )
             {
-                fprintf( stderr, "Error %d reading from port %s: %s\n", errno, device, strerror( errno ) );
-                return FAILURE;
+                return serial_error( error, "Error %d reading from port %s: %s\n", errno, device, strerror( errno ) );
             }
-
-            buffer[*returned] = 0;
         }
         else
         {
-            fprintf( stderr, "Error: unexpected event(s): %s%sreceived when polling the %s port\n",
-                    ( pfds.revents & POLLHUP ) ? "POLLHUP " : "",
-                    ( pfds.revents & POLLERR ) ? "POLLERR " : "",
-                    device );
-            return FAILURE;
+            return serial_error( error, "Error: unexpected event(s): %s%sreceived when polling the %s port\n",
+                                ( pfds[0].revents & POLLHUP ) ? "POLLHUP " : "",
+                                ( pfds[0].revents & POLLERR ) ? "POLLERR " : "",
+                                device );
         }
     }
     else
     {
         *returned = 0;
-        *buffer = 0;
     }
 
     return SUCCESS;    
 }
 
-status_t serial_write( int fd, char *device, uint8_t *buffer, size_t len )
+static uint64_t now_ms( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (uint64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+uint64_t serial_deadline( unsigned int timeout )
+{
+    return now_ms() + timeout;
+}
+
+// Completion for pump_read_until(), for the version banner in protocol.c: up to and
+// including the first occurrence of the string pointed by 'arg'
+//
+size_t serial_until_terminator( const uint8_t *buffer, size_t len, const void *arg )
+{
+    const char *terminator = arg;
+    size_t term_len = strlen( terminator );
+
+    for ( size_t i = 0; i + term_len <= len; ++i )
+    {
+        if ( ! memcmp( &buffer[i], terminator, term_len ) )
+        {
+            return i + term_len;
+        }
+    }
+
+    return 0;
+}
+
+// Writes all of 'buffer', waiting for room in the port, which is non blocking. Stops
+// early, with 'written' less than 'len', if 'wake' becomes readable first
+//
+status_t serial_write( int fd, int wake, char *device, const uint8_t *buffer, size_t len, size_t *written, char *error )
+{
+    struct pollfd pfds[2];
+    ssize_t ret;
+    int ready;
+
+    for ( *written = 0; *written < len; *written += ret )
+    {
+        if ( -1 == ( ret = write( fd, &buffer[*written], len - *written ) ) )
+        {
+            if ( errno != EAGAIN && errno != EINTR )
+            {
+                return serial_error( error, "Error %d writing port %s: %s\n", errno, device, strerror( errno ) );
+            }
+
+            if ( -1 == ( ready = serial_poll( fd, wake, POLLOUT, pfds, -1 ) ) )
+            {
+                return serial_error( error, "Error %d while polling port %s: %s\n", errno, device, strerror( errno ) );
+            }
+
+            if ( 0 == ready )
+            {
+                break;
+            }
+
+            ret = 0;
+        }
+    }
+
+    return SUCCESS;
+}
+
+bool serial_speed_supported( uint32_t baud )
 {
-    if ( -1 == write( fd, buffer, len ) )
+    return NULL != get_speed( baud );
+}
+
+status_t serial_set_speed( int fd, char *device, uint32_t baud, char *error )
+{
+    const speed_t *speed = get_speed( baud );
+    struct termios cfg;
+
+    if ( NULL == speed )
+    {
+        return serial_error( error, "Error: Unsupported baud rate: %u\n", baud );
+    }
+
+    if ( -1 == tcgetattr( fd, &cfg ) )
     {
-        fprintf( stderr, "Error %d writing port %s: %s\n", errno, device, strerror( errno ) );
-        return FAILURE;       
+        return serial_error( error, "Error %d getting attributes of port %s: %s\n", errno, device, strerror( errno ) );
+    }
+
+    cfsetispeed( &cfg, *speed );
+    cfsetospeed( &cfg, *speed );
+
+    // Let any pending output go at the old speed
+    if ( -1 == tcsetattr( fd, TCSADRAIN, &cfg ) )
+    {
+        return serial_error( error, "Error %d setting speed of port %s: %s\n", errno, device, strerror( errno ) );
     }
 
     return SUCCESS;
 }
 
+// Discards any received data not read yet. Not reliable with all USB adapters
+//
+void serial_flush_input( int fd )
+{
+    tcflush( fd, TCIFLUSH );
+}
+
 void serial_close( int fd )
 {
     close( fd );
@@ -32,13 +32,25 @@
 #include <sys/types.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 #include "globals.h"
 
-void serial_config( int fd );
-status_t serial_init( int *fd, char *device );
-status_t serial_read( int fd, char *device, uint8_t *buffer, size_t bufsiz, ssize_t *returned );
-status_t serial_write( int fd, char *device, uint8_t *buffer, size_t len );
+#define SERIAL_DEFAULT_BAUD 57600
+#define SERIAL_ERROR_SIZE   128     // Of 'error', where the functions that fail tell why
+
+// Returns how many bytes of 'buffer' take up to the end of the first complete message,
+// or 0 if there is none yet
+typedef size_t (*serial_complete_t)( const uint8_t *buffer, size_t len, const void *arg );
+
+status_t serial_init( int *fd, char *device, char *error );
+status_t serial_read( int fd, int wake, char *device, uint8_t *buffer, size_t bufsiz, ssize_t *returned, int timeout, char *error );
+uint64_t serial_deadline( unsigned int timeout );
+size_t serial_until_terminator( const uint8_t *buffer, size_t len, const void *arg );
+status_t serial_write( int fd, int wake, char *device, const uint8_t *buffer, size_t len, size_t *written, char *error );
+status_t serial_set_speed( int fd, char *device, uint32_t baud, char *error );
+bool serial_speed_supported( uint32_t baud );
+void serial_flush_input( int fd );
 void serial_close( int fd );
 
 #endif /* SERIAL_H */
\ No newline at end of file
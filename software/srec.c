@@ -0,0 +1,293 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Motorola S-record format support
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "globals.h"
+#include "files.h"
+#include "srec.h"
+#include "hex.h"
+
+#define SREC_WRITE_BYTES_PER_LINE 32
+#define MAX_RECORD      256             // Count, address, data and checksum
+
+typedef struct {
+    image_t *image;
+    unsigned long records;              // Data records, for the count ones
+} parser_t;
+
+// Address bytes of each record type, 0 for the reserved one
+static const uint8_t address_len[10] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
+
+static bool is_eol( char c )
+{
+    return c == '\r' || c == '\n' || c == '\0';
+}
+
+// Parses a record at 's' and adds its data to the image. Returns where it ends
+//
+static const char *parse_record( const char *s, unsigned line, void *arg, bool *last )
+{
+    parser_t *parser = arg;
+    uint8_t record[MAX_RECORD];
+    uint8_t checksum = 0;
+    size_t total, done, alen;
+    uint32_t address = 0;
+    int type;
+
+    if ( 'S' != s[0] || s[1] < '0' || s[1] > '9' )
+    {
+        fprintf( stderr, "Malformed S-record file at line %u\n", line );
+        return NULL;
+    }
+    type = s[1] - '0';
+    s += 2;
+
+    if ( 1 != hex_decode( s, record, 1 ) || record[0] < ( alen = address_len[type] ) + 1 || 0 == alen )
+    {
+        fprintf( stderr, "Invalid record length or type in S-record file at line %u\n", line );
+        return NULL;
+    }
+
+    total = record[0] + 1;
+
+    if ( total != ( done = hex_decode( s, record, total ) ) )
+    {
+        fprintf( stderr, is_eol( s[done * 2] ) || is_eol( s[done * 2 + 1] ) ? "Malformed S-record file: line %u is too short\n"
+                                                                            : "Malformed S-record file: Invalid byte at line %u\n", line );
+        return NULL;
+    }
+    s += total * 2;
+
+    for ( size_t i = 0; i < total; ++i )
+    {
+        checksum += record[i];
+    }
+
+    if ( checksum != 0xFF )
+    {
+        fprintf( stderr, "Malformed S-record file: bad checksum at line %u\n", line );
+        return NULL;
+    }
+
+    while ( *s == ' ' || *s == '\t' )
+    {
+        ++s;
+    }
+
+    if ( ! is_eol( *s ) )
+    {
+        fprintf( stderr, "Malformed S-record file: line %u is too long\n", line );
+        return NULL;
+    }
+
+    for ( size_t i = 0; i < alen; ++i )
+    {
+        address = ( address << 8 ) | record[1 + i];
+    }
+
+    switch ( type )
+    {
+        case 1:
+        case 2:
+        case 3:
+            if ( FAILURE == files_image_add( parser->image, address, &record[1 + alen], total - alen - 2 ) )
+            {
+                fprintf( stderr, "Invalid data in S-record file at line %u\n", line );
+                return NULL;
+            }
+            ++parser->records;
+            break;
+
+        case 5:
+        case 6:
+            if ( address != parser->records )
+            {
+                fprintf( stderr, "S-record file has %lu data records, but line %u says %u\n", parser->records, line, address );
+                return NULL;
+            }
+            break;
+
+        case 7:
+        case 8:
+        case 9:
+            // Execution start address, meaningless here
+            *last = true;
+            break;
+
+        default:
+            // The header
+            break;
+    }
+
+    return s;
+}
+
+// Starts with a record type digit and hex digits
+//
+bool srec_detect( const char *contents, size_t len )
+{
+    while ( *contents == '\r' || *contents == '\n' )
+    {
+        ++contents;
+    }
+
+    if ( contents[0] != 'S' || contents[1] < '0' || contents[1] > '9' )
+    {
+        return false;
+    }
+
+    for ( int i = 2; i < 8; ++i )
+    {
+        if ( ! hex_is_digit( contents[i] ) )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// A single pass over the file contents. The termination record is optional
+//
+status_t srec_parse( const char *contents, size_t len, image_t *image )
+{
+    parser_t parser = { image, 0 };
+    bool complete;
+
+    return files_records( contents, parse_record, &parser, &complete );
+}
+
+// Writes a record of 'type' with the checksum
+//
+static status_t write_record( writer_t *writer, int type, uint32_t address, const uint8_t *data, size_t len )
+{
+    uint8_t header[5] = { address_len[type] + len + 1 };
+    char line[2 + 2 * ( sizeof( header ) + WRITER_LINE_SIZE + 1 ) + 1], *end = line;
+    uint8_t checksum = 0;
+
+    for ( int i = address_len[type]; i > 0; --i, address >>= 8 )
+    {
+        header[i] = address & 0xFF;
+    }
+
+    for ( int i = 0; i <= address_len[type]; ++i )
+    {
+        checksum += header[i];
+    }
+
+    for ( size_t i = 0; i < len; ++i )
+    {
+        checksum += data[i];
+    }
+    checksum = ~checksum;
+
+    *end++ = 'S';
+    *end++ = '0' + type;
+    end = hex_encode( end, header, 1 + address_len[type] );
+    end = hex_encode( end, data, len );
+    end = hex_encode( end, &checksum, 1 );
+    *end++ = '\n';
+
+    return files_write( writer, line, end - line );
+}
+
+// Smallest data record type for the addresses up to 'end'
+//
+static int data_type( uint64_t end )
+{
+    return ( end <= 0x10000 ) ? 1 : ( end <= 0x1000000 ) ? 2 : 3;
+}
+
+// Writes the pending data as a data record, after the header for the first one
+//
+static status_t write_data( writer_t *writer )
+{
+    if ( 0 == writer->records && FAILURE == write_record( writer, 0, 0, NULL, 0 ) )
+    {
+        return FAILURE;
+    }
+
+    if ( FAILURE == write_record( writer, data_type( writer->address + writer->len ), writer->address, writer->pending, writer->len ) )
+    {
+        return FAILURE;
+    }
+
+    writer->address += writer->len;
+    writer->len = 0;
+    ++writer->records;
+
+    return SUCCESS;
+}
+
+status_t srec_put( writer_t *writer, const uint8_t *data, size_t len )
+{
+    for ( size_t i = 0; i < len; ++i )
+    {
+        writer->pending[writer->len++] = data[i];
+
+        if ( writer->len == SREC_WRITE_BYTES_PER_LINE && FAILURE == write_data( writer ) )
+        {
+            return FAILURE;
+        }
+    }
+
+    return SUCCESS;
+}
+
+// Writes the last data record, the record count and the termination matching the
+// data records
+//
+status_t srec_close( writer_t *writer, status_t status )
+{
+    if ( SUCCESS == status && writer->len )
+    {
+        status = write_data( writer );
+    }
+
+    if ( SUCCESS == status && 0 == writer->records )
+    {
+        status = write_record( writer, 0, 0, NULL, 0 );
+    }
+
+    if ( SUCCESS == status && writer->records <= 0xFFFFFF )
+    {
+        status = write_record( writer, writer->records <= 0xFFFF ? 5 : 6, writer->records, NULL, 0 );
+    }
+
+    if ( SUCCESS == status )
+    {
+        status = write_record( writer, 10 - data_type( writer->address ), 0, NULL, 0 );
+    }
+
+    return files_close( writer, status );
+}
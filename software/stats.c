@@ -0,0 +1,379 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Timing statistics of the programmer session
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "globals.h"
+#include "stats.h"
+
+#define FIRST_BUCKET    250         // In us, upper limit of the first bucket
+
+// Nothing is kept without a 'stats', or until it is enabled
+//
+static bool kept( const stats_t *stats )
+{
+    return NULL != stats && stats->enabled;
+}
+
+void stats_init( stats_t *stats, bool enable )
+{
+    memset( stats, 0, sizeof( stats_t ) );
+    stats->enabled = enable;
+}
+
+uint64_t stats_now( void )
+{
+    struct timespec now;
+
+    clock_gettime( CLOCK_MONOTONIC, &now );
+
+    return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+// Wall time of a part of the session, from 'start'
+//
+void stats_phase( stats_t *stats, const char *name, uint64_t start, status_t status )
+{
+    if ( ! kept( stats ) || stats->num_phases == STATS_PHASES )
+    {
+        return;
+    }
+
+    stats->phases[stats->num_phases].name = name;
+    stats->phases[stats->num_phases].us = stats_now() - start;
+    stats->phases[stats->num_phases].status = status;
+    ++stats->num_phases;
+}
+
+void stats_retry( stats_t *stats, const char *what )
+{
+    int i;
+
+    if ( ! kept( stats ) )
+    {
+        return;
+    }
+
+    for ( i = 0; i < stats->num_retries && strcmp( stats->retries[i].what, what ); ++i )
+        ;
+
+    if ( i == stats->num_retries )
+    {
+        if ( stats->num_retries == STATS_RETRIES )
+        {
+            return;
+        }
+        stats->retries[stats->num_retries].what = what;
+        stats->retries[stats->num_retries++].count = 0;
+    }
+
+    ++stats->retries[i].count;
+}
+
+// A request is about to be written. Its response is expected after those of the
+// requests already in flight
+//
+void stats_request( stats_t *stats, char command )
+{
+    stats_pending_t *request;
+
+    if ( ! kept( stats ) )
+    {
+        return;
+    }
+
+    if ( stats->num_pending == STATS_PENDING )
+    {
+        // Forget the oldest one
+        stats->head = ( stats->head + 1 ) % STATS_PENDING;
+        --stats->num_pending;
+    }
+
+    request = &stats->pending[( stats->head + stats->num_pending++ ) % STATS_PENDING];
+    request->command = command & 0x7F;
+    request->sent = stats_now();
+    request->written = request->first = 0;
+}
+
+// From pump_write(), for the last request
+//
+void stats_written( stats_t *stats, size_t len, uint64_t start )
+{
+    stats_pending_t *request;
+    uint64_t now = stats_now();
+
+    if ( ! kept( stats ) || ! stats->num_pending )
+    {
+        return;
+    }
+
+    request = &stats->pending[( stats->head + stats->num_pending - 1 ) % STATS_PENDING];
+    request->written = now;
+    stats->commands[(int) request->command].write_us += now - start;
+    stats->commands[(int) request->command].bytes_out += len;
+}
+
+// From pump_read(), for the oldest request
+//
+void stats_read( stats_t *stats, size_t len )
+{
+    stats_pending_t *request;
+
+    if ( ! kept( stats ) || ! stats->num_pending || ! len )
+    {
+        return;
+    }
+
+    request = &stats->pending[stats->head];
+    stats->last_read = stats_now();
+
+    if ( 0 == request->first )
+    {
+        request->first = stats->last_read;
+    }
+    stats->commands[(int) request->command].bytes_in += len;
+}
+
+static int bucket( uint64_t us )
+{
+    int b = 0;
+
+    for ( uint64_t limit = FIRST_BUCKET; us >= limit && b < STATS_BUCKETS - 1; limit *= 2 )
+    {
+        ++b;
+    }
+
+    return b;
+}
+
+// The response to the oldest request is complete, or failed. If 'buffered', what
+// was read after it is the start of the next one. Returns 'status'
+//
+status_t stats_response( stats_t *stats, status_t status, bool buffered )
+{
+    stats_pending_t *request, *next;
+    stats_command_t *command;
+    uint64_t now = stats_now(), full;
+
+    if ( ! kept( stats ) || ! stats->num_pending )
+    {
+        return status;
+    }
+
+    request = &stats->pending[stats->head];
+    command = &stats->commands[(int) request->command];
+    full = now - request->sent;
+
+    ++command->count;
+    command->errors += ( FAILURE == status );
+    command->full_us += full;
+    command->max_us = ( full > command->max_us ) ? full : command->max_us;
+    ++command->histogram[bucket( full )];
+
+    if ( request->first && request->written )
+    {
+        command->first_us += ( request->first > request->written ) ? request->first - request->written : 0;
+        ++command->first_count;
+    }
+
+    stats->head = ( stats->head + 1 ) % STATS_PENDING;
+    --stats->num_pending;
+    next = &stats->pending[stats->head];
+
+    if ( FAILURE == status )
+    {
+        // Nothing in flight can be matched with its response anymore
+        stats->num_pending = 0;
+    }
+    else if ( buffered && stats->num_pending && 0 == next->first )
+    {
+        next->first = stats->last_read;
+    }
+
+    return status;
+}
+
+// The counters of the programmer itself, for the last command
+//
+void stats_programmer( stats_t *stats, const programmer_stats_t *counters )
+{
+    if ( kept( stats ) )
+    {
+        stats->programmer = *counters;
+        stats->have_programmer = true;
+    }
+}
+
+static double ms( uint64_t us )
+{
+    return us / 1000.0;
+}
+
+static void report_text( const stats_t *stats, FILE *file )
+{
+    fputs( "\nStatistics:\n", file );
+
+    for ( int i = 0; i < stats->num_phases; ++i )
+    {
+        fprintf( file, "  %-16s %10.1f ms%s\n", stats->phases[i].name, ms( stats->phases[i].us ), stats->phases[i].status == SUCCESS ? "" : "  (failed)" );
+    }
+
+    for ( int i = 0; i < stats->num_retries; ++i )
+    {
+        fprintf( file, "  %s retries: %lu\n", stats->retries[i].what, stats->retries[i].count );
+    }
+
+    fputs( "\n  Cmd  Count Errors  Bytes out   Bytes in  Write ms  First ms   Resp ms    Max ms\n", file );
+
+    for ( int c = 0; c < 128; ++c )
+    {
+        const stats_command_t *s = &stats->commands[c];
+
+        if ( 0 == s->count )
+        {
+            continue;
+        }
+
+        fprintf( file, "  %c  %6lu %6lu %10lu %10lu %9.3f %9.3f %9.3f %9.3f\n", c, s->count, s->errors,
+                    (unsigned long) s->bytes_out, (unsigned long) s->bytes_in, ms( s->write_us ) / s->count,
+                    s->first_count ? ms( s->first_us ) / s->first_count : 0.0, ms( s->full_us ) / s->count, ms( s->max_us ) );
+
+        fputs( "     ", file );
+        for ( int b = 0; b < STATS_BUCKETS; ++b )
+        {
+            if ( s->histogram[b] )
+            {
+                if ( b < STATS_BUCKETS - 1 )
+                {
+                    fprintf( file, " <%gms:%lu", ms( FIRST_BUCKET << b ), s->histogram[b] );
+                }
+                else
+                {
+                    fprintf( file, " more:%lu", s->histogram[b] );
+                }
+            }
+        }
+        fputc( '\n', file );
+    }
+
+    if ( stats->have_programmer )
+    {
+        fprintf( file, "\n  Programmer: %lu commands, %lu errors, %lu bytes read, %lu pulses, %.1f ms at 10.5V,"
+                       " %lu verify failures\n",
+                    (unsigned long) stats->programmer.commands, (unsigned long) stats->programmer.errors,
+                    (unsigned long) stats->programmer.bytes_read, (unsigned long) stats->programmer.pulses,
+                    ms( stats->programmer.pulse_time ), (unsigned long) stats->programmer.verify_failures );
+    }
+}
+
+static void report_json( const stats_t *stats, FILE *file )
+{
+    bool first = true;
+
+    fputs( "{\n  \"phases\": [", file );
+    for ( int i = 0; i < stats->num_phases; ++i )
+    {
+        fprintf( file, "%s\n    { \"name\": \"%s\", \"ms\": %.3f, \"status\": \"%s\" }", i ? "," : "",
+                    stats->phases[i].name, ms( stats->phases[i].us ), stats->phases[i].status == SUCCESS ? "ok" : "failed" );
+    }
+
+    fputs( "\n  ],\n  \"retries\": {", file );
+    for ( int i = 0; i < stats->num_retries; ++i )
+    {
+        fprintf( file, "%s \"%s\": %lu", i ? "," : "", stats->retries[i].what, stats->retries[i].count );
+    }
+
+    fputs( " },\n  \"commands\": [", file );
+    for ( int c = 0; c < 128; ++c )
+    {
+        const stats_command_t *s = &stats->commands[c];
+
+        if ( 0 == s->count )
+        {
+            continue;
+        }
+
+        fprintf( file, "%s\n    { \"command\": \"%c\", \"count\": %lu, \"errors\": %lu, \"bytes_out\": %lu, \"bytes_in\": %lu,"
+                       " \"total_write_ms\": %.3f, \"first_bytes\": %lu, \"total_first_byte_ms\": %.3f,\n"
+                       "      \"total_response_ms\": %.3f, \"max_response_ms\": %.3f,"
+                       " \"histogram\": [",
+                    first ? "" : ",", c, s->count, s->errors, (unsigned long) s->bytes_out, (unsigned long) s->bytes_in,
+                    ms( s->write_us ), s->first_count, ms( s->first_us ), ms( s->full_us ), ms( s->max_us ) );
+        first = false;
+
+        for ( int b = 0; b < STATS_BUCKETS; ++b )
+        {
+            if ( b < STATS_BUCKETS - 1 )
+            {
+                fprintf( file, "%s{ \"below_ms\": %g, \"count\": %lu }", b ? ", " : "", ms( FIRST_BUCKET << b ), s->histogram[b] );
+            }
+            else
+            {
+                fprintf( file, ", { \"below_ms\": null, \"count\": %lu }", s->histogram[b] );
+            }
+        }
+        fputs( "] }", file );
+    }
+
+    fputs( "\n  ]", file );
+
+    if ( stats->have_programmer )
+    {
+        fprintf( file, ",\n  \"programmer\": { \"commands\": %lu, \"errors\": %lu, \"bytes_read\": %lu, \"pulses\": %lu,"
+                       " \"pulse_ms\": %.3f, \"verify_failures\": %lu }",
+                    (unsigned long) stats->programmer.commands, (unsigned long) stats->programmer.errors,
+                    (unsigned long) stats->programmer.bytes_read, (unsigned long) stats->programmer.pulses,
+                    ms( stats->programmer.pulse_time ), (unsigned long) stats->programmer.verify_failures );
+    }
+
+    fputs( "\n}\n", file );
+}
+
+// Totals per phase and per command. Commands are the protocol ones, the letters
+// sent to the programmer
+//
+void stats_report( const stats_t *stats, FILE *file, bool json )
+{
+    if ( ! kept( stats ) )
+    {
+        return;
+    }
+
+    if ( json )
+    {
+        report_json( stats, file );
+    }
+    else
+    {
+        report_text( stats, file );
+    }
+}
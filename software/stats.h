@@ -0,0 +1,102 @@
+/*
+ * prom - A command-line utility to interface with the poor's man
+ *        National/TI Bipolar PROM Programmer
+ *  
+ * Timing statistics of the programmer session
+ * 
+ * (C) 2024 Eduardo Casino
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the “Software”), to deal in the Software without restriction,
+ * including without limitation the rights to use, copy, modify, merge,
+ * publish, distribute, sublicense, and/or sell copies of the Software,
+ * and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS”, WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "globals.h"
+#include "protocol.h"
+
+#define STATS_BUCKETS   16          // Response time histogram, from 250us doubling up
+#define STATS_PENDING   256         // Max requests in flight that are timed
+#define STATS_PHASES    16
+#define STATS_RETRIES   8
+
+typedef struct {
+    unsigned long count;
+    unsigned long errors;
+    uint64_t bytes_out;
+    uint64_t bytes_in;
+    uint64_t write_us;              // Time spent in write()
+    uint64_t first_us;              // From the end of the write to the first response byte
+    unsigned long first_count;
+    uint64_t full_us;               // From the start of the write to the whole response
+    uint64_t max_us;
+    unsigned long histogram[STATS_BUCKETS];
+} stats_command_t;
+
+typedef struct {
+    char command;
+    uint64_t sent;
+    uint64_t written;
+    uint64_t first;                 // 0 until the first byte arrives
+} stats_pending_t;
+
+// What is measured on a connection to a programmer, and the parts of the run that
+// uses it. Each session keeps its own, if any, see prom_config_t
+typedef struct stats_s {
+    bool enabled;
+    stats_command_t commands[128];
+    struct {
+        const char *name;
+        uint64_t us;
+        status_t status;
+    } phases[STATS_PHASES];
+    int num_phases;
+    struct {
+        const char *what;
+        unsigned long count;
+    } retries[STATS_RETRIES];
+    int num_retries;
+    programmer_stats_t programmer;
+    bool have_programmer;
+    stats_pending_t pending[STATS_PENDING]; // Requests waiting for their response, oldest first
+    unsigned head, num_pending;
+    uint64_t last_read;
+} stats_t;
+
+void stats_init( stats_t *stats, bool enable );
+uint64_t stats_now( void );
+
+void stats_phase( stats_t *stats, const char *name, uint64_t start, status_t status );
+void stats_retry( stats_t *stats, const char *what );
+
+void stats_request( stats_t *stats, char command );
+void stats_written( stats_t *stats, size_t len, uint64_t start );
+void stats_read( stats_t *stats, size_t len );
+status_t stats_response( stats_t *stats, status_t status, bool buffered );
+void stats_programmer( stats_t *stats, const programmer_stats_t *counters );
+
+void stats_report( const stats_t *stats, FILE *file, bool json );
+
+#endif /* STATS_H */